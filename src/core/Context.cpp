@@ -18,15 +18,17 @@
 
 #include <mutex>
 
-#include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
 
 #include "Context.h"
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
 #include "Program.h"
+#include "Scheduler.h"
+#include "ThreadPool.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
@@ -34,6 +36,7 @@
 #include "plugins/InteractiveDebugger.h"
 #include "plugins/Logger.h"
 #include "plugins/MemCheck.h"
+#include "plugins/Profiler.h"
 #include "plugins/RaceDetector.h"
 #include "plugins/Uninitialized.h"
 
@@ -42,18 +45,19 @@ using namespace std;
 
 Context::Context()
 {
-  m_llvmContext = new llvm::LLVMContext;
-
   m_globalMemory = new Memory(AddrSpaceGlobal, sizeof(size_t)==8 ? 16 : 8,
                               this);
-  m_kernelInvocation = NULL;
+  m_threadPool = new ThreadPool;
+  m_scheduler = new Scheduler(this);
 
   loadPlugins();
 }
 
 Context::~Context()
 {
-  delete m_llvmContext;
+  delete m_scheduler;
+  m_scheduler = NULL;
+  delete m_threadPool;
   delete m_globalMemory;
 
   unloadPlugins();
@@ -69,14 +73,29 @@ bool Context::isThreadSafe() const
   return true;
 }
 
+bool Context::supportsConcurrentKernels() const
+{
+  for (const PluginEntry &p : m_plugins)
+  {
+    if (!p.first->supportsConcurrentKernels())
+      return false;
+  }
+  return true;
+}
+
 Memory* Context::getGlobalMemory() const
 {
   return m_globalMemory;
 }
 
-llvm::LLVMContext* Context::getLLVMContext() const
+ThreadPool* Context::getThreadPool() const
 {
-  return m_llvmContext;
+  return m_threadPool;
+}
+
+Scheduler* Context::getScheduler() const
+{
+  return m_scheduler;
 }
 
 void Context::loadPlugins()
@@ -88,6 +107,9 @@ void Context::loadPlugins()
   if (checkEnv("OCLGRIND_INST_COUNTS"))
     m_plugins.push_back(make_pair(new InstructionCounter(this), true));
 
+  if (getenv("OCLGRIND_PROFILE"))
+    m_plugins.push_back(make_pair(new Profiler(this), true));
+
   if (checkEnv("OCLGRIND_DATA_RACES"))
     m_plugins.push_back(make_pair(new RaceDetector(this), true));
 
@@ -97,6 +119,7 @@ void Context::loadPlugins()
   if (checkEnv("OCLGRIND_INTERACTIVE"))
     m_plugins.push_back(make_pair(new InteractiveDebugger(this), true));
 
+  updateListeners();
 
   // Load dynamic plugins
   const char *dynamicPlugins = getenv("OCLGRIND_PLUGINS");
@@ -179,16 +202,42 @@ void Context::unloadPlugins()
   }
 
   m_plugins.clear();
+  updateListeners();
 }
 
 void Context::registerPlugin(Plugin *plugin)
 {
   m_plugins.push_back(make_pair(plugin, false));
+  updateListeners();
 }
 
 void Context::unregisterPlugin(Plugin *plugin)
 {
   m_plugins.remove(make_pair(plugin, false));
+  updateListeners();
+}
+
+void Context::updateListeners()
+{
+  for (unsigned c = 0; c < Plugin::NUM_CALLBACKS; c++)
+  {
+    m_listeners[c].clear();
+  }
+
+  for (const PluginEntry &p : m_plugins)
+  {
+    Plugin::CallbackMask callbacks = p.first->getCallbacks();
+
+    // Plugins that observe every instruction already see loads and stores
+    if (callbacks & (1 << Plugin::INSTRUCTION_EXECUTED))
+      callbacks &= ~(1 << Plugin::MEMORY_INSTRUCTION_EXECUTED);
+
+    for (unsigned c = 0; c < Plugin::NUM_CALLBACKS; c++)
+    {
+      if (callbacks & (1 << c))
+        m_listeners[c].push_back(p.first);
+    }
+  }
 }
 
 void Context::logError(const char* error) const
@@ -202,158 +251,214 @@ void Context::logError(const char* error) const
   msg.send();
 }
 
-#define NOTIFY(function, ...)                     \
-{                                                 \
-  PluginList::const_iterator pluginItr;           \
-  for (pluginItr = m_plugins.begin();             \
-       pluginItr != m_plugins.end(); pluginItr++) \
-  {                                               \
-    pluginItr->first->function(__VA_ARGS__);      \
-  }                                               \
+#define NOTIFY(callback, function, ...)                \
+{                                                      \
+  for (Plugin *plugin : m_listeners[Plugin::callback]) \
+  {                                                    \
+    plugin->function(__VA_ARGS__);                     \
+  }                                                    \
 }
 
+// Host-side notifications update plugin state that running kernels read
+// without synchronisation, so they must wait for those kernels to finish
+#define LOCK_HOST_NOTIFICATION(lock)                   \
+  unique_lock<mutex> lock;                             \
+  if (m_scheduler && !KernelInvocation::getCurrent())  \
+    lock = m_scheduler->lockExecution()
+
 void Context::notifyInstructionExecuted(const WorkItem *workItem,
                                         const llvm::Instruction *instruction,
                                         const TypedValue& result) const
 {
-  NOTIFY(instructionExecuted, workItem, instruction, result);
+  NOTIFY(INSTRUCTION_EXECUTED, instructionExecuted,
+         workItem, instruction, result);
+  if (llvm::isa<llvm::LoadInst>(instruction) ||
+      llvm::isa<llvm::StoreInst>(instruction))
+  {
+    NOTIFY(MEMORY_INSTRUCTION_EXECUTED, instructionExecuted,
+           workItem, instruction, result);
+  }
 }
 
 void Context::notifyKernelBegin(const KernelInvocation *kernelInvocation) const
 {
-  assert(m_kernelInvocation == NULL);
-  m_kernelInvocation = kernelInvocation;
+  assert(KernelInvocation::getCurrent() == kernelInvocation);
 
-  NOTIFY(kernelBegin, kernelInvocation);
+  NOTIFY(KERNEL_BEGIN, kernelBegin, kernelInvocation);
 }
 
 void Context::notifyKernelEnd(const KernelInvocation *kernelInvocation) const
 {
-  NOTIFY(kernelEnd, kernelInvocation);
+  NOTIFY(KERNEL_END, kernelEnd, kernelInvocation);
 
-  assert(m_kernelInvocation == kernelInvocation);
-  m_kernelInvocation = NULL;
+  assert(KernelInvocation::getCurrent() == kernelInvocation);
 }
 
 void Context::notifyMemoryAllocated(const Memory *memory, size_t address,
                                     size_t size, cl_mem_flags flags,
                                     const uint8_t *initData) const
 {
-  NOTIFY(memoryAllocated, memory, address, size, flags, initData);
+  if (!hasListeners(Plugin::MEMORY_ALLOCATED))
+    return;
+
+  LOCK_HOST_NOTIFICATION(lock);
+  NOTIFY(MEMORY_ALLOCATED, memoryAllocated,
+         memory, address, size, flags, initData);
 }
 
 void Context::notifyMemoryAtomicLoad(const Memory *memory, AtomicOp op,
                                      size_t address, size_t size) const
 {
-  if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
+  if (!hasListeners(Plugin::MEMORY_ATOMIC_LOAD))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation && kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
-           op, address, size);
+    NOTIFY(MEMORY_ATOMIC_LOAD, memoryAtomicLoad,
+           memory, kernelInvocation->getCurrentWorkItem(), op, address, size);
   }
 }
 
 void Context::notifyMemoryAtomicStore(const Memory *memory, AtomicOp op,
                                       size_t address, size_t size) const
 {
-  if (m_kernelInvocation && m_kernelInvocation->getCurrentWorkItem())
+  if (!hasListeners(Plugin::MEMORY_ATOMIC_STORE))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation && kernelInvocation->getCurrentWorkItem())
   {
-    NOTIFY(memoryAtomicStore, memory, m_kernelInvocation->getCurrentWorkItem(),
-           op, address, size);
+    NOTIFY(MEMORY_ATOMIC_STORE, memoryAtomicStore,
+           memory, kernelInvocation->getCurrentWorkItem(), op, address, size);
   }
 }
 
 void Context::notifyMemoryDeallocated(const Memory *memory,
                                       size_t address) const
 {
-  NOTIFY(memoryDeallocated, memory, address);
+  if (!hasListeners(Plugin::MEMORY_DEALLOCATED))
+    return;
+
+  LOCK_HOST_NOTIFICATION(lock);
+  NOTIFY(MEMORY_DEALLOCATED, memoryDeallocated, memory, address);
 }
 
 void Context::notifyMemoryLoad(const Memory *memory, size_t address,
                                size_t size) const
 {
-  if (m_kernelInvocation)
+  if (!hasListeners(Plugin::MEMORY_LOAD) &&
+      !hasListeners(Plugin::HOST_MEMORY_LOAD))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation)
   {
-    if (m_kernelInvocation->getCurrentWorkItem())
+    if (kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkItem(),
-             address, size);
+      NOTIFY(MEMORY_LOAD, memoryLoad,
+             memory, kernelInvocation->getCurrentWorkItem(), address, size);
     }
-    else if (m_kernelInvocation->getCurrentWorkGroup())
+    else if (kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryLoad, memory, m_kernelInvocation->getCurrentWorkGroup(),
-             address, size);
+      NOTIFY(MEMORY_LOAD, memoryLoad,
+             memory, kernelInvocation->getCurrentWorkGroup(), address, size);
     }
   }
   else
   {
-    NOTIFY(hostMemoryLoad, memory, address, size);
+    LOCK_HOST_NOTIFICATION(lock);
+    NOTIFY(HOST_MEMORY_LOAD, hostMemoryLoad, memory, address, size);
   }
 }
 
+void Context::notifyMemoryLoad(const Memory *memory, const WorkItem *workItem,
+                               size_t address, size_t size) const
+{
+  NOTIFY(MEMORY_LOAD, memoryLoad, memory, workItem, address, size);
+}
+
 void Context::notifyMemoryMap(const Memory *memory, size_t address,
                               size_t offset, size_t size,
                               cl_mem_flags flags) const
 {
-  NOTIFY(memoryMap, memory, address, offset, size, flags);
+  NOTIFY(MEMORY_MAP, memoryMap, memory, address, offset, size, flags);
 }
 
 void Context::notifyMemoryStore(const Memory *memory, size_t address,
                                 size_t size, const uint8_t *storeData) const
 {
-  if (m_kernelInvocation)
+  if (!hasListeners(Plugin::MEMORY_STORE) &&
+      !hasListeners(Plugin::HOST_MEMORY_STORE))
+    return;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  if (kernelInvocation)
   {
-    if (m_kernelInvocation->getCurrentWorkItem())
+    if (kernelInvocation->getCurrentWorkItem())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkItem(),
+      NOTIFY(MEMORY_STORE, memoryStore,
+             memory, kernelInvocation->getCurrentWorkItem(),
              address, size, storeData);
     }
-    else if (m_kernelInvocation->getCurrentWorkGroup())
+    else if (kernelInvocation->getCurrentWorkGroup())
     {
-      NOTIFY(memoryStore, memory, m_kernelInvocation->getCurrentWorkGroup(),
+      NOTIFY(MEMORY_STORE, memoryStore,
+             memory, kernelInvocation->getCurrentWorkGroup(),
              address, size, storeData);
     }
   }
   else
   {
-    NOTIFY(hostMemoryStore, memory, address, size, storeData);
+    LOCK_HOST_NOTIFICATION(lock);
+    NOTIFY(HOST_MEMORY_STORE, hostMemoryStore,
+           memory, address, size, storeData);
   }
 }
 
+void Context::notifyMemoryStore(const Memory *memory, const WorkItem *workItem,
+                                size_t address, size_t size,
+                                const uint8_t *storeData) const
+{
+  NOTIFY(MEMORY_STORE, memoryStore,
+         memory, workItem, address, size, storeData);
+}
+
 void Context::notifyMessage(MessageType type, const char *message) const
 {
-  NOTIFY(log, type, message);
+  NOTIFY(LOG, log, type, message);
 }
 
 void Context::notifyMemoryUnmap(const Memory *memory, size_t address,
                                 const void *ptr) const
 {
-  NOTIFY(memoryUnmap, memory, address, ptr);
+  NOTIFY(MEMORY_UNMAP, memoryUnmap, memory, address, ptr);
 }
 
 void Context::notifyWorkGroupBarrier(const WorkGroup *workGroup,
                                      uint32_t flags) const
 {
-  NOTIFY(workGroupBarrier, workGroup, flags);
+  NOTIFY(WORK_GROUP_BARRIER, workGroupBarrier, workGroup, flags);
 }
 
 void Context::notifyWorkGroupBegin(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupBegin, workGroup);
+  NOTIFY(WORK_GROUP_BEGIN, workGroupBegin, workGroup);
 }
 
 void Context::notifyWorkGroupComplete(const WorkGroup *workGroup) const
 {
-  NOTIFY(workGroupComplete, workGroup);
+  NOTIFY(WORK_GROUP_COMPLETE, workGroupComplete, workGroup);
 }
 
 void Context::notifyWorkItemBegin(const WorkItem *workItem) const
 {
-  NOTIFY(workItemBegin, workItem);
+  NOTIFY(WORK_ITEM_BEGIN, workItemBegin, workItem);
 }
 
 void Context::notifyWorkItemComplete(const WorkItem *workItem) const
 {
-  NOTIFY(workItemComplete, workItem);
+  NOTIFY(WORK_ITEM_COMPLETE, workItemComplete, workItem);
 }
 
 #undef NOTIFY
@@ -363,7 +468,7 @@ Context::Message::Message(MessageType type, const Context *context)
 {
   m_type             = type;
   m_context          = context;
-  m_kernelInvocation = context->m_kernelInvocation;
+  m_kernelInvocation = KernelInvocation::getCurrent();
 }
 
 Context::Message& Context::Message::operator<<(const special& id)
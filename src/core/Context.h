@@ -7,17 +7,14 @@
 // source code.
 
 #include "common.h"
-
-namespace llvm
-{
-  class LLVMContext;
-}
+#include "Plugin.h"
 
 namespace oclgrind
 {
   class KernelInvocation;
   class Memory;
-  class Plugin;
+  class Scheduler;
+  class ThreadPool;
   class WorkGroup;
   class WorkItem;
 
@@ -31,8 +28,10 @@ namespace oclgrind
     virtual ~Context();
 
     Memory* getGlobalMemory() const;
-    llvm::LLVMContext* getLLVMContext() const;
+    Scheduler* getScheduler() const;
+    ThreadPool* getThreadPool() const;
     bool isThreadSafe() const;
+    bool supportsConcurrentKernels() const;
     void logError(const char* error) const;
 
     // Simulation callbacks
@@ -51,10 +50,15 @@ namespace oclgrind
     void notifyMemoryDeallocated(const Memory *memory, size_t address) const;
     void notifyMemoryLoad(const Memory *memory, size_t address,
                           size_t size) const;
+    void notifyMemoryLoad(const Memory *memory, const WorkItem *workItem,
+                          size_t address, size_t size) const;
     void notifyMemoryMap(const Memory *memory, size_t address,
                          size_t offset, size_t size, cl_map_flags flags) const;
     void notifyMemoryStore(const Memory *memory, size_t address, size_t size,
                            const uint8_t *storeData) const;
+    void notifyMemoryStore(const Memory *memory, const WorkItem *workItem,
+                           size_t address, size_t size,
+                           const uint8_t *storeData) const;
     void notifyMessage(MessageType type, const char *message) const;
     void notifyMemoryUnmap(const Memory *memory, size_t address,
                            const void *ptr) const;
@@ -70,8 +74,14 @@ namespace oclgrind
     void registerPlugin(Plugin *plugin);
     void unregisterPlugin(Plugin *plugin);
 
+    // Check whether any plugin subscribes to a callback, so that callers
+    // can skip building its arguments
+    bool hasListeners(Plugin::Callback callback) const
+    {
+      return !m_listeners[callback].empty();
+    }
+
   private:
-    mutable const KernelInvocation *m_kernelInvocation;
     Memory *m_globalMemory;
 
     PluginList m_plugins;
@@ -79,7 +89,12 @@ namespace oclgrind
     void loadPlugins();
     void unloadPlugins();
 
-    llvm::LLVMContext *m_llvmContext;
+    // Plugins subscribed to each callback
+    std::vector<Plugin*> m_listeners[Plugin::NUM_CALLBACKS];
+    void updateListeners();
+
+    ThreadPool *m_threadPool;
+    Scheduler *m_scheduler;
 
   public:
     class Message
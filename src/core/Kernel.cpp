@@ -18,6 +18,7 @@
 
 #include "Kernel.h"
 #include "Program.h"
+#include "WorkItem.h"
 
 using namespace oclgrind;
 using namespace std;
@@ -81,6 +82,9 @@ Kernel::Kernel(const Program *program,
     }
   }
 
+  // Check whether work-items can run independently of each other
+  m_barrierFree = !program->getInterpreterCache(function)->hasWorkGroupSync();
+
   // Get metadata node containing kernel arg info
   m_metadata = NULL;
   llvm::NamedMDNode *md = module->getNamedMetadata("opencl.kernels");
@@ -112,6 +116,7 @@ Kernel::Kernel(const Kernel& kernel)
   m_name = kernel.m_name;
   m_metadata = kernel.m_metadata;
   m_requiresUniformWorkGroups = kernel.m_requiresUniformWorkGroups;
+  m_barrierFree = kernel.m_barrierFree;
 
   for (auto itr = kernel.m_values.begin(); itr != kernel.m_values.end(); itr++)
   {
@@ -416,6 +421,11 @@ void Kernel::getRequiredWorkGroupSize(size_t reqdWorkGroupSize[3]) const
   }
 }
 
+bool Kernel::isBarrierFree() const
+{
+  return m_barrierFree;
+}
+
 bool Kernel::requiresUniformWorkGroups() const
 {
   return m_requiresUniformWorkGroups;
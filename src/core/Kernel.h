@@ -50,6 +50,7 @@ namespace oclgrind
     unsigned int getNumArguments() const;
     const Program* getProgram() const;
     void getRequiredWorkGroupSize(size_t reqdWorkGroupSize[3]) const;
+    bool isBarrierFree() const;
     bool requiresUniformWorkGroups() const;
     void setArgument(unsigned int index, TypedValue value);
 
@@ -62,6 +63,7 @@ namespace oclgrind
     TypedValueMap m_values;
 
     bool m_requiresUniformWorkGroups;
+    bool m_barrierFree;
 
     const llvm::Argument* getArgument(unsigned int index) const;
     const llvm::Metadata* getArgumentMetadata(std::string name,
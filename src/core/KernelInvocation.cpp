@@ -8,7 +8,6 @@
 
 #include "common.h"
 
-#include <atomic>
 #include <sstream>
 #include <thread>
 
@@ -17,6 +16,7 @@
 #include "KernelInvocation.h"
 #include "Memory.h"
 #include "Program.h"
+#include "ThreadPool.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
@@ -26,11 +26,14 @@ using namespace std;
 struct
 {
   int id;
+  const KernelInvocation *invocation;
   WorkGroup *workGroup;
   WorkItem  *workItem;
-} static THREAD_LOCAL workerState;
 
-static atomic<unsigned> nextGroupIndex;
+  // Chunk of work-group indices claimed from the worker's queue
+  size_t chunkBegin;
+  size_t chunkEnd;
+} static THREAD_LOCAL workerState;
 
 KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
                                    unsigned int workDim,
@@ -60,28 +63,26 @@ KernelInvocation::KernelInvocation(const Context *context, const Kernel *kernel,
   if (!m_numWorkers || !m_context->isThreadSafe())
     m_numWorkers = 1;
 
+  // Run work-items straight through if the kernel has no barriers
+  // The interactive debugger needs every work-item to be switchable
+  m_barrierFree = m_kernel->isBarrierFree() &&
+                  !checkEnv("OCLGRIND_INTERACTIVE");
+
+  // Check for lane-batched execution of barrier-free kernels
+  m_numLanes = getEnvInt("OCLGRIND_LANES", 1, false);
+  if (!m_numLanes || !m_barrierFree)
+    m_numLanes = 1;
+
   // Check for quick-mode environment variable
   if (checkEnv("OCLGRIND_QUICK"))
   {
     // Only run first and last work-groups in quick-mode
-    Size3 firstGroup(0, 0, 0);
-    Size3 lastGroup(m_numGroups.x-1, m_numGroups.y-1, m_numGroups.z-1);
-    m_workGroups.push_back(firstGroup);
-    if (lastGroup != firstGroup)
-      m_workGroups.push_back(lastGroup);
+    size_t numGroups = m_numGroups.x*m_numGroups.y*m_numGroups.z;
+    m_numPendingGroups = numGroups > 1 ? 2 : 1;
   }
   else
   {
-    for (size_t k = 0; k < m_numGroups.z; k++)
-    {
-      for (size_t j = 0; j < m_numGroups.y; j++)
-      {
-        for (size_t i = 0; i < m_numGroups.x; i++)
-        {
-          m_workGroups.push_back(Size3(i, j, k));
-        }
-      }
-    }
+    m_numPendingGroups = m_numGroups.x*m_numGroups.y*m_numGroups.z;
   }
 }
 
@@ -110,6 +111,11 @@ const WorkItem* KernelInvocation::getCurrentWorkItem() const
   return workerState.workItem;
 }
 
+bool KernelInvocation::isBarrierFree() const
+{
+  return m_barrierFree;
+}
+
 Size3 KernelInvocation::getGlobalOffset() const
 {
   return m_globalOffset;
@@ -130,6 +136,11 @@ Size3 KernelInvocation::getLocalSize() const
   return m_localSize;
 }
 
+unsigned KernelInvocation::getNumLanes() const
+{
+  return m_numLanes;
+}
+
 Size3 KernelInvocation::getNumGroups() const
 {
   return m_numGroups;
@@ -153,30 +164,134 @@ void KernelInvocation::run(const Context *context, Kernel *kernel,
                                               localSize);
 
   // Run kernel
+  const KernelInvocation *previous = workerState.invocation;
+  workerState.invocation = ki;
   context->notifyKernelBegin(ki);
   ki->run();
   context->notifyKernelEnd(ki);
+  workerState.invocation = previous;
 
   delete ki;
 }
 
-void KernelInvocation::run()
+const KernelInvocation* KernelInvocation::getCurrent()
 {
-  nextGroupIndex = 0;
+  return workerState.invocation;
+}
 
-  // Create worker threads
-  // TODO: Run in main thread if only 1 worker
-  vector<thread> threads;
-  for (unsigned i = 0; i < m_numWorkers; i++)
+Size3 KernelInvocation::getGroupID(size_t index) const
+{
+  if (m_numPendingGroups < m_numGroups.x*m_numGroups.y*m_numGroups.z)
+  {
+    // Quick-mode only runs first and last work-groups
+    if (index == 0)
+      return Size3(0, 0, 0);
+    return Size3(m_numGroups.x-1, m_numGroups.y-1, m_numGroups.z-1);
+  }
+
+  return Size3(index % m_numGroups.x,
+               (index / m_numGroups.x) % m_numGroups.y,
+               index / (m_numGroups.x * m_numGroups.y));
+}
+
+bool KernelInvocation::getNextGroupIndex(size_t& index)
+{
+  while (true)
+  {
+    // Take next work-group from current chunk
+    if (workerState.chunkBegin < workerState.chunkEnd)
+    {
+      index = workerState.chunkBegin++;
+
+      // Skip work-groups already started by switchWorkItem()
+      if (!m_claimedGroups.empty() && m_claimedGroups.count(index))
+        continue;
+
+      return true;
+    }
+
+    // Claim a new chunk from the front of this worker's queue
+    // Chunks shrink as the queue drains so that the tail remains stealable
+    WorkerQueue& queue = m_workerQueues[workerState.id];
+    {
+      lock_guard<mutex> lock(queue.mutex);
+      size_t remaining = queue.end - queue.begin;
+      if (remaining)
+      {
+        size_t chunk = min(max(remaining / (4*m_numWorkers), (size_t)1),
+                           (size_t)64);
+        workerState.chunkBegin = queue.begin;
+        workerState.chunkEnd   = queue.begin + chunk;
+        queue.begin += chunk;
+        continue;
+      }
+    }
+
+    if (!stealGroups(workerState.id))
+      return false;
+  }
+}
+
+bool KernelInvocation::stealGroups(int id)
+{
+  while (true)
   {
-    threads.push_back(thread(&KernelInvocation::runWorker, this, i));
+    // Find the worker with the most remaining work-groups
+    unsigned victim = 0;
+    size_t largest = 0;
+    for (unsigned i = 0; i < m_numWorkers; i++)
+    {
+      if (i == (unsigned)id)
+        continue;
+
+      WorkerQueue& queue = m_workerQueues[i];
+      lock_guard<mutex> lock(queue.mutex);
+      if (queue.end - queue.begin > largest)
+      {
+        largest = queue.end - queue.begin;
+        victim = i;
+      }
+    }
+
+    if (!largest)
+      return false;
+
+    // Steal the back half of the victim's queue
+    size_t begin, end;
+    {
+      WorkerQueue& queue = m_workerQueues[victim];
+      lock_guard<mutex> lock(queue.mutex);
+      size_t remaining = queue.end - queue.begin;
+      if (!remaining)
+        // Victim drained while we were looking, try again
+        continue;
+
+      end   = queue.end;
+      begin = queue.end - (remaining+1)/2;
+      queue.end = begin;
+    }
+
+    WorkerQueue& queue = m_workerQueues[id];
+    lock_guard<mutex> lock(queue.mutex);
+    queue.begin = begin;
+    queue.end   = end;
+    return true;
   }
+}
 
-  // Wait for workers to complete
+void KernelInvocation::run()
+{
+  // Give each worker a contiguous range of work-groups
+  m_workerQueues = vector<WorkerQueue>(m_numWorkers);
   for (unsigned i = 0; i < m_numWorkers; i++)
   {
-    threads[i].join();
+    m_workerQueues[i].begin = (m_numPendingGroups*i) / m_numWorkers;
+    m_workerQueues[i].end   = (m_numPendingGroups*(i+1)) / m_numWorkers;
   }
+
+  // Run workers on the context's thread pool
+  m_context->getThreadPool()->run(m_numWorkers,
+                                  [this](unsigned id){ runWorker(id); });
 }
 
 int KernelInvocation::getWorkerID() const
@@ -186,9 +301,14 @@ int KernelInvocation::getWorkerID() const
 
 void KernelInvocation::runWorker(int id)
 {
+  // Threads may run workers for several concurrent kernels in turn
+  const KernelInvocation *previous = workerState.invocation;
+  workerState.invocation = this;
   workerState.workGroup = NULL;
   workerState.workItem = NULL;
   workerState.id = id;
+  workerState.chunkBegin = 0;
+  workerState.chunkEnd = 0;
   try
   {
     while (true)
@@ -203,12 +323,12 @@ void KernelInvocation::runWorker(int id)
       else
       {
         // Take next work-group from pending pool
-        unsigned index = nextGroupIndex++;
-        if (index >= m_workGroups.size())
+        size_t index;
+        if (!getNextGroupIndex(index))
           // No more work to do
           break;
 
-        Size3 wgid   = m_workGroups[index];
+        Size3 wgid   = getGroupID(index);
         Size3 wgsize = m_localSize;
 
         // Handle remainder work-groups
@@ -223,7 +343,10 @@ void KernelInvocation::runWorker(int id)
       }
 
       // Execute work-group
-      workerState.workItem = workerState.workGroup->getNextWorkItem();
+      if (workerState.workGroup->getNumLanes() > 1)
+        runLanes();
+      else
+        workerState.workItem = workerState.workGroup->getNextWorkItem();
       while (workerState.workItem)
       {
         // Run work-item until complete or at barrier
@@ -264,6 +387,39 @@ void KernelInvocation::runWorker(int id)
     if (workerState.workGroup)
       delete workerState.workGroup;
   }
+
+  workerState.invocation = previous;
+}
+
+void KernelInvocation::runLanes()
+{
+  vector<WorkItem*> lanes;
+  while (workerState.workGroup->getNextLanes(lanes))
+  {
+    // Advance lanes in lockstep while they execute the same instruction
+    while (WorkItem::isLockstep(lanes.data(), lanes.size()))
+    {
+      if (WorkItem::stepLanes(lanes.data(), lanes.size()))
+        continue;
+
+      for (unsigned l = 0; l < lanes.size(); l++)
+      {
+        workerState.workItem = lanes[l];
+        lanes[l]->step();
+      }
+    }
+
+    // Lanes have diverged or finished, so complete them one at a time
+    for (unsigned l = 0; l < lanes.size(); l++)
+    {
+      workerState.workItem = lanes[l];
+      while (lanes[l]->getState() == WorkItem::READY)
+      {
+        lanes[l]->step();
+      }
+    }
+  }
+  workerState.workItem = NULL;
 }
 
 bool KernelInvocation::switchWorkItem(const Size3 gid)
@@ -299,26 +455,26 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
   }
 
   // Check if work-group is in pending pool
+  // Safe since this is not in a multi-threaded context
   if (!found)
   {
-    std::vector<Size3>::iterator pItr;
-    for (pItr = m_workGroups.begin()+nextGroupIndex;
-         pItr != m_workGroups.end(); pItr++)
+    size_t first = min(workerState.chunkBegin, m_workerQueues[0].begin);
+    size_t last  = m_workerQueues[0].end;
+    for (size_t index = first; index < last; index++)
     {
-     if (group == *pItr)
-     {
-       workerState.workGroup = new WorkGroup(this, group);
-       m_context->notifyWorkGroupBegin(workerState.workGroup);
-       found = true;
-
-       // Re-order list of groups accordingly
-       // Safe since this is not in a multi-threaded context
-       m_workGroups.erase(pItr);
-       m_workGroups.insert(m_workGroups.begin()+nextGroupIndex, group);
-       nextGroupIndex++;
-
-       break;
-     }
+      if (index >= workerState.chunkEnd && index < m_workerQueues[0].begin)
+        continue;
+      if (m_claimedGroups.count(index) || group != getGroupID(index))
+        continue;
+
+      workerState.workGroup = new WorkGroup(this, group);
+      m_context->notifyWorkGroupBegin(workerState.workGroup);
+      found = true;
+
+      // Make sure the work-group is not started again later
+      m_claimedGroups.insert(index);
+
+      break;
     }
   }
 
@@ -327,14 +483,25 @@ bool KernelInvocation::switchWorkItem(const Size3 gid)
     return false;
   }
 
+  // Get work-item
+  Size3 lid(gid.x%m_localSize.x, gid.y%m_localSize.y, gid.z%m_localSize.z);
+  WorkItem *workItem = workerState.workGroup->getWorkItem(lid);
+  if (!workItem)
+  {
+    // Work-item has finished and its state has been released
+    if (previousWorkGroup != workerState.workGroup)
+    {
+      m_runningGroups.push_back(workerState.workGroup);
+      workerState.workGroup = previousWorkGroup;
+    }
+    return false;
+  }
+
   if (previousWorkGroup != workerState.workGroup)
   {
     m_runningGroups.push_back(previousWorkGroup);
   }
-
-  // Get work-item
-  Size3 lid(gid.x%m_localSize.x, gid.y%m_localSize.y, gid.z%m_localSize.z);
-  workerState.workItem = workerState.workGroup->getWorkItem(lid);
+  workerState.workItem = workItem;
 
   return true;
 }
@@ -8,6 +8,8 @@
 
 #include "common.h"
 
+#include <mutex>
+
 namespace oclgrind
 {
   class Context;
@@ -24,6 +26,9 @@ namespace oclgrind
                     Size3 globalSize,
                     Size3 localSize);
 
+    // Kernel invocation being run by the calling thread, if any
+    static const KernelInvocation* getCurrent();
+
     const Context* getContext() const;
     const WorkGroup* getCurrentWorkGroup() const;
     const WorkItem* getCurrentWorkItem() const;
@@ -32,7 +37,9 @@ namespace oclgrind
     Size3 getLocalSize() const;
     const Kernel* getKernel() const;
     Size3 getNumGroups() const;
+    unsigned getNumLanes() const;
     size_t getWorkDim() const;
+    bool isBarrierFree() const;
     bool switchWorkItem(const Size3 gid);
 
     int getWorkerID() const;
@@ -54,13 +61,31 @@ namespace oclgrind
     Size3  m_globalSize;
     Size3  m_localSize;
     Size3  m_numGroups;
+    bool   m_barrierFree;
+    unsigned m_numLanes;
 
     // Current execution state
-    std::vector<Size3>    m_workGroups;
+    size_t                m_numPendingGroups;
+    std::set<size_t>      m_claimedGroups;
     std::list<WorkGroup*> m_runningGroups;
 
+    // Range of linear work-group indices owned by a worker
+    // Owners take chunks from the front, thieves steal from the back
+    struct WorkerQueue
+    {
+      std::mutex mutex;
+      size_t begin;
+      size_t end;
+    };
+    std::vector<WorkerQueue> m_workerQueues;
+
+    Size3 getGroupID(size_t index) const;
+    bool getNextGroupIndex(size_t& index);
+    bool stealGroups(int id);
+
     // Worker threads
     void runWorker(int id);
+    void runLanes();
     unsigned m_numWorkers;
   };
 }
@@ -27,6 +27,80 @@ mutex atomicMutex[NUM_ATOMIC_MUTEXES];
 #define ATOMIC_MUTEX(offset) \
   atomicMutex[(((offset)>>2) & (NUM_ATOMIC_MUTEXES-1))]
 
+// Use lock-free atomic builtins for naturally aligned global atomics
+#if defined(__GNUC__) || defined(__clang__)
+#define HAVE_NATIVE_ATOMICS 1
+#else
+#define HAVE_NATIVE_ATOMICS 0
+#endif
+
+#if HAVE_NATIVE_ATOMICS
+template<typename T>
+static T nativeAtomic(AtomicOp op, T *ptr, T value)
+{
+  switch(op)
+  {
+  case AtomicAdd:
+    return __atomic_fetch_add(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicAnd:
+    return __atomic_fetch_and(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicCmpXchg:
+    FATAL_ERROR("AtomicCmpXchg in generic atomic handler");
+  case AtomicDec:
+    return __atomic_fetch_sub(ptr, 1, __ATOMIC_SEQ_CST);
+  case AtomicInc:
+    return __atomic_fetch_add(ptr, 1, __ATOMIC_SEQ_CST);
+  case AtomicMax:
+  case AtomicMin:
+  {
+    T old = __atomic_load_n(ptr, __ATOMIC_RELAXED);
+    T desired;
+    do
+    {
+      if (op == AtomicMax)
+        desired = old > value ? old : value;
+      else
+        desired = old < value ? old : value;
+    }
+    while (!__atomic_compare_exchange_n(ptr, &old, desired, true,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return old;
+  }
+  case AtomicOr:
+    return __atomic_fetch_or(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicSub:
+    return __atomic_fetch_sub(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicXchg:
+    return __atomic_exchange_n(ptr, value, __ATOMIC_SEQ_CST);
+  case AtomicXor:
+    return __atomic_fetch_xor(ptr, value, __ATOMIC_SEQ_CST);
+  }
+
+  // Unreachable
+  assert(false);
+  return 0;
+}
+#endif
+
+// Cache of buffer translations for the loads and stores of each worker
+// Entries are tagged with the memory's generation, which changes whenever
+// one of its buffers is released
+#define NUM_TRANSLATIONS 8 // Must be power of two
+namespace
+{
+  struct Translation
+  {
+    const Memory *memory;
+    size_t generation;
+    size_t buffer;
+    unsigned char *data;
+    size_t size;
+  };
+  THREAD_LOCAL Translation translations[NUM_TRANSLATIONS];
+}
+
+atomic<size_t> Memory::m_nextGeneration(1);
+
 Memory::Memory(unsigned addrSpace, unsigned bufferBits, const Context *context)
 {
   m_context = context;
@@ -37,6 +111,14 @@ Memory::Memory(unsigned addrSpace, unsigned bufferBits, const Context *context)
   m_maxNumBuffers = ((size_t)1 << m_numBitsBuffer) - 1; // 0 reserved for NULL
   m_maxBufferSize = ((size_t)1 << m_numBitsAddress);
 
+  m_nativeAtomics = HAVE_NATIVE_ATOMICS &&
+                    !checkEnv("OCLGRIND_DISABLE_NATIVE_ATOMICS");
+
+  // The host may create global buffers while a queue is running a kernel,
+  // so make sure the buffer table is never reallocated underneath it
+  if (addrSpace == AddrSpaceGlobal)
+    m_memory.reserve(m_maxNumBuffers);
+
   clear();
 }
 
@@ -55,6 +137,7 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
   }
 
   // Find first unallocated buffer slot
+  unique_lock<mutex> lock = lockBuffers();
   unsigned b = getNextBuffer();
   if (b >= m_maxNumBuffers)
   {
@@ -77,6 +160,8 @@ size_t Memory::allocateBuffer(size_t size, cl_mem_flags flags,
   }
 
   m_totalAllocated += size;
+  if (lock)
+    lock.unlock();
 
   // Initialize contents of buffer
   if (initData)
@@ -113,6 +198,15 @@ T Memory::atomic(AtomicOp op, size_t address, T value)
   Buffer *buffer = m_memory[extractBuffer(address)];
   T *ptr = (T*)(buffer->data + offset);
 
+#if HAVE_NATIVE_ATOMICS
+  // Use lock-free builtins unless the address is misaligned
+  if (m_addressSpace == AddrSpaceGlobal && m_nativeAtomics &&
+      ((uintptr_t)ptr % sizeof(T)) == 0)
+  {
+    return nativeAtomic(op, ptr, value);
+  }
+#endif
+
   if (m_addressSpace == AddrSpaceGlobal)
     ATOMIC_MUTEX(offset).lock();
 
@@ -179,6 +273,22 @@ T Memory::atomicCmpxchg(size_t address, T cmp, T value)
   Buffer *buffer = m_memory[extractBuffer(address)];
   T *ptr = (T *)(buffer->data + offset);
 
+#if HAVE_NATIVE_ATOMICS
+  // Use lock-free builtins unless the address is misaligned
+  if (m_addressSpace == AddrSpaceGlobal && m_nativeAtomics &&
+      ((uintptr_t)ptr % sizeof(T)) == 0)
+  {
+    T old = cmp;
+    if (__atomic_compare_exchange_n(ptr, &old, value, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+    {
+      m_context->notifyMemoryAtomicStore(this, AtomicCmpXchg,
+                                         address, sizeof(T));
+    }
+    return old;
+  }
+#endif
+
   if (m_addressSpace == AddrSpaceGlobal)
     ATOMIC_MUTEX(offset).lock();
 
@@ -218,6 +328,7 @@ void Memory::clear()
   m_memory[0] = NULL;
   m_freeBuffers = queue<unsigned>();
   m_totalAllocated = 0;
+  m_generation = m_nextGeneration++;
 }
 
 size_t Memory::createHostBuffer(size_t size, void *ptr, cl_mem_flags flags)
@@ -229,6 +340,7 @@ size_t Memory::createHostBuffer(size_t size, void *ptr, cl_mem_flags flags)
   }
 
   // Find first unallocated buffer slot
+  unique_lock<mutex> lock = lockBuffers();
   unsigned b = getNextBuffer();
   if (b >= m_maxNumBuffers)
   {
@@ -251,6 +363,8 @@ size_t Memory::createHostBuffer(size_t size, void *ptr, cl_mem_flags flags)
   }
 
   m_totalAllocated += size;
+  if (lock)
+    lock.unlock();
 
   size_t address = ((size_t)b) << m_numBitsAddress;
 
@@ -293,6 +407,7 @@ bool Memory::copy(size_t dst, size_t src, size_t size)
 
 void Memory::deallocateBuffer(size_t address)
 {
+  unique_lock<mutex> lock = lockBuffers();
   unsigned buffer = extractBuffer(address);
   assert(buffer < m_memory.size() && m_memory[buffer]);
 
@@ -306,6 +421,9 @@ void Memory::deallocateBuffer(size_t address)
 
   delete m_memory[buffer];
   m_memory[buffer] = NULL;
+  m_generation = m_nextGeneration++;
+  if (lock)
+    lock.unlock();
 
   m_context->notifyMemoryDeallocated(this, address);
 }
@@ -334,6 +452,27 @@ void Memory::dump() const
   cout << endl;
 }
 
+// Write the contents of each buffer in binary, as its 64-bit address and
+// size followed by its data
+void Memory::dump(ostream& output) const
+{
+  for (unsigned b = 1; b < m_memory.size(); b++)
+  {
+    if (!m_memory[b] || !m_memory[b]->data)
+    {
+      continue;
+    }
+
+    uint64_t header[2] =
+    {
+      ((uint64_t)b)<<m_numBitsAddress,
+      m_memory[b]->size
+    };
+    output.write((const char*)header, sizeof(header));
+    output.write((const char*)m_memory[b]->data, m_memory[b]->size);
+  }
+}
+
 size_t Memory::extractBuffer(size_t address) const
 {
   return (address >> m_numBitsAddress);
@@ -365,6 +504,13 @@ size_t Memory::getMaxAllocSize()
   return m_maxBufferSize;
 }
 
+unique_lock<mutex> Memory::lockBuffers()
+{
+  if (m_addressSpace == AddrSpaceGlobal)
+    return unique_lock<mutex>(m_bufferMutex);
+  return unique_lock<mutex>();
+}
+
 unsigned Memory::getNextBuffer()
 {
   if (m_freeBuffers.empty())
@@ -431,6 +577,24 @@ bool Memory::load(unsigned char *dest, size_t address, size_t size) const
   return true;
 }
 
+bool Memory::load(unsigned char *dest, size_t address, size_t size,
+                  const WorkItem *workItem) const
+{
+  m_context->notifyMemoryLoad(this, workItem, address, size);
+
+  // Bounds check
+  unsigned char *src = translate(address, size);
+  if (!src)
+  {
+    return false;
+  }
+
+  // Load data
+  memcpy(dest, src, size);
+
+  return true;
+}
+
 void* Memory::mapBuffer(size_t address, size_t offset, size_t size)
 {
   size_t buffer = extractBuffer(address);
@@ -463,3 +627,52 @@ bool Memory::store(const unsigned char *source, size_t address, size_t size)
 
   return true;
 }
+
+bool Memory::store(const unsigned char *source, size_t address, size_t size,
+                   const WorkItem *workItem)
+{
+  m_context->notifyMemoryStore(this, workItem, address, size, source);
+
+  // Bounds check
+  unsigned char *dst = translate(address, size);
+  if (!dst)
+  {
+    return false;
+  }
+
+  // Store data
+  memcpy(dst, source, size);
+
+  return true;
+}
+
+unsigned char* Memory::translate(size_t address, size_t size) const
+{
+  size_t buffer = extractBuffer(address);
+  size_t offset = extractOffset(address);
+
+  // Only valid buffers are cached, so a miss falls back to the same checks
+  // as isAddressValid()
+  Translation& translation = translations[buffer & (NUM_TRANSLATIONS-1)];
+  size_t generation = m_generation.load(memory_order_acquire);
+  if (translation.memory != this || translation.buffer != buffer ||
+      translation.generation != generation)
+  {
+    if (buffer == 0 || buffer >= m_memory.size() || !m_memory[buffer])
+    {
+      return NULL;
+    }
+
+    translation.memory = this;
+    translation.generation = generation;
+    translation.buffer = buffer;
+    translation.data = m_memory[buffer]->data;
+    translation.size = m_memory[buffer]->size;
+  }
+
+  if (offset+size > translation.size)
+  {
+    return NULL;
+  }
+  return translation.data + offset;
+}
@@ -8,9 +8,13 @@
 
 #include "common.h"
 
+#include <atomic>
+#include <mutex>
+
 namespace oclgrind
 {
   class Context;
+  class WorkItem;
 
   class Memory
   {
@@ -35,6 +39,7 @@ namespace oclgrind
     bool copy(size_t dest, size_t src, size_t size);
     void deallocateBuffer(size_t address);
     void dump() const;
+    void dump(std::ostream& output) const;
     unsigned int getAddressSpace() const;
     const Buffer* getBuffer(size_t address) const;
     void* getPointer(size_t address) const;
@@ -44,6 +49,13 @@ namespace oclgrind
     void* mapBuffer(size_t address, size_t offset, size_t size);
     bool store(const unsigned char *source, size_t address, size_t size=1);
 
+    // Loads and stores performed by a work-item, which translate addresses
+    // through a per-worker cache of recently used buffers
+    bool load(unsigned char *dst, size_t address, size_t size,
+              const WorkItem *workItem) const;
+    bool store(const unsigned char *source, size_t address, size_t size,
+               const WorkItem *workItem);
+
     size_t extractBuffer(size_t address) const;
     size_t extractOffset(size_t address) const;
 
@@ -56,11 +68,24 @@ namespace oclgrind
     unsigned int m_addressSpace;
     size_t m_totalAllocated;
 
+    // Global buffers are allocated by host threads and program builds
+    // concurrently, so updates to the buffer table are serialised
+    std::mutex m_bufferMutex;
+    std::unique_lock<std::mutex> lockBuffers();
+
     unsigned m_numBitsBuffer;
     unsigned m_numBitsAddress;
     size_t m_maxNumBuffers;
     size_t m_maxBufferSize;
 
+    bool m_nativeAtomics;
+
+    // Changes whenever a buffer is released, invalidating cached
+    // translations for this memory
+    std::atomic<size_t> m_generation;
+    static std::atomic<size_t> m_nextGeneration;
+
     unsigned getNextBuffer();
+    unsigned char* translate(size_t address, size_t size) const;
   };
 }
@@ -19,7 +19,19 @@ Plugin::~Plugin()
 {
 }
 
+Plugin::CallbackMask Plugin::getCallbacks() const
+{
+  return ALL_CALLBACKS;
+}
+
 bool Plugin::isThreadSafe() const
 {
   return true;
 }
+
+bool Plugin::supportsConcurrentKernels() const
+{
+  // Most plugins keep state for a single kernel between kernelBegin() and
+  // kernelEnd(), so they must opt in to overlapping kernel invocations
+  return false;
+}
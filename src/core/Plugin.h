@@ -22,6 +22,34 @@ namespace oclgrind
   class Plugin
   {
   public:
+    // Callbacks that a plugin can subscribe to
+    enum Callback
+    {
+      HOST_MEMORY_LOAD,
+      HOST_MEMORY_STORE,
+      INSTRUCTION_EXECUTED,
+      MEMORY_INSTRUCTION_EXECUTED, // instructionExecuted() for loads/stores
+      KERNEL_BEGIN,
+      KERNEL_END,
+      LOG,
+      MEMORY_ALLOCATED,
+      MEMORY_ATOMIC_LOAD,
+      MEMORY_ATOMIC_STORE,
+      MEMORY_DEALLOCATED,
+      MEMORY_LOAD,
+      MEMORY_MAP,
+      MEMORY_STORE,
+      MEMORY_UNMAP,
+      WORK_GROUP_BARRIER,
+      WORK_GROUP_BEGIN,
+      WORK_GROUP_COMPLETE,
+      WORK_ITEM_BEGIN,
+      WORK_ITEM_COMPLETE,
+      NUM_CALLBACKS
+    };
+    typedef uint32_t CallbackMask;
+    static const CallbackMask ALL_CALLBACKS = (1u << NUM_CALLBACKS) - 1;
+
     Plugin(const Context *context);
     virtual ~Plugin();
 
@@ -66,7 +94,12 @@ namespace oclgrind
     virtual void workItemBegin(const WorkItem *workItem){}
     virtual void workItemComplete(const WorkItem *workItem){}
 
+    // Callbacks the context should invoke, queried when the plugin is
+    // registered, as a mask of (1 << Callback) bits
+    virtual CallbackMask getCallbacks() const;
+
     virtual bool isThreadSafe() const;
+    virtual bool supportsConcurrentKernels() const;
 
   protected:
     const Context *m_context;
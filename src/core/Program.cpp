@@ -9,6 +9,8 @@
 #include "config.h"
 #include "common.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 
 #if defined(_WIN32) && !defined(__MINGW32__)
@@ -17,6 +19,8 @@
 #include <dlfcn.h>
 #endif
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
 #include "llvm/IR/AssemblyAnnotationWriter.h"
@@ -25,13 +29,23 @@
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Transforms/IPO/PassManagerBuilder.h"
-#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/InstCombine/InstCombine.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Utils.h"
 #include "clang/CodeGen/CodeGenAction.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/TextDiagnosticPrinter.h"
+#include "clang/Frontend/Utils.h"
 #include "clang/Lex/PreprocessorOptions.h"
 
 #include "Context.h"
@@ -45,6 +59,15 @@
 #define IR_DUMP_NAME "/tmp/oclgrind_%lX.s"
 #define BC_DUMP_NAME "/tmp/oclgrind_%lX.bc"
 
+#define ENV_OPTIMIZE_IR "OCLGRIND_OPTIMIZE_IR"
+
+#define ENV_CACHE_DIR "OCLGRIND_CACHE_DIR"
+#define ENV_CACHE_SIZE "OCLGRIND_CACHE_SIZE"
+#define ENV_CACHE_STATS "OCLGRIND_CACHE_STATS"
+#define DEFAULT_CACHE_SIZE 256
+#define CACHE_EXTENSION ".cache"
+#define CACHE_MAGIC "OCLGRIND-CACHE-1\n"
+
 #if defined(_WIN32)
 #define REMAP_DIR "Z:/remapped/"
 #else
@@ -71,16 +94,54 @@ const char *EXTENSIONS[] =
 using namespace oclgrind;
 using namespace std;
 
-Program::Program(const Context *context, llvm::Module *module)
-  : m_module(module), m_context(context)
+// Persistent program cache statistics, reported at exit if requested
+static struct ProgramCacheStats
 {
-  m_buildLog = "";
-  m_buildOptions = "";
-  m_buildStatus = CL_BUILD_SUCCESS;
-  m_uid = generateUID();
-  m_totalProgramScopeVarSize = 0;
+  atomic<size_t> hits;
+  atomic<size_t> misses;
+
+  ProgramCacheStats() : hits(0), misses(0) {}
+  ~ProgramCacheStats()
+  {
+    if (checkEnv(ENV_CACHE_STATS) && (hits || misses))
+    {
+      cerr << endl
+           << "Program cache statistics:" << endl
+           << "  Hits:   " << hits << endl
+           << "  Misses: " << misses << endl;
+    }
+  }
+} cacheStats;
+
+namespace
+{
+  // Records the files that a build includes from disk, since the cache
+  // key only covers the program source and remapped headers
+  class IncludeCollector : public clang::DependencyCollector
+  {
+  public:
+    bool sawDependency(llvm::StringRef filename, bool fromModule,
+                       bool isSystem, bool isModuleFile,
+                       bool isMissing) override
+    {
+      // Skip remapped files and the inputs of the precompiled header
+      return !fromModule && !isModuleFile && !isMissing &&
+             filename != REMAP_INPUT && !filename.startswith(REMAP_DIR);
+    }
+  };
+}
 
-  allocateProgramScopeVars();
+// Get the SHA1 hash of the contents of a file
+static bool hashFile(const string& filename, string& hash)
+{
+  llvm::ErrorOr<unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(filename);
+  if (!buffer)
+    return false;
+
+  hash = llvm::toHex(llvm::SHA1::hash(
+    llvm::arrayRefFromStringRef(buffer->get()->getBuffer())), true);
+  return true;
 }
 
 Program::Program(const Context *context, const string& source)
@@ -251,6 +312,8 @@ bool Program::build(const char *options, list<Header> headers)
     clearInterpreterCache();
     m_module.reset();
   }
+  m_binary.clear();
+  m_llvmContext.reset(new llvm::LLVMContext);
 
   // Assign a new UID to this program
   m_uid = generateUID();
@@ -478,9 +541,26 @@ bool Program::build(const char *options, list<Header> headers)
   buffer = llvm::MemoryBuffer::getMemBuffer(m_source, "", false);
   compiler.getPreprocessorOpts().addRemappedFile(REMAP_INPUT, buffer.release());
 
+  // Check persistent program cache
+  string cacheFile;
+  const char *cacheDir = getenv(ENV_CACHE_DIR);
+  shared_ptr<IncludeCollector> includes = make_shared<IncludeCollector>();
+  if (cacheDir && strlen(cacheDir))
+  {
+    cacheFile = getCacheFilename(cacheDir, args, headers);
+    compiler.addDependencyCollector(includes);
+  }
+
   // Compile
-  clang::EmitLLVMOnlyAction action(m_context->getLLVMContext());
-  if (compiler.ExecuteAction(action))
+  clang::EmitLLVMOnlyAction action(m_llvmContext.get());
+  size_t logStart = buildLog.str().size();
+  if (!cacheFile.empty() && loadCachedModule(cacheFile, buildLog))
+  {
+    allocateProgramScopeVars();
+
+    m_buildStatus = CL_BUILD_SUCCESS;
+  }
+  else if (compiler.ExecuteAction(action))
   {
     // Retrieve module
     m_module = action.takeModule();
@@ -491,8 +571,19 @@ bool Program::build(const char *options, list<Header> headers)
       stripDebugIntrinsics();
     }
 
+    if (checkEnv(ENV_OPTIMIZE_IR))
+    {
+      optimize(buildLog);
+    }
+
     removeLValueLoads();
 
+    if (!cacheFile.empty())
+    {
+      storeCachedModule(cacheFile, buildLog.str().substr(logStart),
+                        includes->getDependencies());
+    }
+
     allocateProgramScopeVars();
 
     m_buildStatus = CL_BUILD_SUCCESS;
@@ -556,6 +647,7 @@ bool Program::build(const char *options, list<Header> headers)
 
 void Program::clearInterpreterCache()
 {
+  lock_guard<mutex> lock(m_interpreterCacheMutex);
   InterpreterCacheMap::iterator itr;
   for (itr = m_interpreterCache.begin(); itr != m_interpreterCache.end(); itr++)
   {
@@ -564,28 +656,39 @@ void Program::clearInterpreterCache()
   m_interpreterCache.clear();
 }
 
-Program* Program::createFromBitcode(const Context *context,
-                                    const unsigned char *bitcode,
-                                    size_t length)
+Program* Program::createFromBinary(const Context *context, string binary)
 {
-  // Load bitcode from file
-  llvm::StringRef data((const char*)bitcode, length);
-  unique_ptr<llvm::MemoryBuffer> buffer =
-    llvm::MemoryBuffer::getMemBuffer(data, "", false);
-  if (!buffer)
-  {
-    return NULL;
-  }
+  Program *program = new Program(context, "");
+  program->m_llvmContext.reset(new llvm::LLVMContext);
+  program->m_binary = std::move(binary);
 
-  // Parse bitcode into IR module
+  // Parse bitcode into IR module, leaving function bodies to be
+  // materialised when the first kernel is created
+  unique_ptr<llvm::MemoryBuffer> buffer =
+    llvm::MemoryBuffer::getMemBuffer(program->m_binary, "", false);
   llvm::Expected<unique_ptr<llvm::Module>> module =
-    parseBitcodeFile(buffer->getMemBufferRef(), *context->getLLVMContext());
+    llvm::getOwningLazyBitcodeModule(std::move(buffer),
+                                     *program->m_llvmContext);
   if (!module)
   {
+    llvm::consumeError(module.takeError());
+    delete program;
     return NULL;
   }
 
-  return new Program(context, module.get().release());
+  program->m_module = std::move(module.get());
+  program->m_buildStatus = CL_BUILD_SUCCESS;
+  program->m_uid = program->generateUID();
+  program->allocateProgramScopeVars();
+
+  return program;
+}
+
+Program* Program::createFromBitcode(const Context *context,
+                                    const unsigned char *bitcode,
+                                    size_t length)
+{
+  return createFromBinary(context, string((const char*)bitcode, length));
 }
 
 Program* Program::createFromBitcodeFile(const Context *context,
@@ -599,37 +702,46 @@ Program* Program::createFromBitcodeFile(const Context *context,
     return NULL;
   }
 
-  // Parse bitcode into IR module
-  llvm::Expected<unique_ptr<llvm::Module>> module =
-    parseBitcodeFile(buffer->get()->getMemBufferRef(),
-                     *context->getLLVMContext());
-  if (!module)
-  {
-    return NULL;
-  }
-
-  return new Program(context, module.get().release());
+  return createFromBinary(context, buffer->get()->getBuffer().str());
 }
 
 Program* Program::createFromPrograms(const Context *context,
                                      list<const Program*> programs)
 {
-  llvm::Module *module = new llvm::Module("oclgrind_linked",
-                                          *context->getLLVMContext());
-  llvm::Linker linker(*module);
+  Program *program = new Program(context, "");
+  program->m_llvmContext.reset(new llvm::LLVMContext);
+  program->m_module.reset(
+    new llvm::Module("oclgrind_linked", *program->m_llvmContext));
+  llvm::Linker linker(*program->m_module);
 
   // Link modules
   list<const Program*>::iterator itr;
   for (itr = programs.begin(); itr != programs.end(); itr++)
   {
-    unique_ptr<llvm::Module> m = llvm::CloneModule(*(*itr)->m_module);
-    if (linker.linkInModule(std::move(m)))
+    // Input modules live in the LLVM contexts of their own programs, so
+    // they are copied into this program's context through their bitcode
+    llvm::MemoryBufferRef bitcode((*itr)->serialize(), "");
+    llvm::Expected<unique_ptr<llvm::Module>> module =
+      parseBitcodeFile(bitcode, *program->m_llvmContext);
+    if (!module)
     {
+      llvm::consumeError(module.takeError());
+      delete program;
+      return NULL;
+    }
+
+    if (linker.linkInModule(std::move(module.get())))
+    {
+      delete program;
       return NULL;
     }
   }
 
-  return new Program(context, module);
+  program->m_buildStatus = CL_BUILD_SUCCESS;
+  program->m_uid = program->generateUID();
+  program->allocateProgramScopeVars();
+
+  return program;
 }
 
 Kernel* Program::createKernel(const string name)
@@ -658,10 +770,19 @@ Kernel* Program::createKernel(const string name)
   try
   {
     // Create cache if none already
-    InterpreterCacheMap::iterator itr = m_interpreterCache.find(function);
-    if (itr == m_interpreterCache.end())
     {
-      m_interpreterCache[function] = new InterpreterCache(function);
+      lock_guard<mutex> lock(m_interpreterCacheMutex);
+      if (!materializeKernels())
+      {
+        cerr << "Failed to load kernel '" << name << "' from binary"
+             << endl;
+        return NULL;
+      }
+      InterpreterCacheMap::iterator itr = m_interpreterCache.find(function);
+      if (itr == m_interpreterCache.end())
+      {
+        m_interpreterCache[function] = new InterpreterCache(function);
+      }
     }
 
     return new Kernel(this, function, m_module.get());
@@ -677,6 +798,59 @@ Kernel* Program::createKernel(const string name)
   }
 }
 
+// Serialise the module, once per build
+const string& Program::serialize() const
+{
+  lock_guard<mutex> lock(m_binaryMutex);
+  if (m_binary.empty())
+  {
+    llvm::raw_string_ostream stream(m_binary);
+    llvm::WriteBitcodeToFile(*m_module, stream);
+    stream.flush();
+  }
+  return m_binary;
+}
+
+// Materialise the body of every kernel and every function they use
+// Materialising changes the module, so this is done for all kernels when
+// the first one is created, before any kernel from the program can run
+bool Program::materializeKernels()
+{
+  list<llvm::Function*> pending;
+  for (auto F = m_module->begin(); F != m_module->end(); F++)
+  {
+    if (F->getCallingConv() == llvm::CallingConv::SPIR_KERNEL &&
+        F->isMaterializable())
+      pending.push_back(&*F);
+  }
+  while (!pending.empty())
+  {
+    llvm::Function *function = pending.front();
+    pending.pop_front();
+    if (!function->isMaterializable())
+      continue;
+
+    if (llvm::Error err = function->materialize())
+    {
+      llvm::consumeError(std::move(err));
+      return false;
+    }
+
+    for (llvm::inst_iterator I = inst_begin(function), E = inst_end(function);
+         I != E; I++)
+    {
+      for (llvm::Value *operand : I->operands())
+      {
+        auto callee =
+          llvm::dyn_cast<llvm::Function>(operand->stripPointerCasts());
+        if (callee && callee->isMaterializable())
+          pending.push_back(callee);
+      }
+    }
+  }
+  return true;
+}
+
 void Program::deallocateProgramScopeVars()
 {
   for (auto psv  = m_programScopeVars.begin();
@@ -695,11 +869,7 @@ void Program::getBinary(unsigned char *binary) const
   if (!m_module)
     return;
 
-  std::string str;
-  llvm::raw_string_ostream stream(str);
-  llvm::WriteBitcodeToFile(*m_module, stream);
-  stream.str();
-
+  const string& str = serialize();
   memcpy(binary, str.c_str(), str.length());
 }
 
@@ -710,11 +880,227 @@ size_t Program::getBinarySize() const
     return 0;
   }
 
-  std::string str;
-  llvm::raw_string_ostream stream(str);
-  llvm::WriteBitcodeToFile(*m_module, stream);
-  stream.str();
-  return str.length();
+  return serialize().length();
+}
+
+size_t Program::getCacheHits()
+{
+  return cacheStats.hits;
+}
+
+size_t Program::getCacheMisses()
+{
+  return cacheStats.misses;
+}
+
+string Program::getCacheFilename(const char *cacheDir,
+                                 const vector<const char*>& args,
+                                 const list<Header>& headers) const
+{
+  // Hash everything that can affect the resulting module
+  string key = PACKAGE_VERSION;
+  key += '\0';
+  key += to_string(LLVM_VERSION);
+  key += '\0';
+  key += checkEnv("OCLGRIND_INTERACTIVE") ? "interactive" : "";
+  key += '\0';
+  key += checkEnv(ENV_OPTIMIZE_IR) ? "optimize" : "";
+  key += '\0';
+  for (const char *arg : args)
+  {
+    key += arg;
+    key += '\0';
+  }
+  for (const Header& header : headers)
+  {
+    key += header.first;
+    key += '\0';
+    key += header.second->m_source;
+    key += '\0';
+  }
+  key += m_source;
+
+  auto hash = llvm::SHA1::hash(llvm::arrayRefFromStringRef(key));
+
+  llvm::SmallString<256> filename(cacheDir);
+  llvm::sys::path::append(filename,
+                          llvm::toHex(hash, true) + CACHE_EXTENSION);
+  return filename.str().str();
+}
+
+// Cache entries contain the files included from disk with their hashes,
+// then the build log and then the module bitcode:
+//   OCLGRIND-CACHE-1
+//   <number of includes>
+//   <hash> <filename>      (one per include)
+//   <build log size>
+//   <build log><bitcode>
+bool Program::loadCachedModule(const string& filename, llvm::raw_ostream& log)
+{
+  llvm::ErrorOr<unique_ptr<llvm::MemoryBuffer>> buffer =
+    llvm::MemoryBuffer::getFile(filename);
+  if (!buffer)
+  {
+    cacheStats.misses++;
+    return false;
+  }
+
+  llvm::StringRef data = buffer->get()->getBuffer();
+  llvm::StringRef line;
+  unsigned long long numIncludes, logSize;
+  bool corrupt = !data.consume_front(CACHE_MAGIC);
+  if (!corrupt)
+  {
+    std::tie(line, data) = data.split('\n');
+    corrupt = line.getAsInteger(10, numIncludes);
+  }
+  for (unsigned long long i = 0; !corrupt && i < numIncludes; i++)
+  {
+    std::tie(line, data) = data.split('\n');
+    llvm::StringRef hash, include;
+    std::tie(hash, include) = line.split(' ');
+    corrupt = include.empty();
+
+    // Entry is stale if an included file has changed since it was built
+    string current;
+    if (!corrupt && (!hashFile(include.str(), current) || hash != current))
+    {
+      cacheStats.misses++;
+      return false;
+    }
+  }
+  if (!corrupt)
+  {
+    std::tie(line, data) = data.split('\n');
+    corrupt = line.getAsInteger(10, logSize) || logSize > data.size();
+  }
+
+  if (corrupt)
+  {
+    // Discard corrupt entry so that it gets replaced
+    llvm::sys::fs::remove(filename);
+    cacheStats.misses++;
+    return false;
+  }
+
+  llvm::Expected<unique_ptr<llvm::Module>> module = parseBitcodeFile(
+    llvm::MemoryBufferRef(data.drop_front(logSize), filename),
+    *m_llvmContext);
+  if (!module)
+  {
+    // Discard corrupt entry so that it gets replaced
+    llvm::consumeError(module.takeError());
+    llvm::sys::fs::remove(filename);
+    cacheStats.misses++;
+    return false;
+  }
+  m_module = std::move(module.get());
+
+  // Replay warnings from the original build
+  log << data.take_front(logSize);
+
+  // Mark entry as recently used
+  int fd;
+  if (!llvm::sys::fs::openFileForWrite(filename, fd,
+                                       llvm::sys::fs::CD_OpenExisting,
+                                       llvm::sys::fs::OF_Append))
+  {
+    llvm::sys::fs::setLastAccessAndModificationTime(
+      fd, chrono::time_point_cast<chrono::nanoseconds>(
+        chrono::system_clock::now()));
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+  }
+
+  cacheStats.hits++;
+  return true;
+}
+
+void Program::storeCachedModule(const string& filename, const string& log,
+                                llvm::ArrayRef<string> includes) const
+{
+  // Hash included files now, so that later edits invalidate the entry
+  vector<string> hashes(includes.size());
+  for (size_t i = 0; i < includes.size(); i++)
+  {
+    if (!hashFile(includes[i], hashes[i]))
+      return;
+  }
+
+  llvm::StringRef cacheDir = llvm::sys::path::parent_path(filename);
+  if (llvm::sys::fs::create_directories(cacheDir))
+    return;
+
+  // Write to temporary file first, so that concurrent builds never see
+  // partially written entries
+  int fd;
+  llvm::SmallString<256> tmpFilename;
+  if (llvm::sys::fs::createUniqueFile(filename + ".%%%%%%.tmp",
+                                      fd, tmpFilename))
+    return;
+  {
+    llvm::raw_fd_ostream bc(fd, true);
+    bc << CACHE_MAGIC << includes.size() << "\n";
+    for (size_t i = 0; i < includes.size(); i++)
+      bc << hashes[i] << " " << includes[i] << "\n";
+    bc << log.size() << "\n" << log;
+    llvm::WriteBitcodeToFile(*m_module, bc);
+    bc.close();
+    if (bc.has_error())
+    {
+      bc.clear_error();
+      llvm::sys::fs::remove(tmpFilename);
+      return;
+    }
+  }
+  if (llvm::sys::fs::rename(tmpFilename, filename))
+  {
+    llvm::sys::fs::remove(tmpFilename);
+    return;
+  }
+
+  // Collect cache entries
+  struct Entry
+  {
+    string path;
+    uint64_t size;
+    llvm::sys::TimePoint<> time;
+  };
+  vector<Entry> entries;
+  uint64_t totalSize = 0;
+  error_code err;
+  for (llvm::sys::fs::directory_iterator itr(cacheDir, err), end;
+       itr != end && !err; itr.increment(err))
+  {
+    if (llvm::sys::path::extension(itr->path()) != CACHE_EXTENSION)
+      continue;
+
+    llvm::ErrorOr<llvm::sys::fs::basic_file_status> status = itr->status();
+    if (!status)
+      continue;
+
+    Entry entry = {itr->path(), status->getSize(),
+                   status->getLastModificationTime()};
+    entries.push_back(entry);
+    totalSize += entry.size;
+  }
+
+  // Evict least recently used entries until within size limit
+  uint64_t limit =
+    getEnvInt(ENV_CACHE_SIZE, DEFAULT_CACHE_SIZE, false) * 1024ULL * 1024ULL;
+  if (totalSize <= limit)
+    return;
+
+  sort(entries.begin(), entries.end(),
+       [](const Entry& a, const Entry& b){ return a.time < b.time; });
+  for (const Entry& entry : entries)
+  {
+    if (totalSize <= limit)
+      break;
+    if (entry.path == filename)
+      continue;
+    if (!llvm::sys::fs::remove(entry.path))
+      totalSize -= entry.size;
+  }
 }
 
 const string& Program::getBuildLog() const
@@ -746,7 +1132,9 @@ unsigned long Program::generateUID() const
 const InterpreterCache* Program::getInterpreterCache(
   const llvm::Function *kernel) const
 {
-  return m_interpreterCache[kernel];
+  lock_guard<mutex> lock(m_interpreterCacheMutex);
+  InterpreterCacheMap::const_iterator itr = m_interpreterCache.find(kernel);
+  return itr == m_interpreterCache.end() ? NULL : itr->second;
 }
 
 list<string> Program::getKernelNames() const
@@ -815,6 +1203,122 @@ unsigned long Program::getUID() const
   return m_uid;
 }
 
+// Count the instructions in a function and the functions it calls
+static size_t countInstructions(const llvm::Function *function)
+{
+  size_t count = 0;
+  set<const llvm::Function*> visited;
+  list<const llvm::Function*> pending;
+  pending.push_back(function);
+  while (!pending.empty())
+  {
+    function = pending.front();
+    pending.pop_front();
+    if (!visited.insert(function).second)
+      continue;
+
+    for (const llvm::Instruction& I : llvm::instructions(function))
+    {
+      count++;
+      if (auto call = llvm::dyn_cast<llvm::CallInst>(&I))
+      {
+        const llvm::Function *callee = call->getCalledFunction();
+        if (callee && !callee->isDeclaration())
+          pending.push_back(callee);
+      }
+    }
+  }
+  return count;
+}
+
+// Reduce the number of instructions that the interpreter has to execute
+// Accesses to global, local and constant memory are checked by plugins, so
+// the passes must not remove, merge or move them
+void Program::optimize(llvm::raw_ostream& log)
+{
+  map<string, size_t> before;
+  for (const string& name : getKernelNames())
+  {
+    before[name] = countInstructions(m_module->getFunction(name));
+  }
+
+  // Make non-private memory accesses volatile while the passes run
+  // Private memory is only visible to its work-item, so SROA can still
+  // promote it to registers
+  // The accesses are tagged with metadata, which is copied along with them
+  // if a pass clones or replaces them
+  llvm::LLVMContext& context = m_module->getContext();
+  unsigned volatileKind = context.getMDKindID("oclgrind.volatile");
+  llvm::MDNode *volatileNode = llvm::MDNode::get(context, {});
+  for (llvm::Function& F : *m_module)
+  {
+    for (llvm::Instruction& I : llvm::instructions(F))
+    {
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(&I))
+      {
+        if (load->isVolatile() ||
+            load->getPointerAddressSpace() == AddrSpacePrivate)
+          continue;
+        load->setVolatile(true);
+        load->setMetadata(volatileKind, volatileNode);
+      }
+      else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&I))
+      {
+        if (store->isVolatile() ||
+            store->getPointerAddressSpace() == AddrSpacePrivate)
+          continue;
+        store->setVolatile(true);
+        store->setMetadata(volatileKind, volatileNode);
+      }
+    }
+  }
+
+  // LICM and GVN hoist and merge calls to the get_*_id builtins, which are
+  // declared readnone
+  // GVN runs without memory dependence analysis, so it leaves loads alone
+  // Vector operations are left intact, as scalarising them would give the
+  // interpreter more instructions to execute rather than fewer
+  llvm::legacy::FunctionPassManager passes(m_module.get());
+  passes.add(llvm::createSROAPass());
+  passes.add(llvm::createPromoteMemoryToRegisterPass());
+  passes.add(llvm::createInstructionCombiningPass());
+  passes.add(llvm::createCFGSimplificationPass());
+  passes.add(llvm::createLICMPass());
+  passes.add(llvm::createGVNPass(true));
+  passes.add(llvm::createInstructionCombiningPass());
+  passes.add(llvm::createCFGSimplificationPass());
+
+  passes.doInitialization();
+  for (llvm::Function& F : *m_module)
+  {
+    if (!F.isDeclaration())
+      passes.run(F);
+  }
+  passes.doFinalization();
+
+  // Restore every access that was only made volatile for the passes
+  for (llvm::Function& F : *m_module)
+  {
+    for (llvm::Instruction& I : llvm::instructions(F))
+    {
+      if (!I.getMetadata(volatileKind))
+        continue;
+      if (auto load = llvm::dyn_cast<llvm::LoadInst>(&I))
+        load->setVolatile(false);
+      else if (auto store = llvm::dyn_cast<llvm::StoreInst>(&I))
+        store->setVolatile(false);
+      I.setMetadata(volatileKind, NULL);
+    }
+  }
+
+  for (auto& kernel : before)
+  {
+    log << "Optimized kernel '" << kernel.first << "': " << kernel.second
+        << " -> " << countInstructions(m_module->getFunction(kernel.first))
+        << " instructions\n";
+  }
+}
+
 void Program::pruneDeadCode(llvm::Instruction *instruction)
 {
   // Remove instructions that have no uses
@@ -8,11 +8,15 @@
 
 #include "common.h"
 
+#include <mutex>
+
 namespace llvm
 {
+  template<typename T> class ArrayRef;
   class Function;
   class LLVMContext;
   class Module;
+  class raw_ostream;
   class StoreInst;
 }
 
@@ -53,6 +57,8 @@ namespace oclgrind
     std::list<std::string> getKernelNames() const;
     llvm::LLVMContext& getLLVMContext() const;
     unsigned int getNumKernels() const;
+    static size_t getCacheHits();
+    static size_t getCacheMisses();
     const std::string& getSource() const;
     const char* getSourceLine(size_t lineNumber) const;
     size_t getNumSourceLines() const;
@@ -61,8 +67,18 @@ namespace oclgrind
     unsigned long getUID() const;
 
   private:
-    Program(const Context *context, llvm::Module *module);
+    static Program* createFromBinary(const Context *context,
+                                     std::string binary);
 
+    // Each program owns the LLVM context its module lives in, so that
+    // programs can be built on several host threads at once
+    std::unique_ptr<llvm::LLVMContext> m_llvmContext;
+    // Serialised module, created on demand for built programs
+    // Modules loaded from a binary refer to it until they are materialised,
+    // so it must outlive the module
+    mutable std::string m_binary;
+    mutable std::mutex m_binaryMutex;
+    const std::string& serialize() const;
     std::unique_ptr<llvm::Module> m_module;
     std::string m_source;
     std::string m_buildLog;
@@ -77,8 +93,19 @@ namespace oclgrind
     unsigned long m_uid;
     unsigned long generateUID() const;
 
+    std::string getCacheFilename(const char *cacheDir,
+                                 const std::vector<const char*>& args,
+                                 const std::list<Header>& headers) const;
+    bool loadCachedModule(const std::string& filename,
+                          llvm::raw_ostream& log);
+    void storeCachedModule(const std::string& filename,
+                           const std::string& log,
+                           llvm::ArrayRef<std::string> includes) const;
+
     void allocateProgramScopeVars();
     void deallocateProgramScopeVars();
+    bool materializeKernels();
+    void optimize(llvm::raw_ostream& log);
     void pruneDeadCode(llvm::Instruction*);
     void removeLValueLoads();
     void scalarizeAggregateStore(llvm::StoreInst *store);
@@ -87,6 +114,9 @@ namespace oclgrind
     typedef std::map<const llvm::Function*, InterpreterCache*>
       InterpreterCacheMap;
     mutable InterpreterCacheMap m_interpreterCache;
+    // Kernels may be created while other kernels from the program run
+    // Also held while materialising kernels from a binary
+    mutable std::mutex m_interpreterCacheMutex;
     void clearInterpreterCache();
   };
 }
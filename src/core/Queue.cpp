@@ -9,23 +9,40 @@
 #include "common.h"
 
 #include <cassert>
-#include <algorithm>
 
 #include "Context.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
 #include "Queue.h"
+#include "Scheduler.h"
 
 using namespace oclgrind;
 using namespace std;
 
+namespace
+{
+  // Signalled whenever a command completes on any queue, so that waiting
+  // never depends on the lifetime of the queue that owns an event
+  mutex completionMutex;
+  condition_variable completion;
+}
+
 Queue::Queue(const Context *context, bool out_of_order)
   : m_context(context), m_out_of_order(out_of_order)
 {
+  m_barrier = NULL;
 }
 
 Queue::~Queue()
 {
+  finish();
+
+  // Completed commands that were never collected by the host
+  while (!m_completed.empty())
+  {
+    delete m_completed.front();
+    m_completed.pop_front();
+  }
 }
 
 Event::Event()
@@ -41,7 +58,35 @@ Event* Queue::enqueue(Command *cmd)
   cmd->event = event;
   event->command = cmd;
   event->queue = this;
+
+  // In-order queues run each command after the previous one, whereas
+  // commands in out-of-order queues are only ordered by barriers
+  // Markers and barriers without a wait list wait for every earlier
+  // command, but only barriers hold back the commands that follow them
+  lock_guard<mutex> lock(m_mutex);
+  list<Command*> dependencies;
+  if (!m_out_of_order)
+  {
+    if (!m_queue.empty())
+      cmd->predecessor = m_queue.back();
+  }
+  else
+  {
+    if ((cmd->type == Command::MARKER || cmd->type == Command::BARRIER) &&
+        cmd->waitList.empty())
+      dependencies = m_queue;
+    cmd->predecessor = m_barrier;
+    if (cmd->type == Command::BARRIER)
+      m_barrier = cmd;
+  }
+  if (cmd->predecessor)
+    dependencies.push_back(cmd->predecessor);
   m_queue.push_back(cmd);
+
+  // Submit while holding the lock so that none of the dependencies can be
+  // collected by the host before the scheduler has seen them
+  m_context->getScheduler()->submit(cmd, dependencies);
+
   return event;
 }
 
@@ -193,24 +238,33 @@ void Queue::executeWriteBufferRect(BufferRectCommand *cmd)
 
 bool Queue::isEmpty() const
 {
+  lock_guard<mutex> lock(m_mutex);
   return m_queue.empty();
 }
 
-void Queue::execute(Command *command, bool flush)
+void Queue::complete(Command *command)
 {
-  // Find command in queue
-  auto it = std::find(m_queue.begin(), m_queue.end(), command);
+  m_queue.remove(command);
+  if (command == m_barrier)
+    m_barrier = NULL;
+  m_completed.push_back(command);
+
+  // Notify while still holding the lock, as the host may destroy the queue
+  // as soon as it is released
+  m_complete.notify_all();
+  notifyCompletion();
+}
 
-  // If there is a previous (older) command in the queue AND either the queue
-  // is not out of order OR needs to be flushed, then add event associated with
-  // previous (older) command as a dependency
-  if (it != m_queue.begin() && (!m_out_of_order || flush))
+void Queue::execute(Command *command)
+{
+  // The scheduler only runs a command once everything in its wait list has
+  // finished, but the command must not run if any of them failed, or if
+  // the command it is ordered after in its queue failed
+  if (command->predecessorStatus < 0)
   {
-    command->waitList.push_back((*std::prev(it))->event);
+    command->event->state = command->predecessorStatus;
+    return;
   }
-
-  // Make sure all events in the wait list are complete before executing
-  // current command
   while (!command->waitList.empty())
   {
     Event *evt = command->waitList.front();
@@ -218,25 +272,9 @@ void Queue::execute(Command *command, bool flush)
 
     if (evt->state < 0)
     {
-      command->event->state = evt->state;
-      m_queue.erase(it);
+      command->event->state = evt->state.load();
       return;
     }
-    else if (evt->state != CL_COMPLETE)
-    {
-      if (evt->command)
-      {
-        // If it's not a user event, execute the associated command
-        evt->queue->execute(evt->command, flush);
-        command->execBefore.push_front(evt->command);
-      }
-      else
-      {
-        // If it's a user event then place it back at the of the wait list, and
-        // check it later
-        command->waitList.push_back(evt);
-      }
-    }
   }
 
   // Dispatch command
@@ -251,7 +289,9 @@ void Queue::execute(Command *command, bool flush)
   case Command::COPY_RECT:
     executeCopyBufferRect((CopyRectCommand*)command);
     break;
+  case Command::BARRIER:
   case Command::EMPTY:
+  case Command::MARKER:
     break;
   case Command::FILL_BUFFER:
     executeFillBuffer((FillBufferCommand*)command);
@@ -288,23 +328,39 @@ void Queue::execute(Command *command, bool flush)
   }
 
   command->event->endTime = now();
-  command->event->state = CL_COMPLETE;
+}
 
-  // Remove command from its queue
-  m_queue.erase(it);
+void Queue::finish()
+{
+  unique_lock<mutex> lock(m_mutex);
+  m_complete.wait(lock, [this]{ return m_queue.empty(); });
 }
 
-Command* Queue::finish()
+Command* Queue::popCompleted()
 {
-  if (m_queue.empty())
+  lock_guard<mutex> lock(m_mutex);
+  if (m_completed.empty())
   {
     return NULL;
   }
 
-  // Get most recent command in queue and execute it, triggering the execution
-  // of all previous commands even if it's an out-of-order queue
-  Command *cmd = m_queue.back();
-  execute(cmd, true);
-
+  Command *cmd = m_completed.front();
+  m_completed.pop_front();
   return cmd;
 }
+
+void Queue::notifyCompletion()
+{
+  {
+    lock_guard<mutex> lock(completionMutex);
+  }
+  completion.notify_all();
+}
+
+void Queue::wait(const Event *event)
+{
+  unique_lock<mutex> lock(completionMutex);
+  completion.wait(lock, [event]{
+      return event->state == CL_COMPLETE || event->state < 0;
+    });
+}
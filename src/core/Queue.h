@@ -9,6 +9,10 @@
 #pragma once
 #include "common.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
 namespace oclgrind
 {
   class Context;
@@ -18,7 +22,7 @@ namespace oclgrind
 
   struct Event
   {
-    int state;
+    std::atomic<int> state;
     double queueTime, startTime, endTime;
     Command *command;
     Queue *queue;
@@ -27,21 +31,34 @@ namespace oclgrind
 
   struct Command
   {
-    enum CommandType {EMPTY, COPY, COPY_RECT, FILL_BUFFER, FILL_IMAGE, KERNEL,
-                      MAP, NATIVE_KERNEL, READ, READ_RECT, UNMAP, WRITE,
-                      WRITE_RECT};
+    enum CommandType {EMPTY, BARRIER, COPY, COPY_RECT, FILL_BUFFER,
+                      FILL_IMAGE, KERNEL, MAP, MARKER, NATIVE_KERNEL, READ,
+                      READ_RECT, UNMAP, WRITE, WRITE_RECT};
 
     CommandType type;
     std::list<Event*> waitList;
-    std::list<Command*> execBefore;
-    Command()
+    Command(CommandType t = EMPTY)
     {
-      type = EMPTY;
+      type = t;
+      numDependencies = 0;
+      predecessor = NULL;
+      predecessorStatus = CL_COMPLETE;
     }
     virtual ~Command() { }
   private:
     Event *event;
+
+    // Scheduling state, guarded by the context's scheduler
+    unsigned numDependencies;
+    std::list<Command*> dependents;
+
+    // Command that this one is implicitly ordered after in its queue, and
+    // the status it finished with if it has completed
+    Command *predecessor;
+    int predecessorStatus;
+
     friend class Queue;
+    friend class Scheduler;
   };
   struct BufferCommand : Command
   {
@@ -193,8 +210,9 @@ namespace oclgrind
     Queue(const Context *context, const bool out_of_order);
     virtual ~Queue();
 
+    // Commands are submitted to the context's scheduler, which runs them
+    // as soon as the commands they depend on have completed
     Event* enqueue(Command *command);
-    void execute(Command *command, bool flush);
 
     void executeCopyBuffer(CopyCommand *cmd);
     void executeCopyBufferRect(CopyRectCommand *cmd);
@@ -210,11 +228,31 @@ namespace oclgrind
     void executeWriteBufferRect(BufferRectCommand *cmd);
 
     bool isEmpty() const;
-    Command* finish();
+
+    // Block until all enqueued commands have completed
+    void finish();
+
+    // Remove and return the oldest completed command, or NULL if there are
+    // none, so that the host can release it
+    Command* popCompleted();
+
+    // Block until an event has completed or terminated with an error
+    static void wait(const Event *event);
 
   private:
     const Context *m_context;
     const bool m_out_of_order;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_complete;
     std::list<Command*> m_queue;
+    std::list<Command*> m_completed;
+    Command *m_barrier;
+
+    // Called by the scheduler with m_mutex held
+    void complete(Command *command);
+    void execute(Command *command);
+    static void notifyCompletion();
+    friend class Scheduler;
   };
 }
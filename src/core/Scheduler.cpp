@@ -0,0 +1,205 @@
+// Scheduler.cpp (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+
+#include "Context.h"
+#include "Queue.h"
+#include "Scheduler.h"
+
+using namespace oclgrind;
+using namespace std;
+
+// Set on dispatcher threads while they hold the execution lock
+static THREAD_LOCAL bool executing = false;
+
+Scheduler::Scheduler(const Context *context)
+  : m_context(context)
+{
+  m_maxThreads = getEnvInt("OCLGRIND_NUM_THREADS",
+                           thread::hardware_concurrency(), false);
+  if (!m_maxThreads)
+    m_maxThreads = 1;
+
+  m_numIdle = 0;
+  m_shutdown = false;
+}
+
+Scheduler::~Scheduler()
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_ready.notify_all();
+
+  for (unsigned i = 0; i < m_threads.size(); i++)
+  {
+    m_threads[i].join();
+  }
+}
+
+void Scheduler::complete(Command *command)
+{
+  // Hold the queue's lock until it has finished with the command, so that
+  // the host cannot destroy the queue once it sees the command complete
+  Queue *queue = command->event->queue;
+  lock_guard<mutex> queueLock(queue->m_mutex);
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    // Commands that failed keep their error status
+    if (command->event->state > 0)
+      command->event->state = CL_COMPLETE;
+
+    // Release commands that were waiting for this one
+    while (!command->dependents.empty())
+    {
+      Command *dependent = command->dependents.front();
+      command->dependents.pop_front();
+      if (dependent->predecessor == command)
+      {
+        dependent->predecessorStatus = command->event->state;
+        dependent->predecessor = NULL;
+      }
+      if (--dependent->numDependencies == 0)
+        enqueueReady(dependent);
+    }
+  }
+
+  // Hand the command back to its queue for the host to release
+  queue->complete(command);
+}
+
+void Scheduler::dispatcher()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (true)
+  {
+    if (!m_readyCommands.empty())
+    {
+      Command *command = m_readyCommands.front();
+      m_readyCommands.pop_front();
+      lock.unlock();
+
+      // Plugins that track a single running kernel need commands to
+      // execute one at a time
+      if (m_context->supportsConcurrentKernels())
+      {
+        command->event->queue->execute(command);
+      }
+      else
+      {
+        lock_guard<mutex> execLock(m_executionMutex);
+        executing = true;
+        command->event->queue->execute(command);
+        executing = false;
+      }
+      complete(command);
+
+      lock.lock();
+      continue;
+    }
+
+    if (m_shutdown)
+      return;
+
+    m_numIdle++;
+    m_ready.wait(lock);
+    m_numIdle--;
+  }
+}
+
+void Scheduler::enqueueReady(Command *command)
+{
+  if (isBlocked(command))
+  {
+    m_blockedCommands.push_back(command);
+  }
+  else
+  {
+    m_readyCommands.push_back(command);
+  }
+
+  // Start another dispatcher if every existing one is busy
+  if ((m_threads.empty() || m_readyCommands.size() > m_numIdle) &&
+      m_threads.size() < m_maxThreads)
+  {
+    m_threads.push_back(thread(&Scheduler::dispatcher, this));
+  }
+  m_ready.notify_one();
+}
+
+bool Scheduler::isBlocked(const Command *command) const
+{
+  for (const Event *evt : command->waitList)
+  {
+    if (!evt->command && evt->state > 0)
+      return true;
+  }
+  return false;
+}
+
+unique_lock<mutex> Scheduler::lockExecution()
+{
+  // Commands notify plugins about host copies while already holding the lock
+  if (executing || m_context->supportsConcurrentKernels())
+    return unique_lock<mutex>();
+  return unique_lock<mutex>(m_executionMutex);
+}
+
+void Scheduler::setUserEventStatus(Event *event, int status)
+{
+  {
+    lock_guard<mutex> lock(m_mutex);
+    event->state = status;
+
+    // Commands are only ever blocked by user events, so check them all again
+    list<Command*> blocked;
+    blocked.swap(m_blockedCommands);
+    for (Command *command : blocked)
+      enqueueReady(command);
+  }
+
+  // Wake host threads waiting for the event
+  Queue::notifyCompletion();
+}
+
+void Scheduler::submit(Command *command,
+                       const list<Command*>& dependencies)
+{
+  lock_guard<mutex> lock(m_mutex);
+
+  // Commands are only marked complete while holding the scheduler lock, so
+  // any dependency that is still pending here will notify this command
+  command->numDependencies = 0;
+  for (Command *dependency : dependencies)
+  {
+    if (dependency->event->state > 0)
+    {
+      dependency->dependents.push_back(command);
+      command->numDependencies++;
+    }
+    else if (dependency == command->predecessor)
+    {
+      command->predecessorStatus = dependency->event->state;
+      command->predecessor = NULL;
+    }
+  }
+  for (Event *evt : command->waitList)
+  {
+    if (evt->command && evt->state > 0)
+    {
+      evt->command->dependents.push_back(command);
+      command->numDependencies++;
+    }
+  }
+
+  if (command->numDependencies == 0)
+    enqueueReady(command);
+}
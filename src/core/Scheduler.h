@@ -0,0 +1,64 @@
+// Scheduler.h (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+#include "common.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace oclgrind
+{
+  class Context;
+  class Queue;
+  struct Command;
+  struct Event;
+
+  // Dispatches commands from every queue in a context as soon as the
+  // commands they depend on have completed, so that independent commands
+  // run concurrently on a set of dispatcher threads
+  class Scheduler
+  {
+  public:
+    Scheduler(const Context *context);
+    virtual ~Scheduler();
+
+    // Submit a command that must run after each of the given commands
+    // Dependencies that have already completed are ignored
+    void submit(Command *command, const std::list<Command*>& dependencies);
+
+    // Set the status of a user event, releasing commands blocked on it
+    void setUserEventStatus(Event *event, int status);
+
+    // Lock out running commands while the host notifies plugins that cannot
+    // observe concurrent kernels; the lock is empty if no locking is needed
+    std::unique_lock<std::mutex> lockExecution();
+
+  private:
+    const Context *m_context;
+    unsigned m_maxThreads;
+    bool m_concurrent;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::list<Command*> m_readyCommands;
+    std::list<Command*> m_blockedCommands;
+    std::vector<std::thread> m_threads;
+    unsigned m_numIdle;
+    bool m_shutdown;
+
+    // Serialises commands when plugins cannot observe concurrent kernels
+    std::mutex m_executionMutex;
+
+    void complete(Command *command);
+    void dispatcher();
+    void enqueueReady(Command *command);
+    bool isBlocked(const Command *command) const;
+  };
+}
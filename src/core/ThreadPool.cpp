@@ -0,0 +1,179 @@
+// ThreadPool.cpp (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+
+#include "ThreadPool.h"
+
+using namespace oclgrind;
+using namespace std;
+
+ThreadPool::ThreadPool()
+{
+  m_shutdown = false;
+
+  m_numJobs = 0;
+  m_numInlineJobs = 0;
+  m_numTasks = 0;
+  m_busyTime = 0;
+  m_callerTime = 0;
+  m_threadStartTime = 0;
+}
+
+ThreadPool::~ThreadPool()
+{
+  if (checkEnv("OCLGRIND_POOL_STATS"))
+    printStats();
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    m_shutdown = true;
+  }
+  m_ready.notify_all();
+
+  for (unsigned i = 0; i < m_threads.size(); i++)
+  {
+    m_threads[i].join();
+  }
+}
+
+unsigned ThreadPool::getNumThreads() const
+{
+  lock_guard<mutex> lock(m_mutex);
+  return m_threads.size();
+}
+
+size_t ThreadPool::getNumJobs() const
+{
+  return m_numJobs;
+}
+
+size_t ThreadPool::getNumInlineJobs() const
+{
+  return m_numInlineJobs;
+}
+
+size_t ThreadPool::getNumTasks() const
+{
+  return m_numTasks;
+}
+
+double ThreadPool::getUtilization() const
+{
+  lock_guard<mutex> lock(m_mutex);
+
+  // Calling threads are part of the pool while they are inside run()
+  double lifetime = m_threads.size()*now() - m_threadStartTime;
+  lifetime += m_callerTime;
+  return lifetime > 0 ? m_busyTime / lifetime : 0.0;
+}
+
+void ThreadPool::execute(const TaskEntry& entry)
+{
+  (*entry.first->task)(entry.second);
+  m_numTasks++;
+
+  bool complete;
+  {
+    lock_guard<mutex> lock(m_mutex);
+    complete = (--entry.first->remaining == 0);
+  }
+  if (complete)
+    m_complete.notify_all();
+}
+
+void ThreadPool::printStats() const
+{
+  cerr << endl
+       << "Thread pool statistics:" << endl
+       << "  Threads:     " << getNumThreads() << endl
+       << "  Jobs:        " << getNumJobs()
+       << " (" << getNumInlineJobs() << " inline)" << endl
+       << "  Tasks:       " << getNumTasks() << endl
+       << "  Utilization: " << fixed << setprecision(1)
+       << getUtilization()*100 << "%" << endl;
+}
+
+void ThreadPool::run(unsigned numTasks, const Task& task)
+{
+  m_numJobs++;
+  double start = now();
+
+  // Run single tasks in the calling thread
+  if (numTasks == 1)
+  {
+    m_numInlineJobs++;
+    m_numTasks++;
+    task(0);
+    uint64_t elapsed = (uint64_t)(now() - start);
+    m_busyTime += elapsed;
+    m_callerTime += elapsed;
+    return;
+  }
+
+  Job job = {&task, numTasks};
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+
+    // Grow pool if necessary, since the calling thread also runs tasks
+    while (m_threads.size() < numTasks-1)
+    {
+      m_threadStartTime += now();
+      m_threads.push_back(thread(&ThreadPool::worker, this));
+    }
+
+    for (unsigned i = 0; i < numTasks; i++)
+    {
+      m_tasks.push_back(TaskEntry(&job, i));
+    }
+  }
+  m_ready.notify_all();
+
+  // Help with pending tasks until the job has been fully claimed
+  while (true)
+  {
+    TaskEntry entry;
+    {
+      lock_guard<mutex> lock(m_mutex);
+      if (m_tasks.empty())
+        break;
+      entry = m_tasks.front();
+      m_tasks.pop_front();
+    }
+
+    double taskStart = now();
+    execute(entry);
+    m_busyTime += (uint64_t)(now() - taskStart);
+  }
+
+  // Wait for tasks running on other threads
+  unique_lock<mutex> lock(m_mutex);
+  m_complete.wait(lock, [&job]{ return job.remaining == 0; });
+  m_callerTime += (uint64_t)(now() - start);
+}
+
+void ThreadPool::worker()
+{
+  while (true)
+  {
+    TaskEntry entry;
+    {
+      unique_lock<mutex> lock(m_mutex);
+      m_ready.wait(lock, [this]{ return m_shutdown || !m_tasks.empty(); });
+      if (m_tasks.empty())
+        return;
+      entry = m_tasks.front();
+      m_tasks.pop_front();
+    }
+
+    double start = now();
+    execute(entry);
+    m_busyTime += (uint64_t)(now() - start);
+  }
+}
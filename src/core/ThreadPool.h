@@ -0,0 +1,67 @@
+// ThreadPool.h (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace oclgrind
+{
+  // Pool of worker threads that persists for the lifetime of a context
+  class ThreadPool
+  {
+  public:
+    typedef std::function<void(unsigned)> Task;
+
+    ThreadPool();
+    virtual ~ThreadPool();
+
+    // Run task(0)..task(numTasks-1) and wait for all of them to complete
+    // The calling thread executes tasks too, and runs them inline if
+    // there is only one
+    void run(unsigned numTasks, const Task& task);
+
+    unsigned getNumThreads() const;
+    size_t getNumJobs() const;
+    size_t getNumInlineJobs() const;
+    size_t getNumTasks() const;
+    double getUtilization() const;
+
+  private:
+    struct Job
+    {
+      const Task *task;
+      unsigned remaining;
+    };
+    typedef std::pair<Job*, unsigned> TaskEntry;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_complete;
+    std::deque<TaskEntry> m_tasks;
+    std::vector<std::thread> m_threads;
+    bool m_shutdown;
+
+    // Utilization statistics
+    std::atomic<size_t> m_numJobs;
+    std::atomic<size_t> m_numInlineJobs;
+    std::atomic<size_t> m_numTasks;
+    std::atomic<uint64_t> m_busyTime;
+    std::atomic<uint64_t> m_callerTime;
+    double m_threadStartTime;
+
+    void execute(const TaskEntry& entry);
+    void worker();
+    void printStats() const;
+  };
+}
@@ -16,6 +16,7 @@
 #include "Kernel.h"
 #include "KernelInvocation.h"
 #include "Memory.h"
+#include "Program.h"
 #include "WorkGroup.h"
 #include "WorkItem.h"
 
@@ -52,24 +53,34 @@ WorkGroup::WorkGroup(const KernelInvocation *kernelInvocation,
     {
       size_t ptr = m_localMemory->allocateBuffer(value->second.size);
       m_localAddresses[value->first] = ptr;
-    }
-  }
 
-  // Initialise work-items
-  for (size_t k = 0; k < m_groupSize.z; k++)
-  {
-    for (size_t j = 0; j < m_groupSize.y; j++)
+      TypedValue v = {sizeof(size_t), 1, m_pool.alloc(sizeof(size_t))};
+      v.setPointer(ptr);
+      m_sharedValues[value->first] = v;
+    }
+    else if (!type->isPointerTy() ||
+             type->getPointerAddressSpace() != AddrSpacePrivate)
     {
-      for (size_t i = 0; i < m_groupSize.x; i++)
-      {
-        WorkItem *workItem = new WorkItem(kernelInvocation, this,
-                                          Size3(i, j, k));
-        m_workItems.push_back(workItem);
-        m_running.insert(workItem);
-      }
+      // Read-only for the lifetime of the kernel invocation
+      m_sharedValues[value->first] = value->second;
     }
   }
 
+  // Work-items are created lazily by getNextWorkItem() and getWorkItem()
+  m_kernelInvocation = kernelInvocation;
+  m_numWorkItems = m_groupSize.x * m_groupSize.y * m_groupSize.z;
+  m_nextWorkItem = 0;
+  m_numCreated = 0;
+  m_created.resize(m_numWorkItems, false);
+  m_workItems.resize(m_numWorkItems, NULL);
+
+  m_barrierFree = kernelInvocation->isBarrierFree();
+  m_reusedWorkItem = NULL;
+
+  m_numLanes = m_barrierFree ? kernelInvocation->getNumLanes() : 1;
+  m_laneRegisters = NULL;
+  m_laneRegisterFileSize = 0;
+
   m_nextEvent = 1;
   m_barrier = NULL;
 }
@@ -81,6 +92,16 @@ WorkGroup::~WorkGroup()
   {
     delete m_workItems[i];
   }
+  for (auto itr = m_finished.begin(); itr != m_finished.end(); itr++)
+  {
+    delete *itr;
+  }
+  delete m_reusedWorkItem;
+  for (unsigned i = 0; i < m_laneWorkItems.size(); i++)
+  {
+    delete m_laneWorkItems[i];
+  }
+  delete[] m_laneRegisters;
 
   delete m_localMemory;
 }
@@ -184,7 +205,7 @@ void WorkGroup::clearBarrier()
   assert(m_barrier);
 
   // Check for divergence
-  if (m_barrier->workItems.size() != m_workItems.size())
+  if (m_barrier->workItems.size() != m_numWorkItems)
   {
     Context::Message msg(ERROR, m_context);
     msg << "Work-group divergence detected (barrier)" << endl
@@ -192,7 +213,7 @@ void WorkGroup::clearBarrier()
         << "Kernel:     " << msg.CURRENT_KERNEL << endl
         << "Work-group: " << msg.CURRENT_WORK_GROUP << endl
         << "Only " << dec << m_barrier->workItems.size() << " out of "
-        << m_workItems.size() << " work-items executed barrier" << endl
+        << m_numWorkItems << " work-items executed barrier" << endl
         << m_barrier->instruction << endl;
     msg.send();
   }
@@ -251,7 +272,7 @@ void WorkGroup::clearBarrier()
       if (cItr->first.event == event)
       {
         // Check that all work-items registered the copy
-        if (cItr->second.size() != m_workItems.size())
+        if (cItr->second.size() != m_numWorkItems)
         {
           Context::Message msg(ERROR, m_context);
           msg << "Work-group divergence detected (async copy)" << endl
@@ -259,7 +280,7 @@ void WorkGroup::clearBarrier()
               << "Kernel:     " << msg.CURRENT_KERNEL << endl
               << "Work-group: " << msg.CURRENT_WORK_GROUP << endl
               << "Only " << dec << cItr->second.size() << " out of "
-              << m_workItems.size() << " work-items executed copy" << endl
+              << m_numWorkItems << " work-items executed copy" << endl
               << cItr->first.instruction << endl;
           msg.send();
         }
@@ -311,19 +332,162 @@ size_t WorkGroup::getLocalMemoryAddress(const llvm::Value *value) const
   return m_localAddresses.at(value);
 }
 
-WorkItem* WorkGroup::getNextWorkItem() const
+WorkItem* WorkGroup::createWorkItem(size_t index)
+{
+  Size3 lid = getLocalID(index);
+
+  if (m_barrierFree)
+  {
+    if (m_reusedWorkItem)
+    {
+      m_reusedWorkItem->reset(lid);
+    }
+    else
+    {
+      m_reusedWorkItem = new WorkItem(m_kernelInvocation, this, lid);
+    }
+    m_created[index] = true;
+    m_numCreated++;
+    return m_reusedWorkItem;
+  }
+
+  WorkItem *workItem = new WorkItem(m_kernelInvocation, this, lid);
+  m_workItems[index] = workItem;
+  m_created[index] = true;
+  m_numCreated++;
+  m_running.insert(workItem);
+  return workItem;
+}
+
+Size3 WorkGroup::getLocalID(size_t index) const
+{
+  return Size3(index % m_groupSize.x,
+               (index / m_groupSize.x) % m_groupSize.y,
+               index / (m_groupSize.x * m_groupSize.y));
+}
+
+bool WorkGroup::getNextLanes(vector<WorkItem*>& lanes)
 {
+  assert(m_numLanes > 1);
+
+  if (m_nextWorkItem == m_numWorkItems)
+  {
+    return false;
+  }
+
+  if (!m_laneRegisters)
+  {
+    const Kernel *kernel = m_kernelInvocation->getKernel();
+    size_t fileSize = kernel->getProgram()->getInterpreterCache(
+      kernel->getFunction())->getRegisterFileSize();
+    m_laneRegisterFileSize = fileSize*m_numLanes;
+    m_laneRegisters = new uint8_t[m_laneRegisterFileSize];
+    m_laneWorkItems.resize(m_numLanes, NULL);
+  }
+  memset(m_laneRegisters, 0, m_laneRegisterFileSize);
+
+  // Assign the next work-items to lanes
+  lanes.clear();
+  for (unsigned l = 0; l < m_numLanes && m_nextWorkItem < m_numWorkItems; l++)
+  {
+    Size3 lid = getLocalID(m_nextWorkItem++);
+    if (m_laneWorkItems[l])
+    {
+      m_laneWorkItems[l]->reset(lid);
+    }
+    else
+    {
+      m_laneWorkItems[l] = new WorkItem(m_kernelInvocation, this, lid,
+                                        m_laneRegisters, l, m_numLanes);
+    }
+    lanes.push_back(m_laneWorkItems[l]);
+  }
+
+  return true;
+}
+
+unsigned WorkGroup::getNumLanes() const
+{
+  return m_numLanes;
+}
+
+WorkItem* WorkGroup::getNextWorkItem()
+{
+  if (m_barrierFree)
+  {
+    // Keep running the current work-item until it finishes
+    if (m_reusedWorkItem &&
+        m_reusedWorkItem->getState() != WorkItem::FINISHED)
+    {
+      return m_reusedWorkItem;
+    }
+    if (m_nextWorkItem == m_numWorkItems)
+    {
+      return NULL;
+    }
+    return createWorkItem(m_nextWorkItem++);
+  }
+
+  // Release work-items that finished since the last call
+  while (!m_finished.empty())
+  {
+    delete m_finished.front();
+    m_finished.pop_front();
+  }
+
   if (m_running.empty())
   {
-    return NULL;
+    // Create the next work-item that has not started yet, skipping any
+    // that were created out of order by getWorkItem()
+    while (m_nextWorkItem < m_numWorkItems && m_created[m_nextWorkItem])
+    {
+      m_nextWorkItem++;
+    }
+    if (m_nextWorkItem == m_numWorkItems)
+    {
+      return NULL;
+    }
+    return createWorkItem(m_nextWorkItem++);
   }
   return *m_running.begin();
 }
 
-WorkItem* WorkGroup::getWorkItem(Size3 localID) const
+const TypedValue* WorkGroup::getSharedValue(const llvm::Value *value) const
 {
-  return m_workItems[localID.x +
-                    (localID.y + localID.z*m_groupSize.y)*m_groupSize.x];
+  auto itr = m_sharedValues.find(value);
+  if (itr == m_sharedValues.end())
+  {
+    return NULL;
+  }
+  return &itr->second;
+}
+
+WorkItem* WorkGroup::getWorkItem(Size3 localID)
+{
+  size_t index = localID.x +
+                (localID.y + localID.z*m_groupSize.y)*m_groupSize.x;
+  if (m_barrierFree)
+  {
+    // Only the current work-item exists
+    if (m_reusedWorkItem && m_reusedWorkItem->getLocalID() == localID)
+    {
+      return m_reusedWorkItem;
+    }
+    return NULL;
+  }
+  if (m_workItems[index])
+  {
+    return m_workItems[index];
+  }
+
+  // Create the work-item if it has not started yet
+  if (!m_created[index])
+  {
+    return createWorkItem(index);
+  }
+
+  // Work-item has already finished
+  return NULL;
 }
 
 bool WorkGroup::hasBarrier() const
@@ -426,10 +590,22 @@ void WorkGroup::notifyBarrier(WorkItem *workItem,
 
 void WorkGroup::notifyFinished(WorkItem *workItem)
 {
+  if (m_barrierFree)
+  {
+    // Work-item will be reset and reused by getNextWorkItem()
+    return;
+  }
+
   m_running.erase(workItem);
 
+  // Release the work-item once the caller has finished with it
+  Size3 lid = workItem->getLocalID();
+  m_workItems[lid.x + (lid.y + lid.z*m_groupSize.y)*m_groupSize.x] = NULL;
+  m_finished.push_back(workItem);
+
   // Check if work-group finished without waiting for all events
-  if (m_running.empty() && !m_barrier && !m_events.empty())
+  if (m_running.empty() && !m_barrier && !m_events.empty() &&
+      m_numCreated == m_numWorkItems)
   {
     m_context->logError("Work-item finished without waiting for events");
   }
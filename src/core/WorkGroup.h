@@ -78,8 +78,11 @@ namespace oclgrind
     Size3 getGroupSize() const;
     Memory* getLocalMemory() const;
     size_t getLocalMemoryAddress(const llvm::Value *value) const;
-    WorkItem *getNextWorkItem() const;
-    WorkItem *getWorkItem(Size3 localID) const;
+    bool getNextLanes(std::vector<WorkItem*>& lanes);
+    unsigned getNumLanes() const;
+    WorkItem *getNextWorkItem();
+    const TypedValue* getSharedValue(const llvm::Value *value) const;
+    WorkItem *getWorkItem(Size3 localID);
     bool hasBarrier() const;
     void notifyBarrier(WorkItem *workItem, const llvm::Instruction *instruction,
                        uint64_t fence,
@@ -95,7 +98,33 @@ namespace oclgrind
     Memory *m_localMemory;
     std::map<const llvm::Value*,size_t> m_localAddresses;
 
+    // Kernel argument and global variable values common to all work-items
+    MemoryPool m_pool;
+    TypedValueMap m_sharedValues;
+
+    // Work-items are created on demand, in the same order they are run,
+    // and released as soon as they finish
+    const KernelInvocation *m_kernelInvocation;
+    size_t m_numWorkItems;
+    size_t m_nextWorkItem;
+    size_t m_numCreated;
+    std::vector<bool> m_created;
     std::vector<WorkItem*> m_workItems;
+    std::list<WorkItem*> m_finished;
+    WorkItem* createWorkItem(size_t index);
+
+    // Barrier-free kernels run each work-item to completion in turn,
+    // resetting a single WorkItem instead of tracking running items
+    bool m_barrierFree;
+    WorkItem *m_reusedWorkItem;
+    Size3 getLocalID(size_t index) const;
+
+    // Barrier-free kernels may instead run batches of work-items as lanes
+    // that share one register file
+    unsigned m_numLanes;
+    uint8_t *m_laneRegisters;
+    size_t m_laneRegisterFileSize;
+    std::vector<WorkItem*> m_laneWorkItems;
 
     Barrier *m_barrier;
     size_t m_nextEvent;
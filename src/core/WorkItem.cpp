@@ -37,89 +37,65 @@ struct WorkItem::Position
   const llvm::BasicBlock *             prevBlock;
   const llvm::BasicBlock *             currBlock;
   const llvm::BasicBlock *             nextBlock;
-  llvm::BasicBlock::const_iterator     currInst;
+  const InterpreterCache::DecodedInstruction *currInst;
   std::stack<const llvm::Instruction*> callStack;
   std::stack< std::list<size_t> >      allocations;
 };
 
+namespace
+{
+  // Check whether any plugin observes an instruction being executed
+  inline bool isObserved(const Context *context,
+                         const InterpreterCache::DecodedInstruction *inst)
+  {
+    if (context->hasListeners(Plugin::INSTRUCTION_EXECUTED))
+      return true;
+    return (inst->opcode == llvm::Instruction::Load ||
+            inst->opcode == llvm::Instruction::Store) &&
+           context->hasListeners(Plugin::MEMORY_INSTRUCTION_EXECUTED);
+  }
+}
+
 WorkItem::WorkItem(const KernelInvocation *kernelInvocation,
-                   WorkGroup *workGroup, Size3 lid)
+                   WorkGroup *workGroup, Size3 lid,
+                   uint8_t *laneRegisters, unsigned lane, unsigned numLanes)
   : m_context(kernelInvocation->getContext()),
     m_kernelInvocation(kernelInvocation),
     m_workGroup(workGroup)
 {
-  m_localID = lid;
-
-  // Compute global ID
-  Size3 groupID = workGroup->getGroupID();
-  Size3 groupSize = kernelInvocation->getLocalSize();
-  Size3 globalOffset = kernelInvocation->getGlobalOffset();
-  m_globalID.x = lid.x + groupID.x*groupSize.x + globalOffset.x;
-  m_globalID.y = lid.y + groupID.y*groupSize.y + globalOffset.y;
-  m_globalID.z = lid.z + groupID.z*groupSize.z + globalOffset.z;
-
-  Size3 globalSize = kernelInvocation->getGlobalSize();
-  m_globalIndex = (m_globalID.x +
-                  (m_globalID.y +
-                   m_globalID.z*globalSize.y) * globalSize.x);
-
   const Kernel *kernel = kernelInvocation->getKernel();
 
   // Load interpreter cache
   m_cache = kernel->getProgram()->getInterpreterCache(kernel->getFunction());
 
-  // Set initial number of values to store based on cache
+  // Lay out values in register file
+  m_ownsRegisters = !laneRegisters;
+  m_registers = m_ownsRegisters ?
+    new uint8_t[m_cache->getRegisterFileSize()] : laneRegisters;
+  m_lane = lane;
+  m_numLanes = numLanes;
   m_values.resize(m_cache->getNumValues());
-
-  m_privateMemory = new Memory(AddrSpacePrivate, sizeof(size_t)==8 ? 32 : 16,
-                               m_context);
-
-  // Initialise kernel arguments and global variables
-  for (auto value  = kernel->values_begin();
-            value != kernel->values_end();
-            value++)
+  for (unsigned i = 0; i < m_values.size(); i++)
   {
-    pair<unsigned,unsigned> size = getValueSize(value->first);
-    TypedValue v = {
-      size.first,
-      size.second,
-      m_pool.alloc(size.first*size.second)
-    };
-
-    const llvm::Type *type = value->first->getType();
-    if (type->isPointerTy() &&
-        type->getPointerAddressSpace() == AddrSpacePrivate)
-    {
-      size_t sz = value->second.size*value->second.num;
-      v.setPointer(m_privateMemory->allocateBuffer(sz, 0, value->second.data));
-    }
-    else if (type->isPointerTy() &&
-             type->getPointerAddressSpace() == AddrSpaceLocal)
-    {
-      v.setPointer(m_workGroup->getLocalMemoryAddress(value->first));
-    }
-    else
-    {
-      memcpy(v.data, value->second.data, v.size*v.num);
-    }
-
-    setValue(value->first, v);
+    const InterpreterCache::Register& reg = m_cache->getRegister(i);
+    m_values[i].size = reg.size;
+    m_values[i].num  = reg.num;
+    m_values[i].data = getSlot(reg.offset, reg.size*reg.num);
   }
 
-  // Initialize interpreter state
-  m_state    = READY;
+  m_privateMemory = new Memory(AddrSpacePrivate, sizeof(size_t)==8 ? 32 : 16,
+                               m_context);
   m_position = new Position;
-  m_position->hasBegun = false;
-  m_position->prevBlock = NULL;
-  m_position->nextBlock = NULL;
-  m_position->currBlock = &*kernel->getFunction()->begin();
-  m_position->currInst = m_position->currBlock->begin();
+
+  reset(lid);
 }
 
 WorkItem::~WorkItem()
 {
   delete m_privateMemory;
   delete m_position;
+  if (m_ownsRegisters)
+    delete[] m_registers;
 }
 
 void WorkItem::clearBarrier()
@@ -133,203 +109,66 @@ void WorkItem::clearBarrier()
 void WorkItem::dispatch(const llvm::Instruction *instruction,
                         TypedValue& result)
 {
-  switch (instruction->getOpcode())
-  {
-  case llvm::Instruction::Add:
-    add(instruction, result);
-    break;
-  case llvm::Instruction::Alloca:
-    alloc(instruction, result);
-    break;
-  case llvm::Instruction::And:
-    bwand(instruction, result);
-    break;
-  case llvm::Instruction::AShr:
-    ashr(instruction, result);
-    break;
-  case llvm::Instruction::BitCast:
-    bitcast(instruction, result);
-    break;
-  case llvm::Instruction::Br:
-    br(instruction, result);
-    break;
-  case llvm::Instruction::Call:
-    call(instruction, result);
-    break;
-  case llvm::Instruction::ExtractElement:
-    extractelem(instruction, result);
-    break;
-  case llvm::Instruction::ExtractValue:
-    extractval(instruction, result);
-    break;
-  case llvm::Instruction::FAdd:
-    fadd(instruction, result);
-    break;
-  case llvm::Instruction::FCmp:
-    fcmp(instruction, result);
-    break;
-  case llvm::Instruction::FDiv:
-    fdiv(instruction, result);
-    break;
-  case llvm::Instruction::FMul:
-    fmul(instruction, result);
-    break;
-  case llvm::Instruction::FNeg:
-    fneg(instruction, result);
-    break;
-  case llvm::Instruction::FPExt:
-    fpext(instruction, result);
-    break;
-  case llvm::Instruction::FPToSI:
-    fptosi(instruction, result);
-    break;
-  case llvm::Instruction::FPToUI:
-    fptoui(instruction, result);
-    break;
-  case llvm::Instruction::FPTrunc:
-    fptrunc(instruction, result);
-    break;
-  case llvm::Instruction::FRem:
-    frem(instruction, result);
-    break;
-  case llvm::Instruction::FSub:
-    fsub(instruction, result);
-    break;
-  case llvm::Instruction::GetElementPtr:
-    gep(instruction, result);
-    break;
-  case llvm::Instruction::ICmp:
-    icmp(instruction, result);
-    break;
-  case llvm::Instruction::InsertElement:
-    insertelem(instruction, result);
-    break;
-  case llvm::Instruction::InsertValue:
-    insertval(instruction, result);
-    break;
-  case llvm::Instruction::IntToPtr:
-    inttoptr(instruction, result);
-    break;
-  case llvm::Instruction::Load:
-    load(instruction, result);
-    break;
-  case llvm::Instruction::LShr:
-    lshr(instruction, result);
-    break;
-  case llvm::Instruction::Mul:
-    mul(instruction, result);
-    break;
-  case llvm::Instruction::Or:
-    bwor(instruction, result);
-    break;
-  case llvm::Instruction::PHI:
-    phi(instruction, result);
-    break;
-  case llvm::Instruction::PtrToInt:
-    ptrtoint(instruction, result);
-    break;
-  case llvm::Instruction::Ret:
-    ret(instruction, result);
-    break;
-  case llvm::Instruction::SDiv:
-    sdiv(instruction, result);
-    break;
-  case llvm::Instruction::Select:
-    select(instruction, result);
-    break;
-  case llvm::Instruction::SExt:
-    sext(instruction, result);
-    break;
-  case llvm::Instruction::Shl:
-    shl(instruction, result);
-    break;
-  case llvm::Instruction::ShuffleVector:
-    shuffle(instruction, result);
-    break;
-  case llvm::Instruction::SIToFP:
-    sitofp(instruction, result);
-    break;
-  case llvm::Instruction::SRem:
-    srem(instruction, result);
-    break;
-  case llvm::Instruction::Store:
-    store(instruction, result);
-    break;
-  case llvm::Instruction::Sub:
-    sub(instruction, result);
-    break;
-  case llvm::Instruction::Switch:
-    swtch(instruction, result);
-    break;
-  case llvm::Instruction::Trunc:
-    itrunc(instruction, result);
-    break;
-  case llvm::Instruction::UDiv:
-    udiv(instruction, result);
-    break;
-  case llvm::Instruction::UIToFP:
-    uitofp(instruction, result);
-    break;
-  case llvm::Instruction::URem:
-    urem(instruction, result);
-    break;
-  case llvm::Instruction::Unreachable:
-    FATAL_ERROR("Encountered unreachable instruction");
-  case llvm::Instruction::Xor:
-    bwxor(instruction, result);
-    break;
-  case llvm::Instruction::ZExt:
-    zext(instruction, result);
-    break;
-  default:
-    FATAL_ERROR("Unsupported instruction: %s", instruction->getOpcodeName());
-  }
+  const InterpreterCache::DecodedInstruction *decoded =
+    m_cache->getDecodedInstruction(instruction);
+  (this->*decoded->handler)(instruction, decoded->operands, result);
 }
 
 void WorkItem::execute(const llvm::Instruction *instruction)
 {
-  // Prepare private variable for instruction result
-  pair<unsigned,unsigned> resultSize = getValueSize(instruction);
+  execute(m_cache->getDecodedInstruction(instruction));
+}
 
-  // Prepare result
+void WorkItem::execute(const InterpreterCache::DecodedInstruction *instruction)
+{
+  // Result is written directly to its register
+  // PHI nodes write to a temporary slot until the whole group has executed
   TypedValue result = {
-    resultSize.first,
-    resultSize.second,
-    NULL
+    instruction->size,
+    instruction->num,
+    getSlot(instruction->offset, instruction->stride)
   };
-  if (result.size)
-  {
-    result.data = m_pool.alloc(result.size*result.num);
-  }
 
-  if (instruction->getOpcode() != llvm::Instruction::PHI &&
+  if (instruction->opcode != llvm::Instruction::PHI &&
       m_phiTemps.size() > 0)
   {
-    TypedValueMap::iterator itr;
-    for (itr = m_phiTemps.begin(); itr != m_phiTemps.end(); itr++)
+    for (auto phi : m_phiTemps)
     {
-      setValue(itr->first, itr->second);
+      memcpy(m_values[phi->id].data, getSlot(phi->offset, phi->stride),
+             phi->size*phi->num);
     }
     m_phiTemps.clear();
   }
 
   // Execute instruction
-  dispatch(instruction, result);
+  (this->*instruction->handler)(instruction->instruction,
+                                instruction->operands, result);
 
-  // Store result
-  if (result.size)
+  if (instruction->opcode == llvm::Instruction::PHI && result.size)
   {
-    if (instruction->getOpcode() != llvm::Instruction::PHI)
-    {
-      setValue(instruction, result);
-    }
-    else
-    {
-      m_phiTemps[instruction] = result;
-    }
+    m_phiTemps.push_back(instruction);
   }
 
-  m_context->notifyInstructionExecuted(this, instruction, result);
+  if (isObserved(m_context, instruction))
+  {
+    m_context->notifyInstructionExecuted(this, instruction->instruction,
+                                         result);
+  }
+}
+
+TypedValue WorkItem::evaluate(
+  const InterpreterCache::DecodedInstruction *expr) const
+{
+  TypedValue result;
+  result.size = expr->size;
+  result.num  = expr->num;
+  result.data = getSlot(expr->offset, expr->stride);
+
+  // Use of const_cast here is ugly, but ConstExpr instructions
+  // shouldn't actually modify WorkItem state anyway
+  (const_cast<WorkItem*>(this)->*expr->handler)(expr->instruction,
+                                                expr->operands, result);
+  return result;
 }
 
 const stack<const llvm::Instruction*>& WorkItem::getCallStack() const
@@ -344,7 +183,12 @@ const llvm::BasicBlock* WorkItem::getCurrentBlock() const
 
 const llvm::Instruction* WorkItem::getCurrentInstruction() const
 {
-  return &*m_position->currInst;
+  return m_position->currInst->instruction;
+}
+
+unsigned WorkItem::getCurrentInstructionID() const
+{
+  return m_position->currInst->id;
 }
 
 Size3 WorkItem::getGlobalID() const
@@ -401,17 +245,8 @@ TypedValue WorkItem::getOperand(const llvm::Value *operand) const
   //}
   else if (valID == llvm::Value::ConstantExprVal)
   {
-    pair<unsigned,unsigned> size = getValueSize(operand);
-    TypedValue result;
-    result.size = size.first;
-    result.num  = size.second;
-    result.data = m_pool.alloc(getTypeSize(operand->getType()));
-
-    // Use of const_cast here is ugly, but ConstExpr instructions
-    // shouldn't actually modify WorkItem state anyway
-    const_cast<WorkItem*>(this)->dispatch(
-      m_cache->getConstantExpr(operand), result);
-    return result;
+    return evaluate(m_cache->getDecodedInstruction(
+      m_cache->getConstantExpr(operand)));
   }
   else if (valID == llvm::Value::UndefValueVal            ||
            valID == llvm::Value::ConstantAggregateZeroVal ||
@@ -450,6 +285,21 @@ TypedValue WorkItem::getOperand(const llvm::Value *operand) const
   assert(false);
 }
 
+TypedValue WorkItem::getOperand(const InterpreterCache::Operand& operand) const
+{
+  switch (operand.kind)
+  {
+  case InterpreterCache::Operand::VALUE:
+    return m_values[operand.id];
+  case InterpreterCache::Operand::CONSTANT:
+    return operand.constant;
+  case InterpreterCache::Operand::CONSTEXPR:
+    return evaluate(operand.expr);
+  default:
+    return getOperand(operand.value);
+  }
+}
+
 const llvm::BasicBlock* WorkItem::getPreviousBlock() const
 {
   return m_position->prevBlock;
@@ -720,7 +570,63 @@ bool WorkItem::printValue(const llvm::Value *value) const
 
 void WorkItem::setValue(const llvm::Value *key, TypedValue value)
 {
-  m_values[m_cache->getValueID(key)] = value;
+  TypedValue& reg = m_values[m_cache->getValueID(key)];
+  memcpy(reg.data, value.data, reg.size*reg.num);
+}
+
+void WorkItem::reset(Size3 lid)
+{
+  m_localID = lid;
+
+  // Compute global ID
+  Size3 groupID = m_workGroup->getGroupID();
+  Size3 groupSize = m_kernelInvocation->getLocalSize();
+  Size3 globalOffset = m_kernelInvocation->getGlobalOffset();
+  m_globalID.x = lid.x + groupID.x*groupSize.x + globalOffset.x;
+  m_globalID.y = lid.y + groupID.y*groupSize.y + globalOffset.y;
+  m_globalID.z = lid.z + groupID.z*groupSize.z + globalOffset.z;
+
+  Size3 globalSize = m_kernelInvocation->getGlobalSize();
+  m_globalIndex = (m_globalID.x +
+                  (m_globalID.y +
+                   m_globalID.z*globalSize.y) * globalSize.x);
+
+  // Discard any state left by a previous work-item
+  m_privateMemory->clear();
+  m_pool.clear();
+  m_phiTemps.clear();
+  // Lane register files are cleared by the work-group for each batch
+  if (m_ownsRegisters)
+    memset(m_registers, 0, m_cache->getRegisterFileSize());
+
+  // Initialise kernel arguments and global variables
+  // Values that are the same for every work-item are shared with the group
+  const Kernel *kernel = m_kernelInvocation->getKernel();
+  for (auto value  = kernel->values_begin();
+            value != kernel->values_end();
+            value++)
+  {
+    const TypedValue *shared = m_workGroup->getSharedValue(value->first);
+    if (shared)
+    {
+      m_values[m_cache->getValueID(value->first)].data = shared->data;
+    }
+    else
+    {
+      size_t sz = value->second.size*value->second.num;
+      TypedValue v = getValue(value->first);
+      v.setPointer(m_privateMemory->allocateBuffer(sz, 0, value->second.data));
+    }
+  }
+
+  // Initialize interpreter state
+  m_state    = READY;
+  *m_position = Position();
+  m_position->hasBegun = false;
+  m_position->prevBlock = NULL;
+  m_position->nextBlock = NULL;
+  m_position->currBlock = &*kernel->getFunction()->begin();
+  m_position->currInst = m_cache->getBlockEntry(m_position->currBlock);
 }
 
 WorkItem::State WorkItem::step()
@@ -734,20 +640,20 @@ WorkItem::State WorkItem::step()
   }
 
   // Execute the next instruction
-  execute(&*m_position->currInst);
+  execute(m_position->currInst);
 
-  // Check if we've reached the end of the block
-  if (++m_position->currInst == m_position->currBlock->end() ||
-      m_position->nextBlock)
+  if (m_position->nextBlock)
   {
-    if (m_position->nextBlock)
-    {
-      // Move to next basic block
-      m_position->prevBlock = m_position->currBlock;
-      m_position->currBlock = m_position->nextBlock;
-      m_position->nextBlock = NULL;
-      m_position->currInst  = m_position->currBlock->begin();
-    }
+    // Move to next basic block
+    m_position->prevBlock = m_position->currBlock;
+    m_position->currBlock = m_position->nextBlock;
+    m_position->nextBlock = NULL;
+    m_position->currInst  = m_cache->getBlockEntry(m_position->currBlock);
+  }
+  else if (m_position->currInst->next)
+  {
+    // Move to next instruction in block
+    m_position->currInst = m_position->currInst->next;
   }
 
   if (m_state == FINISHED)
@@ -756,18 +662,228 @@ WorkItem::State WorkItem::step()
   return m_state;
 }
 
+bool WorkItem::isLockstep(WorkItem *const *lanes, unsigned num)
+{
+  const InterpreterCache::DecodedInstruction *inst =
+    lanes[0]->m_position->currInst;
+  for (unsigned l = 0; l < num; l++)
+  {
+    if (lanes[l]->m_state != READY ||
+        lanes[l]->m_position->currInst != inst)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace
+{
+  // Source of an operand for every lane of a batched instruction
+  // Values shared by all lanes (constants and kernel arguments) have a
+  // stride of zero
+  template<typename T>
+  struct LaneOperand
+  {
+    const T *data;
+    unsigned stride;
+  };
+
+  template<typename T, typename Op>
+  void executeLanes(T *result, LaneOperand<T> a, LaneOperand<T> b,
+                    unsigned num, unsigned numLanes, Op op)
+  {
+    for (unsigned l = 0; l < numLanes; l++)
+    {
+      for (unsigned i = 0; i < num; i++)
+      {
+        result[l*num + i] = op(a.data[l*a.stride + i], b.data[l*b.stride + i]);
+      }
+    }
+  }
+
+  template<typename T>
+  bool executeIntegerLanes(unsigned opcode, T *result,
+                           LaneOperand<T> a, LaneOperand<T> b,
+                           unsigned num, unsigned numLanes)
+  {
+    switch (opcode)
+    {
+    case llvm::Instruction::Add:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x + y; });
+      return true;
+    case llvm::Instruction::Sub:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x - y; });
+      return true;
+    case llvm::Instruction::Mul:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x * y; });
+      return true;
+    case llvm::Instruction::And:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x & y; });
+      return true;
+    case llvm::Instruction::Or:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x | y; });
+      return true;
+    case llvm::Instruction::Xor:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x ^ y; });
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  template<typename T>
+  bool executeFloatLanes(unsigned opcode, T *result,
+                         LaneOperand<T> a, LaneOperand<T> b,
+                         unsigned num, unsigned numLanes)
+  {
+    switch (opcode)
+    {
+    case llvm::Instruction::FAdd:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x + y; });
+      return true;
+    case llvm::Instruction::FSub:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x - y; });
+      return true;
+    case llvm::Instruction::FMul:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x * y; });
+      return true;
+    case llvm::Instruction::FDiv:
+      executeLanes(result, a, b, num, numLanes,
+                   [](T x, T y) -> T { return x / y; });
+      return true;
+    default:
+      return false;
+    }
+  }
+}
+
+bool WorkItem::stepLanes(WorkItem *const *lanes, unsigned num)
+{
+  assert(isLockstep(lanes, num));
+
+  WorkItem *first = lanes[0];
+  const InterpreterCache::DecodedInstruction *inst =
+    first->m_position->currInst;
+
+  // Only batch binary arithmetic on 32 and 64-bit scalars and vectors,
+  // once every lane has started and committed any pending PHI values
+  if (inst->instruction->getNumOperands() != 2 ||
+      (inst->size != 4 && inst->size != 8) ||
+      !llvm::isa<llvm::BinaryOperator>(inst->instruction))
+  {
+    return false;
+  }
+  for (unsigned l = 0; l < num; l++)
+  {
+    if (!lanes[l]->m_position->hasBegun || !lanes[l]->m_phiTemps.empty())
+      return false;
+  }
+
+  // Locate operands in the lane register file
+  unsigned elements = inst->num;
+  const uint8_t *data[2];
+  unsigned stride[2];
+  for (unsigned i = 0; i < 2; i++)
+  {
+    const InterpreterCache::Operand& operand = inst->operands[i];
+    if (operand.kind == InterpreterCache::Operand::CONSTANT)
+    {
+      data[i] = operand.constant.data;
+      stride[i] = 0;
+    }
+    else if (operand.kind == InterpreterCache::Operand::VALUE)
+    {
+      data[i] = first->m_values[operand.id].data;
+      const InterpreterCache::Register& reg =
+        first->m_cache->getRegister(operand.id);
+      stride[i] =
+        data[i] == first->getSlot(reg.offset, reg.size*reg.num) ? elements : 0;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  uint8_t *result = first->getSlot(inst->offset, inst->stride);
+  bool executed;
+  const llvm::Type *type = inst->instruction->getType()->getScalarType();
+  if (type->isIntegerTy(32))
+  {
+    executed = executeIntegerLanes<uint32_t>(inst->opcode, (uint32_t*)result,
+      {(const uint32_t*)data[0], stride[0]},
+      {(const uint32_t*)data[1], stride[1]}, elements, num);
+  }
+  else if (type->isIntegerTy(64))
+  {
+    executed = executeIntegerLanes<uint64_t>(inst->opcode, (uint64_t*)result,
+      {(const uint64_t*)data[0], stride[0]},
+      {(const uint64_t*)data[1], stride[1]}, elements, num);
+  }
+  else if (type->isFloatTy())
+  {
+    executed = executeFloatLanes<float>(inst->opcode, (float*)result,
+      {(const float*)data[0], stride[0]},
+      {(const float*)data[1], stride[1]}, elements, num);
+  }
+  else if (type->isDoubleTy())
+  {
+    executed = executeFloatLanes<double>(inst->opcode, (double*)result,
+      {(const double*)data[0], stride[0]},
+      {(const double*)data[1], stride[1]}, elements, num);
+  }
+  else
+  {
+    return false;
+  }
+  if (!executed)
+    return false;
+
+  // Advance each lane as though it had executed the instruction itself
+  bool observed = isObserved(lanes[0]->m_context, inst);
+  for (unsigned l = 0; l < num; l++)
+  {
+    WorkItem *lane = lanes[l];
+    if (observed)
+    {
+      TypedValue laneResult = {
+        inst->size, inst->num, lane->getSlot(inst->offset, inst->stride)
+      };
+      lane->m_context->notifyInstructionExecuted(lane, inst->instruction,
+                                                 laneResult);
+    }
+    lane->m_position->currInst = inst->next;
+  }
+
+  return true;
+}
+
 
 ///////////////////////////////
 //// Instruction execution ////
 ///////////////////////////////
 
 #define INSTRUCTION(name) \
-  void WorkItem::name(const llvm::Instruction *instruction, TypedValue& result)
+  void WorkItem::name(const llvm::Instruction *instruction, \
+                      const InterpreterCache::Operand *operands, \
+                      TypedValue& result)
+
+#define OPERAND(i) getOperand(operands[i])
 
 INSTRUCTION(add)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) + opB.getUInt(i), i);
@@ -795,8 +911,8 @@ INSTRUCTION(alloc)
 
 INSTRUCTION(ashr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -808,7 +924,7 @@ INSTRUCTION(ashr)
 
 INSTRUCTION(bitcast)
 {
-  TypedValue operand = getOperand(instruction->getOperand(0));
+  TypedValue operand = OPERAND(0);
   memcpy(result.data, operand.data, result.size*result.num);
 }
 
@@ -822,7 +938,7 @@ INSTRUCTION(br)
   else
   {
     // Conditional branch
-    bool pred = getOperand(instruction->getOperand(0)).getUInt();
+    bool pred = OPERAND(0).getUInt();
     const llvm::Value *iftrue = instruction->getOperand(2);
     const llvm::Value *iffalse = instruction->getOperand(1);
     m_position->nextBlock = (const llvm::BasicBlock*)(pred ? iftrue : iffalse);
@@ -831,8 +947,8 @@ INSTRUCTION(br)
 
 INSTRUCTION(bwand)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) & opB.getUInt(i), i);
@@ -841,8 +957,8 @@ INSTRUCTION(bwand)
 
 INSTRUCTION(bwor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) | opB.getUInt(i), i);
@@ -851,8 +967,8 @@ INSTRUCTION(bwor)
 
 INSTRUCTION(bwxor)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) ^ opB.getUInt(i), i);
@@ -876,7 +992,7 @@ INSTRUCTION(call)
   // Check if function has definition
   if (!function->isDeclaration())
   {
-    m_position->callStack.push(&*m_position->currInst);
+    m_position->callStack.push(instruction);
     m_position->allocations.push(list<size_t>());
     m_position->nextBlock = &*function->begin();
 
@@ -885,8 +1001,7 @@ INSTRUCTION(call)
     for (argItr = function->arg_begin();
          argItr != function->arg_end(); argItr++)
     {
-      const llvm::Value *arg = callInst->getArgOperand(argItr->getArgNo());
-      TypedValue value = getOperand(arg);
+      TypedValue value = OPERAND(argItr->getArgNo());
 
       if (argItr->hasByValAttr())
       {
@@ -897,37 +1012,40 @@ INSTRUCTION(call)
         m_position->allocations.top().push_back(ptr);
 
         // Pass new allocation to function
-        TypedValue address =
-        {
-          sizeof(size_t),
-          1,
-          m_pool.alloc(sizeof(size_t))
-        };
-        address.setPointer(ptr);
-        setValue(&*argItr, address);
+        getValue(&*argItr).setPointer(ptr);
       }
       else
       {
-        setValue(&*argItr, m_pool.clone(value));
+        setValue(&*argItr, value);
       }
     }
 
     return;
   }
 
-  // Call builtin function
-  InterpreterCache::Builtin builtin = m_cache->getBuiltin(function);
-  builtin.function.func(this, callInst,
-                        builtin.name, builtin.overload,
-                        result, builtin.function.op);
+  // Call builtin function, resolved when the cache was built unless the
+  // call was indirect
+  const InterpreterCache::Builtin *builtin =
+    operands[callInst->getNumOperands()-1].builtin;
+  if (!builtin)
+    builtin = &m_cache->getBuiltin(function);
+
+  if (builtin->handler)
+  {
+    builtin->handler(this, operands, result, builtin->function.op);
+  }
+  else
+  {
+    builtin->function.func(this, callInst,
+                           builtin->name, builtin->overload,
+                           result, builtin->function.op);
+  }
 }
 
 INSTRUCTION(extractelem)
 {
-  const llvm::ExtractElementInst *extract =
-    (const llvm::ExtractElementInst*)instruction;
-  unsigned index     = getOperand(extract->getIndexOperand()).getUInt();
-  TypedValue operand = getOperand(extract->getVectorOperand());
+  unsigned index     = OPERAND(1).getUInt();
+  TypedValue operand = OPERAND(0);
   memcpy(result.data, operand.data + result.size*index, result.size);
 }
 
@@ -961,13 +1079,13 @@ INSTRUCTION(extractval)
   }
 
   // Copy target value to result
-  memcpy(result.data, getOperand(agg).data + offset, getTypeSize(type));
+  memcpy(result.data, OPERAND(0).data + offset, getTypeSize(type));
 }
 
 INSTRUCTION(fadd)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) + opB.getFloat(i), i);
@@ -979,8 +1097,8 @@ INSTRUCTION(fcmp)
   const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -1039,8 +1157,8 @@ INSTRUCTION(fcmp)
 
 INSTRUCTION(fdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) / opB.getFloat(i), i);
@@ -1049,8 +1167,8 @@ INSTRUCTION(fdiv)
 
 INSTRUCTION(fmul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) * opB.getFloat(i), i);
@@ -1059,7 +1177,7 @@ INSTRUCTION(fmul)
 
 INSTRUCTION(fneg)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(-op.getFloat(i), i);
@@ -1068,7 +1186,7 @@ INSTRUCTION(fneg)
 
 INSTRUCTION(fpext)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -1077,7 +1195,7 @@ INSTRUCTION(fpext)
 
 INSTRUCTION(fptosi)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setSInt((int64_t)op.getFloat(i), i);
@@ -1086,7 +1204,7 @@ INSTRUCTION(fptosi)
 
 INSTRUCTION(fptoui)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt((uint64_t)op.getFloat(i), i);
@@ -1095,8 +1213,8 @@ INSTRUCTION(fptoui)
 
 INSTRUCTION(frem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(fmod(opA.getFloat(i), opB.getFloat(i)), i);
@@ -1105,7 +1223,7 @@ INSTRUCTION(frem)
 
 INSTRUCTION(fptrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getFloat(i), i);
@@ -1114,8 +1232,8 @@ INSTRUCTION(fptrunc)
 
 INSTRUCTION(fsub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(opA.getFloat(i) - opB.getFloat(i), i);
@@ -1128,15 +1246,14 @@ INSTRUCTION(gep)
     (const llvm::GetElementPtrInst*)instruction;
 
   // Get base address
-  size_t base = getOperand(gepInst->getPointerOperand()).getPointer();
+  size_t base = OPERAND(0).getPointer();
   const llvm::Type *ptrType = gepInst->getPointerOperandType();
 
   // Get indices
   std::vector<int64_t> offsets;
-  llvm::User::const_op_iterator opItr;
-  for (opItr = gepInst->idx_begin(); opItr != gepInst->idx_end(); opItr++)
+  for (unsigned i = 1; i < gepInst->getNumOperands(); i++)
   {
-    offsets.push_back(getOperand(opItr->get()).getSInt());
+    offsets.push_back(OPERAND(i).getSInt());
   }
 
   result.setPointer(resolveGEP(base, ptrType, offsets));
@@ -1147,8 +1264,8 @@ INSTRUCTION(icmp)
   const llvm::CmpInst *cmpInst = (const llvm::CmpInst*)instruction;
   llvm::CmpInst::Predicate pred = cmpInst->getPredicate();
 
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
 
   uint64_t t = result.num > 1 ? -1 : 1;
   for (unsigned i = 0; i < result.num; i++)
@@ -1202,9 +1319,9 @@ INSTRUCTION(icmp)
 
 INSTRUCTION(insertelem)
 {
-  TypedValue vector  = getOperand(instruction->getOperand(0));
-  TypedValue element = getOperand(instruction->getOperand(1));
-  unsigned index     = getOperand(instruction->getOperand(2)).getUInt();
+  TypedValue vector  = OPERAND(0);
+  TypedValue element = OPERAND(1);
+  unsigned index     = OPERAND(2).getUInt();
   memcpy(result.data, vector.data, result.size*result.num);
   memcpy(result.data + index*result.size, element.data, result.size);
 }
@@ -1216,7 +1333,7 @@ INSTRUCTION(insertval)
 
   // Load original aggregate data
   const llvm::Value *agg = insert->getAggregateOperand();
-  memcpy(result.data, getOperand(agg).data, result.size*result.num);
+  memcpy(result.data, OPERAND(0).data, result.size*result.num);
 
   // Compute offset for inserted value
   int offset = 0;
@@ -1243,13 +1360,13 @@ INSTRUCTION(insertval)
 
   // Copy inserted value into result
   const llvm::Value *value = insert->getInsertedValueOperand();
-  memcpy(result.data + offset, getOperand(value).data,
+  memcpy(result.data + offset, OPERAND(1).data,
          getTypeSize(value->getType()));
 }
 
 INSTRUCTION(inttoptr)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setPointer(op.getUInt(i), i);
@@ -1258,7 +1375,7 @@ INSTRUCTION(inttoptr)
 
 INSTRUCTION(itrunc)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(op.getUInt(i), i);
@@ -1270,7 +1387,7 @@ INSTRUCTION(load)
   const llvm::LoadInst *loadInst = (const llvm::LoadInst*)instruction;
   unsigned addressSpace = loadInst->getPointerAddressSpace();
   const llvm::Value *opPtr = loadInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  size_t address = OPERAND(0).getPointer();
 
   // Check address is correctly aligned
   unsigned alignment = loadInst->getAlignment();
@@ -1283,13 +1400,14 @@ INSTRUCTION(load)
   }
 
   // Load data
-  getMemory(addressSpace)->load(result.data, address, result.size*result.num);
+  getMemory(addressSpace)->load(result.data, address, result.size*result.num,
+                                this);
 }
 
 INSTRUCTION(lshr)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1301,8 +1419,8 @@ INSTRUCTION(lshr)
 
 INSTRUCTION(mul)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) * opB.getUInt(i), i);
@@ -1312,14 +1430,13 @@ INSTRUCTION(mul)
 INSTRUCTION(phi)
 {
   const llvm::PHINode *phiNode = (const llvm::PHINode*)instruction;
-  const llvm::Value *value = phiNode->getIncomingValueForBlock(
-    (const llvm::BasicBlock*)m_position->prevBlock);
-  memcpy(result.data, getOperand(value).data, result.size*result.num);
+  int index = phiNode->getBasicBlockIndex(m_position->prevBlock);
+  memcpy(result.data, OPERAND(index).data, result.size*result.num);
 }
 
 INSTRUCTION(ptrtoint)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(op.getPointer(i), i);
@@ -1333,15 +1450,15 @@ INSTRUCTION(ret)
   if (!m_position->callStack.empty())
   {
     m_position->currInst =
-      llvm::BasicBlock::const_iterator(m_position->callStack.top());
-    m_position->currBlock = m_position->currInst->getParent();
+      m_cache->getDecodedInstruction(m_position->callStack.top());
+    m_position->currBlock = m_position->callStack.top()->getParent();
     m_position->callStack.pop();
 
     // Set return value
-    const llvm::Value *returnVal = retInst->getReturnValue();
-    if (returnVal)
+    if (retInst->getReturnValue())
     {
-      setValue(&*m_position->currInst, m_pool.clone(getOperand(returnVal)));
+      TypedValue& reg = m_values[m_position->currInst->id];
+      memcpy(reg.data, OPERAND(0).data, reg.size*reg.num);
     }
 
     // Clear stack allocations
@@ -1363,8 +1480,8 @@ INSTRUCTION(ret)
 
 INSTRUCTION(sdiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1381,18 +1498,15 @@ INSTRUCTION(sdiv)
 INSTRUCTION(select)
 {
   const llvm::SelectInst *selectInst = (const llvm::SelectInst*)instruction;
-  TypedValue opCondition = getOperand(selectInst->getCondition());
+  TypedValue opCondition = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     const bool cond =
       selectInst->getCondition()->getType()->isVectorTy() ?
       opCondition.getUInt(i) :
       opCondition.getUInt();
-    const llvm::Value *op = cond ?
-      selectInst->getTrueValue() :
-      selectInst->getFalseValue();
     memcpy(result.data + i*result.size,
-           getOperand(op).data + i*result.size,
+           OPERAND(cond ? 1 : 2).data + i*result.size,
            result.size);
   }
 }
@@ -1400,7 +1514,7 @@ INSTRUCTION(select)
 INSTRUCTION(sext)
 {
   const llvm::Value *operand = instruction->getOperand(0);
-  TypedValue value = getOperand(operand);
+  TypedValue value = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t val = value.getSInt(i);
@@ -1414,8 +1528,8 @@ INSTRUCTION(sext)
 
 INSTRUCTION(shl)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   uint64_t shiftMask =
     (result.num > 1 ? result.size : max((size_t)result.size, sizeof(uint32_t)))
     * 8 - 1;
@@ -1431,13 +1545,12 @@ INSTRUCTION(shuffle)
     (const llvm::ShuffleVectorInst*)instruction;
 
   const llvm::Value *v1 = shuffle->getOperand(0);
-  const llvm::Value *v2 = shuffle->getOperand(1);
 
   unsigned num =
     llvm::cast<llvm::FixedVectorType>(v1->getType())->getNumElements();
   for (unsigned i = 0; i < result.num; i++)
   {
-    const llvm::Value *src = v1;
+    unsigned src = 0;
     int index = shuffle->getMaskValue(i);
     if (index == llvm::UndefMaskElem)
     {
@@ -1448,16 +1561,16 @@ INSTRUCTION(shuffle)
     if (index >= num)
     {
       index -= num;
-      src = v2;
+      src = 1;
     }
     memcpy(result.data + i*result.size,
-           getOperand(src).data + index*result.size, result.size);
+           OPERAND(src).data + index*result.size, result.size);
   }
 }
 
 INSTRUCTION(sitofp)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setFloat(op.getSInt(i), i);
@@ -1466,8 +1579,8 @@ INSTRUCTION(sitofp)
 
 INSTRUCTION(srem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     int64_t a = opA.getSInt(i);
@@ -1486,7 +1599,7 @@ INSTRUCTION(store)
   const llvm::StoreInst *storeInst = (const llvm::StoreInst*)instruction;
   unsigned addressSpace = storeInst->getPointerAddressSpace();
   const llvm::Value *opPtr = storeInst->getPointerOperand();
-  size_t address = getOperand(opPtr).getPointer();
+  size_t address = OPERAND(1).getPointer();
 
   // Check address is correctly aligned
   unsigned alignment = storeInst->getAlignment();
@@ -1499,15 +1612,15 @@ INSTRUCTION(store)
   }
 
   // Store data
-  TypedValue operand = getOperand(storeInst->getValueOperand());
+  TypedValue operand = OPERAND(0);
   getMemory(addressSpace)->store(operand.data, address,
-                                 operand.size*operand.num);
+                                 operand.size*operand.num, this);
 }
 
 INSTRUCTION(sub)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(opA.getUInt(i) - opB.getUInt(i), i);
@@ -1517,8 +1630,7 @@ INSTRUCTION(sub)
 INSTRUCTION(swtch)
 {
   const llvm::SwitchInst *swtch = (const llvm::SwitchInst*)instruction;
-  const llvm::Value *cond = swtch->getCondition();
-  uint64_t val = getOperand(cond).getUInt();
+  uint64_t val = OPERAND(0).getUInt();
 
   // Look for case matching condition value
   for (auto C : swtch->cases())
@@ -1536,8 +1648,8 @@ INSTRUCTION(swtch)
 
 INSTRUCTION(udiv)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1548,7 +1660,7 @@ INSTRUCTION(udiv)
 
 INSTRUCTION(uitofp)
 {
-  TypedValue op = getOperand(instruction->getOperand(0));
+  TypedValue op = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t in = op.getUInt(i);
@@ -1559,10 +1671,20 @@ INSTRUCTION(uitofp)
   }
 }
 
+INSTRUCTION(unreachable)
+{
+  FATAL_ERROR("Encountered unreachable instruction");
+}
+
+INSTRUCTION(unsupported)
+{
+  FATAL_ERROR("Unsupported instruction: %s", instruction->getOpcodeName());
+}
+
 INSTRUCTION(urem)
 {
-  TypedValue opA = getOperand(instruction->getOperand(0));
-  TypedValue opB = getOperand(instruction->getOperand(1));
+  TypedValue opA = OPERAND(0);
+  TypedValue opB = OPERAND(1);
   for (unsigned i = 0; i < result.num; i++)
   {
     uint64_t a = opA.getUInt(i);
@@ -1573,13 +1695,14 @@ INSTRUCTION(urem)
 
 INSTRUCTION(zext)
 {
-  TypedValue operand = getOperand(instruction->getOperand(0));
+  TypedValue operand = OPERAND(0);
   for (unsigned i = 0; i < result.num; i++)
   {
     result.setUInt(operand.getUInt(i), i);
   }
 }
 
+#undef OPERAND
 #undef INSTRUCTION
 
 
@@ -1592,6 +1715,8 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
   // TODO: Determine this number dynamically?
   m_valueIDs.reserve(1024);
 
+  m_hasWorkGroupSync = false;
+
   // Add global variables to cache
   // TODO: Only add variables that are used?
   const llvm::Module *module = kernel->getParent();
@@ -1653,6 +1778,68 @@ InterpreterCache::InterpreterCache(llvm::Function *kernel)
       }
     }
   }
+
+  // Assign register file slots to all values
+  m_registerFileSize = 0;
+  m_registers.resize(m_valueIDs.size());
+  for (auto V = m_valueIDs.begin(); V != m_valueIDs.end(); V++)
+  {
+    pair<unsigned,unsigned> size = getValueSize(V->first);
+    Register& reg = m_registers[V->second];
+    reg.size   = size.first;
+    reg.num    = size.second;
+    reg.offset = allocateRegister(size.first*size.second);
+  }
+
+  // Allocate storage for pre-decoded instructions and their operands
+  size_t numInstructions = m_constExpressions.size();
+  size_t numOperands = 0;
+  for (auto C = m_constExpressions.begin(); C != m_constExpressions.end(); C++)
+  {
+    numOperands += C->second->getNumOperands();
+  }
+  for (auto F = processed.begin(); F != processed.end(); F++)
+  {
+    llvm::inst_iterator I;
+    for (I = inst_begin(*F); I != inst_end(*F); I++)
+    {
+      numInstructions++;
+      numOperands += I->getNumOperands();
+    }
+  }
+  m_instructions.resize(numInstructions);
+  m_operands.resize(numOperands);
+
+  // Assign slots first, so that operands can refer to any instruction
+  vector<const llvm::Instruction*> order;
+  order.reserve(numInstructions);
+  for (auto C = m_constExpressions.begin(); C != m_constExpressions.end(); C++)
+  {
+    m_decoded[C->second] = &m_instructions[order.size()];
+    order.push_back(C->second);
+  }
+  for (auto F = processed.begin(); F != processed.end(); F++)
+  {
+    for (auto B = (*F)->begin(); B != (*F)->end(); B++)
+    {
+      m_blocks[&*B] = &m_instructions[order.size()];
+      for (auto I = B->begin(); I != B->end(); I++)
+      {
+        DecodedInstruction *decoded = &m_instructions[order.size()];
+        decoded->next = I->isTerminator() ? NULL : decoded + 1;
+        m_decoded[&*I] = decoded;
+        order.push_back(&*I);
+      }
+    }
+  }
+
+  // Decode instructions
+  Operand *operands = m_operands.data();
+  for (unsigned i = 0; i < order.size(); i++)
+  {
+    decode(order[i], &m_instructions[i], operands);
+    operands += order[i]->getNumOperands();
+  }
 }
 
 InterpreterCache::~InterpreterCache()
@@ -1698,12 +1885,23 @@ void InterpreterCache::addBuiltin(
     overload = "";
   }
 
+  // Record whether work-items may need to synchronize with each other
+  if (name == "barrier" || name == "work_group_barrier" ||
+      name == "async_work_group_copy" ||
+      name == "async_work_group_strided_copy" ||
+      name == "wait_group_events")
+  {
+    m_hasWorkGroupSync = true;
+  }
+
   // Find builtin function in map
   BuiltinFunctionMap::iterator bItr = workItemBuiltins.find(name);
   if (bItr != workItemBuiltins.end())
   {
     // Add builtin to cache
-    const InterpreterCache::Builtin builtin = {bItr->second, name, overload};
+    const InterpreterCache::Builtin builtin = {
+      bItr->second, name, overload, specializeBuiltin(function, bItr->second)
+    };
     m_builtins[function] = builtin;
     return;
   }
@@ -1716,7 +1914,9 @@ void InterpreterCache::addBuiltin(
     if (name.compare(0, pItr->first.length(), pItr->first) == 0)
     {
       // Add builtin to cache
-      const InterpreterCache::Builtin builtin = {pItr->second, name, overload};
+      const InterpreterCache::Builtin builtin = {
+        pItr->second, name, overload, specializeBuiltin(function, pItr->second)
+      };
       m_builtins[function] = builtin;
       return;
     }
@@ -1726,7 +1926,7 @@ void InterpreterCache::addBuiltin(
   FATAL_ERROR("Undefined external function: %s", name.c_str());
 }
 
-InterpreterCache::Builtin InterpreterCache::getBuiltin(
+const InterpreterCache::Builtin& InterpreterCache::getBuiltin(
   const llvm::Function *function) const
 {
   return m_builtins.at(function);
@@ -1772,6 +1972,54 @@ const llvm::Instruction* InterpreterCache::getConstantExpr(
   return itr->second;
 }
 
+const InterpreterCache::DecodedInstruction* InterpreterCache::getBlockEntry(
+  const llvm::BasicBlock *block) const
+{
+  BlockMap::const_iterator itr = m_blocks.find(block);
+  if (itr == m_blocks.end())
+  {
+    FATAL_ERROR("Basic block not found in cache");
+  }
+  return itr->second;
+}
+
+const InterpreterCache::DecodedInstruction*
+InterpreterCache::getDecodedInstruction(
+  const llvm::Instruction *instruction) const
+{
+  DecodedMap::const_iterator itr = m_decoded.find(instruction);
+  if (itr == m_decoded.end())
+  {
+    FATAL_ERROR("Instruction not found in cache (%s)",
+                instruction->getOpcodeName());
+  }
+  return itr->second;
+}
+
+size_t InterpreterCache::allocateRegister(size_t size)
+{
+  // Keep all registers 8-byte aligned
+  size_t offset = m_registerFileSize;
+  m_registerFileSize += (size + 7) & ~(size_t)7;
+  return offset;
+}
+
+const InterpreterCache::Register& InterpreterCache::getRegister(
+  unsigned id) const
+{
+  return m_registers[id];
+}
+
+size_t InterpreterCache::getRegisterFileSize() const
+{
+  return m_registerFileSize;
+}
+
+bool InterpreterCache::hasWorkGroupSync() const
+{
+  return m_hasWorkGroupSync;
+}
+
 unsigned InterpreterCache::addValueID(const llvm::Value *value)
 {
   ValueMap::iterator itr = m_valueIDs.find(value);
@@ -1804,6 +2052,243 @@ bool InterpreterCache::hasValue(const llvm::Value *value) const
   return m_valueIDs.count(value);
 }
 
+void InterpreterCache::decode(const llvm::Instruction *instruction,
+                              DecodedInstruction *decoded, Operand *operands)
+{
+  decoded->instruction = instruction;
+  decoded->operands = operands;
+  decoded->opcode = instruction->getOpcode();
+  decoded->id = hasValue(instruction) ? getValueID(instruction) : 0;
+
+  pair<unsigned,unsigned> size = getValueSize(instruction);
+  decoded->size = size.first;
+  decoded->num  = size.second;
+
+  // Determine where the result is written
+  if (!instruction->getParent())
+  {
+    // Constant expressions get a scratch slot for their evaluated value
+    decoded->stride = max((size_t)getTypeSize(instruction->getType()),
+                          (size_t)size.first*size.second);
+    decoded->offset = allocateRegister(decoded->stride);
+  }
+  else if (decoded->opcode == llvm::Instruction::PHI)
+  {
+    // PHI nodes are buffered until all PHIs in the block have executed
+    decoded->stride = size.first*size.second;
+    decoded->offset = allocateRegister(decoded->stride);
+  }
+  else
+  {
+    decoded->stride = size.first*size.second;
+    decoded->offset = m_registers[decoded->id].offset;
+  }
+
+  // Resolve operand sources
+  for (unsigned i = 0; i < instruction->getNumOperands(); i++)
+  {
+    const llvm::Value *value = instruction->getOperand(i);
+    unsigned valID = value->getValueID();
+
+    Operand& operand = operands[i];
+    operand.id = 0;
+    operand.constant.size = 0;
+    operand.constant.num  = 0;
+    operand.constant.data = NULL;
+    operand.expr = NULL;
+    operand.value = value;
+    operand.builtin = NULL;
+
+    ConstantMap::const_iterator constItr;
+    if (valID == llvm::Value::ArgumentVal ||
+        valID == llvm::Value::GlobalVariableVal ||
+        valID >= llvm::Value::InstructionVal)
+    {
+      operand.kind = Operand::VALUE;
+      operand.id = getValueID(value);
+    }
+    else if (valID == llvm::Value::ConstantExprVal)
+    {
+      operand.kind = Operand::CONSTEXPR;
+      operand.expr = getDecodedInstruction(getConstantExpr(value));
+    }
+    else if ((constItr = m_constants.find(value)) != m_constants.end())
+    {
+      operand.kind = Operand::CONSTANT;
+      operand.constant = constItr->second;
+    }
+    else
+    {
+      operand.kind = Operand::OTHER;
+
+      // Resolve builtin function callees
+      if (valID == llvm::Value::FunctionVal)
+      {
+        BuiltinMap::const_iterator bItr =
+          m_builtins.find((const llvm::Function*)value);
+        if (bItr != m_builtins.end())
+          operand.builtin = &bItr->second;
+      }
+    }
+  }
+
+  // Resolve instruction handler
+  switch (decoded->opcode)
+  {
+  case llvm::Instruction::Add:
+    decoded->handler = &WorkItem::add;
+    break;
+  case llvm::Instruction::Alloca:
+    decoded->handler = &WorkItem::alloc;
+    break;
+  case llvm::Instruction::And:
+    decoded->handler = &WorkItem::bwand;
+    break;
+  case llvm::Instruction::AShr:
+    decoded->handler = &WorkItem::ashr;
+    break;
+  case llvm::Instruction::BitCast:
+    decoded->handler = &WorkItem::bitcast;
+    break;
+  case llvm::Instruction::Br:
+    decoded->handler = &WorkItem::br;
+    break;
+  case llvm::Instruction::Call:
+    decoded->handler = &WorkItem::call;
+    break;
+  case llvm::Instruction::ExtractElement:
+    decoded->handler = &WorkItem::extractelem;
+    break;
+  case llvm::Instruction::ExtractValue:
+    decoded->handler = &WorkItem::extractval;
+    break;
+  case llvm::Instruction::FAdd:
+    decoded->handler = &WorkItem::fadd;
+    break;
+  case llvm::Instruction::FCmp:
+    decoded->handler = &WorkItem::fcmp;
+    break;
+  case llvm::Instruction::FDiv:
+    decoded->handler = &WorkItem::fdiv;
+    break;
+  case llvm::Instruction::FMul:
+    decoded->handler = &WorkItem::fmul;
+    break;
+  case llvm::Instruction::FNeg:
+    decoded->handler = &WorkItem::fneg;
+    break;
+  case llvm::Instruction::FPExt:
+    decoded->handler = &WorkItem::fpext;
+    break;
+  case llvm::Instruction::FPToSI:
+    decoded->handler = &WorkItem::fptosi;
+    break;
+  case llvm::Instruction::FPToUI:
+    decoded->handler = &WorkItem::fptoui;
+    break;
+  case llvm::Instruction::FPTrunc:
+    decoded->handler = &WorkItem::fptrunc;
+    break;
+  case llvm::Instruction::FRem:
+    decoded->handler = &WorkItem::frem;
+    break;
+  case llvm::Instruction::FSub:
+    decoded->handler = &WorkItem::fsub;
+    break;
+  case llvm::Instruction::GetElementPtr:
+    decoded->handler = &WorkItem::gep;
+    break;
+  case llvm::Instruction::ICmp:
+    decoded->handler = &WorkItem::icmp;
+    break;
+  case llvm::Instruction::InsertElement:
+    decoded->handler = &WorkItem::insertelem;
+    break;
+  case llvm::Instruction::InsertValue:
+    decoded->handler = &WorkItem::insertval;
+    break;
+  case llvm::Instruction::IntToPtr:
+    decoded->handler = &WorkItem::inttoptr;
+    break;
+  case llvm::Instruction::Load:
+    decoded->handler = &WorkItem::load;
+    break;
+  case llvm::Instruction::LShr:
+    decoded->handler = &WorkItem::lshr;
+    break;
+  case llvm::Instruction::Mul:
+    decoded->handler = &WorkItem::mul;
+    break;
+  case llvm::Instruction::Or:
+    decoded->handler = &WorkItem::bwor;
+    break;
+  case llvm::Instruction::PHI:
+    decoded->handler = &WorkItem::phi;
+    break;
+  case llvm::Instruction::PtrToInt:
+    decoded->handler = &WorkItem::ptrtoint;
+    break;
+  case llvm::Instruction::Ret:
+    decoded->handler = &WorkItem::ret;
+    break;
+  case llvm::Instruction::SDiv:
+    decoded->handler = &WorkItem::sdiv;
+    break;
+  case llvm::Instruction::Select:
+    decoded->handler = &WorkItem::select;
+    break;
+  case llvm::Instruction::SExt:
+    decoded->handler = &WorkItem::sext;
+    break;
+  case llvm::Instruction::Shl:
+    decoded->handler = &WorkItem::shl;
+    break;
+  case llvm::Instruction::ShuffleVector:
+    decoded->handler = &WorkItem::shuffle;
+    break;
+  case llvm::Instruction::SIToFP:
+    decoded->handler = &WorkItem::sitofp;
+    break;
+  case llvm::Instruction::SRem:
+    decoded->handler = &WorkItem::srem;
+    break;
+  case llvm::Instruction::Store:
+    decoded->handler = &WorkItem::store;
+    break;
+  case llvm::Instruction::Sub:
+    decoded->handler = &WorkItem::sub;
+    break;
+  case llvm::Instruction::Switch:
+    decoded->handler = &WorkItem::swtch;
+    break;
+  case llvm::Instruction::Trunc:
+    decoded->handler = &WorkItem::itrunc;
+    break;
+  case llvm::Instruction::UDiv:
+    decoded->handler = &WorkItem::udiv;
+    break;
+  case llvm::Instruction::UIToFP:
+    decoded->handler = &WorkItem::uitofp;
+    break;
+  case llvm::Instruction::URem:
+    decoded->handler = &WorkItem::urem;
+    break;
+  case llvm::Instruction::Unreachable:
+    decoded->handler = &WorkItem::unreachable;
+    break;
+  case llvm::Instruction::Xor:
+    decoded->handler = &WorkItem::bwxor;
+    break;
+  case llvm::Instruction::ZExt:
+    decoded->handler = &WorkItem::zext;
+    break;
+  default:
+    // Unsupported instructions are only reported if they are executed
+    decoded->handler = &WorkItem::unsupported;
+    break;
+  }
+}
+
 void InterpreterCache::addOperand(const llvm::Value *operand)
 {
   // Resolve constants
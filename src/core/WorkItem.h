@@ -51,44 +51,121 @@ namespace oclgrind
   class InterpreterCache
   {
   public:
+    struct DecodedInstruction;
+    struct Operand;
+
+    // Builtin specialised for the argument types of one overload
+    // Arguments are read directly from the pre-decoded call operands
+    typedef void (*BuiltinHandler)(WorkItem*, const Operand*,
+                                   TypedValue&, void*);
+
     struct Builtin
     {
       BuiltinFunction function;
       std::string name, overload;
+      BuiltinHandler handler;
+    };
+
+    // Instruction operand with its source resolved ahead of time
+    struct Operand
+    {
+      enum Kind {VALUE, CONSTANT, CONSTEXPR, OTHER} kind;
+      unsigned id;
+      TypedValue constant;
+      const DecodedInstruction *expr;
+      const llvm::Value *value;
+      const Builtin *builtin;
+    };
+
+    typedef void (WorkItem::*InstructionHandler)(const llvm::Instruction*,
+                                                 const Operand*, TypedValue&);
+
+    // Pre-decoded form of an instruction, laid out contiguously per block
+    struct DecodedInstruction
+    {
+      InstructionHandler handler;
+      const llvm::Instruction *instruction;
+      const Operand *operands;
+      const DecodedInstruction *next;
+      unsigned opcode;
+      unsigned id;
+      unsigned size, num;
+      size_t offset, stride;
+    };
+
+    // Location of a value in the per-work-item register file
+    struct Register
+    {
+      unsigned size, num;
+      size_t offset;
     };
 
     InterpreterCache(llvm::Function *kernel);
     ~InterpreterCache();
 
     void addBuiltin(const llvm::Function *function);
-    Builtin getBuiltin(const llvm::Function *function) const;
+    const Builtin& getBuiltin(const llvm::Function *function) const;
 
     void addConstant(const llvm::Value *constant);
     TypedValue getConstant(const llvm::Value *operand) const;
     const llvm::Instruction* getConstantExpr(const llvm::Value *expr) const;
 
+    const DecodedInstruction* getBlockEntry(
+      const llvm::BasicBlock *block) const;
+    const DecodedInstruction* getDecodedInstruction(
+      const llvm::Instruction *instruction) const;
+
     unsigned addValueID(const llvm::Value *value);
     unsigned getValueID(const llvm::Value *value) const;
     unsigned getNumValues() const;
     bool hasValue(const llvm::Value *value) const;
 
+    const Register& getRegister(unsigned id) const;
+    size_t getRegisterFileSize() const;
+
+    // True if any reachable function uses barriers or async copies
+    bool hasWorkGroupSync() const;
+
   private:
     typedef std::unordered_map<const llvm::Value*, unsigned> ValueMap;
     typedef std::unordered_map<const llvm::Function*, Builtin> BuiltinMap;
     typedef std::unordered_map<const llvm::Value*, TypedValue> ConstantMap;
     typedef std::unordered_map<const llvm::Value*, llvm::Instruction*>
       ConstExprMap;
+    typedef std::unordered_map<const llvm::Instruction*,
+                               const DecodedInstruction*> DecodedMap;
+    typedef std::unordered_map<const llvm::BasicBlock*,
+                               const DecodedInstruction*> BlockMap;
 
     BuiltinMap m_builtins;
     ConstantMap m_constants;
     ConstExprMap m_constExpressions;
     ValueMap m_valueIDs;
 
+    std::vector<DecodedInstruction> m_instructions;
+    std::vector<Operand> m_operands;
+    DecodedMap m_decoded;
+    BlockMap m_blocks;
+
+    std::vector<Register> m_registers;
+    size_t m_registerFileSize;
+
+    bool m_hasWorkGroupSync;
+    size_t allocateRegister(size_t size);
+
     void addOperand(const llvm::Value *value);
+    void decode(const llvm::Instruction *instruction,
+                DecodedInstruction *decoded, Operand *operands);
   };
 
+  // Returns a specialised handler for a builtin overload, or NULL if the
+  // generic implementation must be used
+  InterpreterCache::BuiltinHandler specializeBuiltin(
+    const llvm::Function *function, const BuiltinFunction& builtin);
+
   class WorkItem
   {
+    friend class InterpreterCache;
     friend class WorkItemBuiltins;
 
   public:
@@ -96,7 +173,9 @@ namespace oclgrind
 
   public:
     WorkItem(const KernelInvocation *kernelInvocation,
-             WorkGroup *workGroup, Size3 lid);
+             WorkGroup *workGroup, Size3 lid,
+             uint8_t *laneRegisters = NULL,
+             unsigned lane = 0, unsigned numLanes = 1);
     virtual ~WorkItem();
 
     void clearBarrier();
@@ -105,6 +184,7 @@ namespace oclgrind
     const std::stack<const llvm::Instruction*>& getCallStack() const;
     const llvm::BasicBlock* getCurrentBlock() const;
     const llvm::Instruction* getCurrentInstruction() const;
+    unsigned getCurrentInstructionID() const;
     Size3 getGlobalID() const;
     size_t getGlobalIndex() const;
     Size3 getLocalID() const;
@@ -116,12 +196,18 @@ namespace oclgrind
     const WorkGroup* getWorkGroup() const;
     void printExpression(std::string expr) const;
     bool printValue(const llvm::Value *value) const;
+    void reset(Size3 lid);
     State step();
 
+    // Lockstep execution of work-items sharing a lane register file
+    static bool isLockstep(WorkItem *const *lanes, unsigned num);
+    static bool stepLanes(WorkItem *const *lanes, unsigned num);
+
     // SPIR instructions
   private:
 #define INSTRUCTION(name) \
-  void name(const llvm::Instruction *instruction, TypedValue& result)
+  void name(const llvm::Instruction *instruction, \
+            const InterpreterCache::Operand *operands, TypedValue& result)
     INSTRUCTION(add);
     INSTRUCTION(alloc);
     INSTRUCTION(ashr);
@@ -168,6 +254,8 @@ namespace oclgrind
     INSTRUCTION(swtch);
     INSTRUCTION(udiv);
     INSTRUCTION(uitofp);
+    INSTRUCTION(unreachable);
+    INSTRUCTION(unsupported);
     INSTRUCTION(urem);
     INSTRUCTION(zext);
 #undef INSTRUCTION
@@ -180,7 +268,7 @@ namespace oclgrind
     size_t m_globalIndex;
     Size3 m_globalID;
     Size3 m_localID;
-    TypedValueMap m_phiTemps;
+    std::vector<const InterpreterCache::DecodedInstruction*> m_phiTemps;
     VariableMap m_variables;
     const Context *m_context;
     const KernelInvocation *m_kernelInvocation;
@@ -194,7 +282,21 @@ namespace oclgrind
 
     Memory* getMemory(unsigned int addrSpace) const;
 
+    void execute(const InterpreterCache::DecodedInstruction *instruction);
+    TypedValue getOperand(const InterpreterCache::Operand& operand) const;
+    TypedValue evaluate(const InterpreterCache::DecodedInstruction *expr) const;
+
     // Store for instruction results and other operand values
+    // Each value refers to a fixed slot in the register file
+    // Work-items executed as lanes share a register file, in which each
+    // slot holds the values for all lanes contiguously
+    uint8_t *m_registers;
+    bool m_ownsRegisters;
+    unsigned m_lane, m_numLanes;
+    uint8_t* getSlot(size_t offset, size_t stride) const
+    {
+      return m_registers + offset*m_numLanes + m_lane*stride;
+    }
     std::vector<TypedValue> m_values;
     TypedValue getValue(const llvm::Value *key) const;
     bool hasValue(const llvm::Value *key) const;
@@ -3480,8 +3480,108 @@ namespace oclgrind
       FATAL_ERROR("Encountered trap instruction");
     }
 
+
+    //////////////////////////
+    // Specialised Builtins //
+    //////////////////////////
+
+    // Versions of frequently used builtins instantiated for a fixed type
+    // and vector width, which read their arguments directly from the
+    // pre-decoded call operands
+#define SPECIALIZED_BUILTIN(name)                                 \
+  static void name(WorkItem *workItem,                            \
+                   const InterpreterCache::Operand *operands,     \
+                   TypedValue& result, void *op)
+#define OPDATA(T, i) ((const T*)workItem->getOperand(operands[i]).data)
+
+    template<typename T, unsigned N>
+    SPECIALIZED_BUILTIN(f1arg_n)
+    {
+      double (*func)(double) = (double(*)(double))op;
+      const T *a = OPDATA(T, 0);
+      T *r = (T*)result.data;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = func(a[i]);
+      }
+    }
+
+    template<typename T, unsigned N>
+    SPECIALIZED_BUILTIN(f2arg_n)
+    {
+      double (*func)(double, double) = (double(*)(double, double))op;
+      const T *a = OPDATA(T, 0);
+      const T *b = OPDATA(T, 1);
+      T *r = (T*)result.data;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = func(a[i], b[i]);
+      }
+    }
+
+    template<typename T, unsigned N>
+    SPECIALIZED_BUILTIN(f3arg_n)
+    {
+      double (*func)(double, double, double) =
+        (double(*)(double, double, double))op;
+      const T *a = OPDATA(T, 0);
+      const T *b = OPDATA(T, 1);
+      const T *c = OPDATA(T, 2);
+      T *r = (T*)result.data;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = func(a[i], b[i], c[i]);
+      }
+    }
+
+    template<typename T, unsigned N>
+    SPECIALIZED_BUILTIN(fma_n)
+    {
+      const T *a = OPDATA(T, 0);
+      const T *b = OPDATA(T, 1);
+      const T *c = OPDATA(T, 2);
+      T *r = (T*)result.data;
+      for (unsigned i = 0; i < N; i++)
+      {
+        r[i] = std::fma(a[i], b[i], c[i]);
+      }
+    }
+
+#define SPECIALIZED_ID_QUERY(name, ids)                     \
+    template<typename R>                                    \
+    SPECIALIZED_BUILTIN(name##_n)                           \
+    {                                                       \
+      uint32_t dim = *OPDATA(uint32_t, 0);                  \
+      *(R*)result.data = dim < 3 ? (R)(ids)[dim] : 0;       \
+    }
+    SPECIALIZED_ID_QUERY(get_global_id, workItem->m_globalID)
+    SPECIALIZED_ID_QUERY(get_local_id, workItem->m_localID)
+    SPECIALIZED_ID_QUERY(get_group_id, workItem->m_workGroup->getGroupID())
+    SPECIALIZED_ID_QUERY(get_local_size,
+                         workItem->m_workGroup->getGroupSize())
+    SPECIALIZED_ID_QUERY(get_global_size,
+                         workItem->m_kernelInvocation->getGlobalSize())
+    SPECIALIZED_ID_QUERY(get_num_groups,
+                         workItem->m_kernelInvocation->getNumGroups())
+#undef SPECIALIZED_ID_QUERY
+
+    template<unsigned AddrSpace>
+    SPECIALIZED_BUILTIN(vload_n)
+    {
+      size_t offset = *OPDATA(size_t, 0);
+      size_t base = *OPDATA(size_t, 1);
+      size_t size = result.size*result.num;
+      workItem->getMemory(AddrSpace)->load(result.data, base + offset*size,
+                                           size);
+    }
+
+#undef OPDATA
+#undef SPECIALIZED_BUILTIN
+
   public:
     static BuiltinFunctionMap initBuiltins();
+    static InterpreterCache::BuiltinHandler specialize(
+      const llvm::Function *function, const BuiltinFunction& builtin);
   };
 
   // Utility macros for generating builtin function map
@@ -3766,4 +3866,116 @@ namespace oclgrind
 
     return builtins;
   }
+
+  // Utility macros for selecting specialised builtins
+#define SELECT_WIDTH(func, T) \
+  switch (width)              \
+  {                           \
+  case 1:  return func<T,1>;  \
+  case 2:  return func<T,2>;  \
+  case 3:  return func<T,3>;  \
+  case 4:  return func<T,4>;  \
+  case 8:  return func<T,8>;  \
+  case 16: return func<T,16>; \
+  default: return NULL;       \
+  }
+#define SELECT_FLOAT(func)            \
+  if (elemType->isFloatTy())          \
+  {                                   \
+    SELECT_WIDTH(func, float);        \
+  }                                   \
+  else if (elemType->isDoubleTy())    \
+  {                                   \
+    SELECT_WIDTH(func, double);       \
+  }                                   \
+  return NULL;
+#define SELECT_ID_QUERY(name)              \
+  if (builtin.func == (CAST)name)          \
+  {                                        \
+    if (!idArgs)                           \
+      return NULL;                         \
+    if (returnType->isIntegerTy(32))       \
+      return name##_n<uint32_t>;           \
+    if (returnType->isIntegerTy(64))       \
+      return name##_n<uint64_t>;           \
+    return NULL;                           \
+  }
+
+  InterpreterCache::BuiltinHandler WorkItemBuiltins::specialize(
+    const llvm::Function *function, const BuiltinFunction& builtin)
+  {
+    const llvm::Type *returnType = function->getReturnType();
+    const llvm::Type *elemType = returnType;
+    unsigned width = 1;
+    if (auto vecType = llvm::dyn_cast<llvm::FixedVectorType>(returnType))
+    {
+      elemType = vecType->getElementType();
+      width = vecType->getNumElements();
+    }
+
+    // Component-wise maths builtins whose arguments match the result type
+    bool uniformArgs = true;
+    for (auto arg = function->arg_begin(); arg != function->arg_end(); arg++)
+    {
+      if (arg->getType() != returnType)
+        uniformArgs = false;
+    }
+    if (uniformArgs)
+    {
+      unsigned numArgs = function->arg_size();
+      if (builtin.func == (CAST)f1arg && numArgs == 1)
+      {
+        SELECT_FLOAT(f1arg_n);
+      }
+      if (builtin.func == (CAST)f2arg && numArgs == 2)
+      {
+        SELECT_FLOAT(f2arg_n);
+      }
+      if (builtin.func == (CAST)f3arg && numArgs == 3)
+      {
+        SELECT_FLOAT(f3arg_n);
+      }
+      if (builtin.func == (CAST)fma_builtin && numArgs == 3)
+      {
+        SELECT_FLOAT(fma_n);
+      }
+    }
+
+    // Work-item functions taking a 32-bit dimension index
+    bool idArgs = function->arg_size() == 1 &&
+      function->getFunctionType()->getParamType(0)->isIntegerTy(32);
+    SELECT_ID_QUERY(get_global_id);
+    SELECT_ID_QUERY(get_local_id);
+    SELECT_ID_QUERY(get_group_id);
+    SELECT_ID_QUERY(get_local_size);
+    SELECT_ID_QUERY(get_global_size);
+    SELECT_ID_QUERY(get_num_groups);
+
+    // vloadn with a size_t offset
+    if (builtin.func == (CAST)vload && function->arg_size() == 2 &&
+        getTypeSize(function->getFunctionType()->getParamType(0)) ==
+          sizeof(size_t))
+    {
+      switch (function->getFunctionType()->getParamType(1)
+                ->getPointerAddressSpace())
+      {
+      case AddrSpacePrivate:
+        return vload_n<AddrSpacePrivate>;
+      case AddrSpaceGlobal:
+        return vload_n<AddrSpaceGlobal>;
+      case AddrSpaceConstant:
+        return vload_n<AddrSpaceConstant>;
+      case AddrSpaceLocal:
+        return vload_n<AddrSpaceLocal>;
+      }
+    }
+
+    return NULL;
+  }
+
+  InterpreterCache::BuiltinHandler specializeBuiltin(
+    const llvm::Function *function, const BuiltinFunction& builtin)
+  {
+    return WorkItemBuiltins::specialize(function, builtin);
+  }
 }
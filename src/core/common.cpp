@@ -305,6 +305,35 @@ namespace oclgrind
     return result;
   }
 
+  string escapeJSON(const string& str)
+  {
+    ostringstream escaped;
+    for (char c : str)
+    {
+      switch (c)
+      {
+      case '"':
+        escaped << "\\\"";
+        break;
+      case '\\':
+        escaped << "\\\\";
+        break;
+      case '\n':
+        escaped << "\\n";
+        break;
+      case '\t':
+        escaped << "\\t";
+        break;
+      default:
+        if ((unsigned char)c < 0x20)
+          escaped << "\\u" << hex << setw(4) << setfill('0') << (int)c << dec;
+        else
+          escaped << c;
+      }
+    }
+    return escaped.str();
+  }
+
   void dumpInstruction(ostream& out, const llvm::Instruction *instruction)
   {
     llvm::raw_os_ostream stream(out);
@@ -954,6 +983,16 @@ namespace oclgrind
     return buffer;
   }
 
+  void MemoryPool::clear()
+  {
+    for (auto itr = m_blocks.begin(); itr != m_blocks.end(); itr++)
+    {
+      delete[] *itr;
+    }
+    m_blocks.clear();
+    m_offset = m_blockSize;
+  }
+
   TypedValue MemoryPool::clone(const TypedValue& source)
   {
     TypedValue dest;
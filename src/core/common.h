@@ -160,6 +160,9 @@ namespace oclgrind
   // Get an environment variable as an integer
   unsigned getEnvInt(const char *var, int def=0, bool allowZero=true);
 
+  // Escape a string for use in a JSON string literal
+  std::string escapeJSON(const std::string& str);
+
   // Output an instruction in human-readable format
   void dumpInstruction(std::ostream& out, const llvm::Instruction *instruction);
 
@@ -237,6 +240,7 @@ namespace oclgrind
     MemoryPool(size_t blockSize = 1024);
     ~MemoryPool();
     uint8_t* alloc(size_t size);
+    void clear();
     TypedValue clone(const TypedValue& source);
   private:
     size_t m_blockSize;
@@ -0,0 +1,265 @@
+// Batch.cpp (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+#include "core/Context.h"
+#include "core/KernelInvocation.h"
+#include "core/Plugin.h"
+#include "core/Program.h"
+#include "kernel/Batch.h"
+
+using namespace oclgrind;
+using namespace std;
+
+namespace
+{
+  // Counts the errors reported by each simulation
+  // Simulations run on their own host thread, and errors raised by a kernel
+  // are attributed to the simulation that launched it
+  class ErrorCounter : public Plugin
+  {
+  public:
+    ErrorCounter(const Context *context) : Plugin(context) {}
+
+    static THREAD_LOCAL atomic<unsigned> *current;
+
+    virtual CallbackMask getCallbacks() const override
+    {
+      return (1 << KERNEL_BEGIN) | (1 << KERNEL_END) | (1 << LOG);
+    }
+
+    virtual void kernelBegin(const KernelInvocation *kernelInvocation) override
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_counters[kernelInvocation] = current;
+    }
+
+    virtual void kernelEnd(const KernelInvocation *kernelInvocation) override
+    {
+      lock_guard<mutex> lock(m_mutex);
+      m_counters.erase(kernelInvocation);
+    }
+
+    virtual void log(MessageType type, const char *message) override
+    {
+      if (type != ERROR)
+        return;
+
+      atomic<unsigned> *counter = current;
+      const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+      if (kernelInvocation)
+      {
+        lock_guard<mutex> lock(m_mutex);
+        auto itr = m_counters.find(kernelInvocation);
+        if (itr != m_counters.end())
+          counter = itr->second;
+      }
+      if (counter)
+        (*counter)++;
+    }
+
+    virtual bool supportsConcurrentKernels() const override
+    {
+      return true;
+    }
+
+  private:
+    mutex m_mutex;
+    map<const KernelInvocation*, atomic<unsigned>*> m_counters;
+  };
+
+  THREAD_LOCAL atomic<unsigned> *ErrorCounter::current = NULL;
+}
+
+Batch::Batch(unsigned numJobs)
+{
+  m_numJobs = numJobs ? numJobs : 1;
+  m_context = new Context();
+  m_nextSimulation = 0;
+  m_nextOutput = 0;
+}
+
+Batch::~Batch()
+{
+  for (auto program : m_programs)
+    delete program.second;
+  delete m_context;
+}
+
+bool Batch::load(const char *filename)
+{
+  ifstream manifest(filename);
+  if (!manifest.good())
+  {
+    cerr << "Unable to open batch manifest " << filename << endl;
+    return false;
+  }
+
+  // One simulation file per line, ignoring comments and blank lines
+  string line;
+  while (getline(manifest, line))
+  {
+    size_t comment = line.find_first_of('#');
+    if (comment != string::npos)
+      line = line.substr(0, comment);
+
+    size_t begin = line.find_first_not_of(" \t\r");
+    if (begin == string::npos)
+      continue;
+    size_t end = line.find_last_not_of(" \t\r");
+
+    Result result;
+    result.filename = line.substr(begin, end - begin + 1);
+    result.done = false;
+    result.loaded = false;
+    result.errors = 0;
+    result.loadTime = 0;
+    result.runTime = 0;
+    m_results.push_back(result);
+  }
+
+  if (m_results.empty())
+  {
+    cerr << "No simulations in batch manifest " << filename << endl;
+    return false;
+  }
+
+  return true;
+}
+
+bool Batch::run()
+{
+  ErrorCounter errorCounter(m_context);
+  m_context->registerPlugin(&errorCounter);
+
+  double start = now();
+
+  m_nextSimulation = 0;
+  m_nextOutput = 0;
+  unsigned numThreads = min((size_t)m_numJobs, m_results.size());
+  vector<thread> threads;
+  for (unsigned i = 1; i < numThreads; i++)
+    threads.push_back(thread(&Batch::runSimulations, this));
+  runSimulations();
+  for (thread& t : threads)
+    t.join();
+
+  double elapsed = now() - start;
+
+  m_context->unregisterPlugin(&errorCounter);
+
+  // Print summary
+  unsigned passed = 0;
+  double loadTime = 0, runTime = 0;
+  for (const Result& result : m_results)
+  {
+    if (result.loaded && !result.errors)
+      passed++;
+    loadTime += result.loadTime;
+    runTime += result.runTime;
+  }
+
+  cout << endl
+       << "Simulations: " << passed << " passed, "
+       << (m_results.size() - passed) << " failed, "
+       << m_results.size() << " total" << endl
+       << "Programs built: " << m_programs.size() << endl
+       << fixed << setprecision(3)
+       << "Time: " << loadTime*1e-9 << " s load, "
+       << runTime*1e-9 << " s run, "
+       << elapsed*1e-9 << " s elapsed" << endl;
+
+  return passed == m_results.size();
+}
+
+void Batch::runSimulation(Result& result)
+{
+  atomic<unsigned> errors(0);
+  ErrorCounter::current = &errors;
+
+  Simulation *simulation = new Simulation(m_context, &m_programs);
+  ostringstream output;
+
+  // Plugins that track a single running kernel need simulations to run one
+  // at a time, including the buffer allocations made while loading them
+  unique_lock<mutex> runLock;
+  if (!m_context->supportsConcurrentKernels())
+    runLock = unique_lock<mutex>(m_runMutex);
+
+  // Loading allocates buffers and may build programs, which are shared
+  // with other simulations
+  double start = now();
+  {
+    lock_guard<mutex> lock(m_loadMutex);
+    result.loaded = simulation->load(result.filename.c_str());
+  }
+  result.loadTime = now() - start;
+
+  if (result.loaded)
+  {
+    start = now();
+    try
+    {
+      simulation->run(false, NULL, output);
+    }
+    catch (const char *err)
+    {
+      cerr << result.filename << ": " << err << endl;
+      errors++;
+    }
+    result.runTime = now() - start;
+  }
+
+  {
+    lock_guard<mutex> lock(m_loadMutex);
+    delete simulation;
+  }
+
+  ErrorCounter::current = NULL;
+  result.errors = errors;
+  result.output = output.str();
+}
+
+void Batch::runSimulations()
+{
+  while (true)
+  {
+    size_t index;
+    {
+      lock_guard<mutex> lock(m_loadMutex);
+      if (m_nextSimulation >= m_results.size())
+        return;
+      index = m_nextSimulation++;
+    }
+
+    runSimulation(m_results[index]);
+
+    // Report results in manifest order as soon as they are available
+    lock_guard<mutex> lock(m_outputMutex);
+    m_results[index].done = true;
+    while (m_nextOutput < m_results.size() && m_results[m_nextOutput].done)
+    {
+      Result& result = m_results[m_nextOutput++];
+      cout << result.output;
+      if (!result.loaded)
+        cout << "FAIL " << result.filename << " (failed to load)";
+      else if (result.errors)
+        cout << "FAIL " << result.filename << " (" << result.errors
+             << (result.errors == 1 ? " error)" : " errors)");
+      else
+        cout << "PASS " << result.filename;
+      cout << fixed << setprecision(3)
+           << " [load " << result.loadTime*1e-9 << " s, run "
+           << result.runTime*1e-9 << " s]" << endl;
+      result.output.clear();
+    }
+  }
+}
@@ -0,0 +1,56 @@
+// Batch.h (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#pragma once
+#include "core/common.h"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "kernel/Simulation.h"
+
+// Runs the simulations listed in a manifest file in one process
+// Simulations share a context and the programs they build, and independent
+// simulations run in parallel
+class Batch
+{
+  public:
+    Batch(unsigned numJobs);
+    virtual ~Batch();
+
+    bool load(const char *filename);
+    bool run();
+
+  private:
+    struct Result
+    {
+      std::string filename;
+      bool done;
+      bool loaded;
+      unsigned errors;
+      double loadTime;
+      double runTime;
+      std::string output;
+    };
+
+    unsigned m_numJobs;
+    std::vector<Result> m_results;
+
+    oclgrind::Context *m_context;
+    Simulation::ProgramMap m_programs;
+
+    std::mutex m_loadMutex;
+    std::mutex m_runMutex;
+    std::mutex m_outputMutex;
+    size_t m_nextSimulation;
+    size_t m_nextOutput;
+
+    void runSimulation(Result& result);
+    void runSimulations();
+};
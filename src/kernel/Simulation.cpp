@@ -11,6 +11,13 @@
 #include <iostream>
 #include <sstream>
 
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "core/Context.h"
 #include "core/Kernel.h"
 #include "core/KernelInvocation.h"
@@ -39,17 +46,49 @@ Simulation::Simulation()
   m_context = new Context();
   m_kernel = NULL;
   m_program = NULL;
+  m_ownsContext = true;
+  m_programs = NULL;
+}
+
+Simulation::Simulation(Context *context, ProgramMap *programs)
+{
+  m_context = context;
+  m_kernel = NULL;
+  m_program = NULL;
+  m_ownsContext = false;
+  m_programs = programs;
 }
 
 Simulation::~Simulation()
 {
   delete m_kernel;
-  delete m_program;
-  delete m_context;
+
+  // Release buffers from a shared context before unmapping their data
+  for (size_t address : m_buffers)
+  {
+    m_context->getGlobalMemory()->deallocateBuffer(address);
+  }
+
+  if (!m_programs)
+    delete m_program;
+  if (m_ownsContext)
+    delete m_context;
+
+  for (const MappedFile& file : m_mappedFiles)
+  {
+#if !defined(_WIN32)
+    if (file.mapped)
+    {
+      munmap(file.data, file.size);
+      continue;
+    }
+#endif
+    delete[] file.data;
+  }
 }
 
 template<typename T>
-void Simulation::dumpArgument(DumpArg& arg)
+void Simulation::dumpArgument(DumpArg& arg, ostream& output)
 {
   size_t num = arg.size / sizeof(T);
   T *data = new T[num];
@@ -57,17 +96,17 @@ void Simulation::dumpArgument(DumpArg& arg)
 
   for (size_t i = 0; i < num; i++)
   {
-    cout << "  " << arg.name << "[" << i << "] = ";
+    output << "  " << arg.name << "[" << i << "] = ";
     if (arg.hex)
-      cout << "0x" << setfill('0') << setw(sizeof(T)*2) << hex;
+      output << "0x" << setfill('0') << setw(sizeof(T)*2) << hex;
     if (sizeof(T) == 1)
-      cout << (int)data[i];
+      output << (int)data[i];
     else
-      cout << data[i];
-    cout << dec;
-    cout << endl;
+      output << data[i];
+    output << dec;
+    output << endl;
   }
-  cout << endl;
+  output << endl;
 
   delete[] data;
 }
@@ -121,6 +160,14 @@ void Simulation::get(T& result)
 
 bool Simulation::load(const char *filename)
 {
+  if (m_programs)
+  {
+    string path = filename;
+    size_t separator = path.find_last_of("/\\");
+    if (separator != string::npos)
+      m_directory = path.substr(0, separator + 1);
+  }
+
   // Open simulator file
   m_lineNumber = 0;
   m_lineBuffer.setstate(ios_base::eofbit);
@@ -149,50 +196,21 @@ bool Simulation::load(const char *filename)
     get(m_wgsize.y);
     get(m_wgsize.z);
 
-    // Open program file
-    ifstream progFile;
-    progFile.open(progFileName.c_str(), ios_base::in | ios_base::binary);
-    if (!progFile.good())
+    // Load program, reusing it if another simulation already built it
+    progFileName = resolvePath(progFileName);
+    if (m_programs && m_programs->count(progFileName))
     {
-      cerr << "Unable to open " << progFileName << endl;
-      return false;
+      m_program = m_programs->at(progFileName);
     }
-
-    // Check for LLVM bitcode magic numbers
-    char magic[2] = {0,0};
-    progFile.read(magic, 2);
-    if (magic[0] == 0x42 && magic[1] == 0x43)
+    else
     {
-      // Load bitcode
-      progFile.close();
-      m_program = Program::createFromBitcodeFile(m_context, progFileName);
-      if (!m_program)
-      {
-        cerr << "Failed to load bitcode from " << progFileName << endl;
-        return false;
-      }
+      m_program = loadProgram(progFileName);
+      if (m_programs)
+        (*m_programs)[progFileName] = m_program;
     }
-    else
+    if (!m_program || m_program->getBuildStatus() != CL_BUILD_SUCCESS)
     {
-      // Get size of file
-      progFile.seekg(0, ios_base::end);
-      size_t sz = progFile.tellg();
-      progFile.seekg(0, ios_base::beg);
-
-      // Load source
-      char *data = new char[sz + 1];
-      progFile.read(data, sz+1);
-      progFile.close();
-      data[sz] = '\0';
-      m_program = new Program(m_context, data);
-      delete[] data;
-
-      // Build program
-      if (!m_program->build(""))
-      {
-        cerr << "Build failure:" << endl << m_program->getBuildLog() << endl;
-        return false;
-      }
+      return false;
     }
 
     // Get kernel
@@ -257,6 +275,107 @@ bool Simulation::load(const char *filename)
   return true;
 }
 
+Program* Simulation::loadProgram(const string& filename)
+{
+  // Open program file
+  ifstream progFile;
+  progFile.open(filename.c_str(), ios_base::in | ios_base::binary);
+  if (!progFile.good())
+  {
+    cerr << "Unable to open " << filename << endl;
+    return NULL;
+  }
+
+  // Check for LLVM bitcode magic numbers
+  char magic[2] = {0,0};
+  progFile.read(magic, 2);
+  if (magic[0] == 0x42 && magic[1] == 0x43)
+  {
+    // Load bitcode
+    progFile.close();
+    Program *program = Program::createFromBitcodeFile(m_context, filename);
+    if (!program)
+    {
+      cerr << "Failed to load bitcode from " << filename << endl;
+    }
+    return program;
+  }
+
+  // Get size of file
+  progFile.clear();
+  progFile.seekg(0, ios_base::end);
+  size_t sz = progFile.tellg();
+  progFile.seekg(0, ios_base::beg);
+
+  // Load source
+  char *data = new char[sz + 1];
+  progFile.read(data, sz+1);
+  progFile.close();
+  data[sz] = '\0';
+  Program *program = new Program(m_context, data);
+  delete[] data;
+
+  // Build program
+  if (!program->build(""))
+  {
+    cerr << "Build failure:" << endl << program->getBuildLog() << endl;
+  }
+  return program;
+}
+
+const Simulation::MappedFile& Simulation::mapFile(const string& filename)
+{
+  MappedFile file = {NULL, 0, false};
+
+#if !defined(_WIN32)
+  // Map the file copy-on-write, so that kernels can modify buffers that use
+  // it without changing the file
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    throw "Unable to open argument data file";
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0)
+  {
+    void *data = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE,
+                      fd, 0);
+    if (data != MAP_FAILED)
+    {
+      file.data = (unsigned char*)data;
+      file.size = st.st_size;
+      file.mapped = true;
+    }
+  }
+  close(fd);
+#endif
+
+  if (!file.mapped)
+  {
+    ifstream input(filename.c_str(), ios_base::in | ios_base::binary);
+    if (!input.good())
+    {
+      throw "Unable to open argument data file";
+    }
+
+    input.seekg(0, ios_base::end);
+    file.size = input.tellg();
+    input.seekg(0, ios_base::beg);
+
+    file.data = new unsigned char[file.size];
+    input.read((char*)file.data, file.size);
+    if (input.fail())
+    {
+      delete[] file.data;
+      throw "Failed to read argument data file";
+    }
+  }
+
+  m_mappedFiles.push_back(file);
+  return m_mappedFiles.back();
+}
+
 void Simulation::parseArgument(size_t index)
 {
   // Argument parsing parameters
@@ -270,6 +389,8 @@ void Simulation::parseArgument(size_t index)
   bool noinit = false;
   string fill = "";
   string range = "";
+  string file = "";
+  string dumpFile = "";
   string name = m_kernel->getArgumentName(index).str();
 
   // Set meaningful parsing status for error messages
@@ -344,9 +465,26 @@ void Simulation::parseArgument(size_t index)
     MATCH_TYPE("ulong", TYPE_ULONG, 8)
     MATCH_TYPE("float", TYPE_FLOAT, 4)
     MATCH_TYPE("double", TYPE_DOUBLE, 8)
+    else if (token == "dump")
+    {
+      dump = true;
+    }
     else if (token.compare(0, 4, "dump") == 0)
     {
+      if (token.size() < 6 || token[4] != '=')
+      {
+        throw "Expected =FILE after 'dump'";
+      }
       dump = true;
+      dumpFile = resolvePath(token.substr(5));
+    }
+    else if (token.compare(0, 4, "file") == 0)
+    {
+      if (token.size() < 6 || token[4] != '=')
+      {
+        throw "Expected =FILE after 'file'";
+      }
+      file = token.substr(5);
     }
     else if (token.compare(0, 4, "fill") == 0)
     {
@@ -437,16 +575,37 @@ void Simulation::parseArgument(size_t index)
     }
   }
 
+  // Binary argument data provides its own size
+  const MappedFile *mappedFile = NULL;
+  if (!file.empty() && !null)
+  {
+    if (addrSpace == CL_KERNEL_ARG_ADDRESS_LOCAL)
+    {
+      throw "'file' not valid for local memory arguments";
+    }
+
+    mappedFile = &mapFile(resolvePath(file));
+    if (size == (size_t)-1)
+    {
+      size = mappedFile->size;
+    }
+    else if (size != mappedFile->size)
+    {
+      throw "Argument data file size doesn't match argument size";
+    }
+  }
+
   // Ensure size given
   if (null)
   {
-    if (size != -1 || !fill.empty() || !range.empty() || noinit || dump)
+    if (size != (size_t)-1 || !fill.empty() || !range.empty() ||
+        !file.empty() || noinit || dump)
     {
       throw "'null' not valid with other argument descriptors";
     }
     size = 0;
   }
-  else if (size == -1)
+  else if (size == (size_t)-1)
   {
     throw "size required";
   }
@@ -500,6 +659,7 @@ void Simulation::parseArgument(size_t index)
   if (noinit) numInitializers++;
   if (!fill.empty()) numInitializers++;
   if (!range.empty()) numInitializers++;
+  if (!file.empty()) numInitializers++;
   if (numInitializers > 1)
   {
     throw "Multiple initializers present";
@@ -519,11 +679,42 @@ void Simulation::parseArgument(size_t index)
     value.data = new unsigned char[value.size];
     memset(value.data, 0, value.size);
   }
+  else if (mappedFile && addrSpace != CL_KERNEL_ARG_ADDRESS_PRIVATE)
+  {
+    // Use the file data as the buffer's storage, instead of copying it
+    Memory *globalMemory = m_context->getGlobalMemory();
+    size_t address =
+      globalMemory->createHostBuffer(size, mappedFile->data,
+                                     flags | CL_MEM_USE_HOST_PTR);
+    if (!address)
+      throw "Failed to allocate global memory";
+    m_buffers.push_back(address);
+    value.data = new unsigned char[value.size];
+    value.setPointer(address);
+
+    if (dump)
+    {
+      DumpArg dump =
+      {
+        address,
+        size,
+        type,
+        name,
+        hex,
+        dumpFile
+      };
+      m_dumpArguments.push_back(dump);
+    }
+  }
   else
   {
     // Parse argument data
     unsigned char *data = new unsigned char[size];
     if (noinit){}
+    else if (mappedFile)
+    {
+      memcpy(data, mappedFile->data, size);
+    }
     else if (!fill.empty())
     {
       istringstream fillStream(fill);
@@ -611,6 +802,7 @@ void Simulation::parseArgument(size_t index)
       size_t address = globalMemory->allocateBuffer(size, flags);
       if (!address)
         throw "Failed to allocate global memory";
+      m_buffers.push_back(address);
       if (!noinit)
         globalMemory->store((unsigned char*)&data[0], address, size);
       value.data = new unsigned char[value.size];
@@ -625,7 +817,8 @@ void Simulation::parseArgument(size_t index)
           size,
           type,
           name,
-          hex
+          hex,
+          dumpFile
         };
         m_dumpArguments.push_back(dump);
       }
@@ -721,7 +914,18 @@ void Simulation::parseRange(unsigned char *result, size_t size,
   }
 }
 
-void Simulation::run(bool dumpGlobalMemory)
+string Simulation::resolvePath(const string& filename) const
+{
+  if (filename.empty() || filename[0] == '/' || filename[0] == '\\' ||
+      (filename.size() > 1 && filename[1] == ':'))
+  {
+    return filename;
+  }
+  return m_directory + filename;
+}
+
+void Simulation::run(bool dumpGlobalMemory, const char *globalMemoryFile,
+                     ostream& output)
 {
   assert(m_kernel && m_program);
   assert(m_kernel->allArgumentsSet());
@@ -730,17 +934,35 @@ void Simulation::run(bool dumpGlobalMemory)
   KernelInvocation::run(m_context, m_kernel, 3, offset, m_ndrange, m_wgsize);
 
   // Dump individual arguments
-  cout << dec;
+  output << dec;
   list<DumpArg>::iterator itr;
   for (itr = m_dumpArguments.begin(); itr != m_dumpArguments.end(); itr++)
   {
-    cout << endl
-         << "Argument '" << itr->name << "': "
-         << itr->size << " bytes" << endl;
+    output << endl
+           << "Argument '" << itr->name << "': "
+           << itr->size << " bytes";
+
+    // Write raw buffer contents to a binary file
+    if (!itr->file.empty())
+    {
+      ofstream dumpFile(itr->file.c_str(), ios_base::out | ios_base::binary);
+      dumpFile.write((const char*)
+                     m_context->getGlobalMemory()->getPointer(itr->address),
+                     itr->size);
+      if (dumpFile.fail())
+      {
+        output << endl;
+        cerr << "Failed to write " << itr->file << endl;
+        continue;
+      }
+      output << " written to " << itr->file << endl;
+      continue;
+    }
+    output << endl;
 
-#define DUMP_TYPE(type, T) \
-  case type:               \
-    dumpArgument<T>(*itr); \
+#define DUMP_TYPE(type, T)         \
+  case type:                       \
+    dumpArgument<T>(*itr, output); \
     break;
 
     switch (itr->type)
@@ -763,9 +985,18 @@ void Simulation::run(bool dumpGlobalMemory)
   // Dump global memory if required
   if (dumpGlobalMemory)
   {
-    cout << endl << "Global Memory:" << endl;
+    output << endl << "Global Memory:" << endl;
     m_context->getGlobalMemory()->dump();
   }
+  if (globalMemoryFile)
+  {
+    ofstream memoryFile(globalMemoryFile, ios_base::out | ios_base::binary);
+    m_context->getGlobalMemory()->dump(memoryFile);
+    if (memoryFile.fail())
+    {
+      cerr << "Failed to write " << globalMemoryFile << endl;
+    }
+  }
 }
 
 template<typename T>
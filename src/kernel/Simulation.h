@@ -6,10 +6,12 @@
 // license terms please see the LICENSE file distributed with this
 // source code.
 
+#pragma once
 #include "core/common.h"
 
 #include <fstream>
 #include <list>
+#include <map>
 #include <sstream>
 #include <string>
 
@@ -38,16 +40,28 @@ class Simulation
   };
 
   public:
+    // Programs built for simulations sharing a context, by program file
+    typedef std::map<std::string, oclgrind::Program*> ProgramMap;
+
     Simulation();
+    // Use a context and programs shared with other simulations
+    // Files are found relative to the simulation file instead of the
+    // working directory
+    Simulation(oclgrind::Context *context, ProgramMap *programs);
     virtual ~Simulation();
 
     bool load(const char *filename);
-    void run(bool dumpGlobalMemory=false);
+    void run(bool dumpGlobalMemory=false, const char *globalMemoryFile=NULL,
+             std::ostream& output=std::cout);
 
   private:
     oclgrind::Context *m_context;
     oclgrind::Kernel *m_kernel;
     oclgrind::Program *m_program;
+    bool m_ownsContext;
+    ProgramMap *m_programs;
+    std::string m_directory;
+    std::list<size_t> m_buffers;
 
     oclgrind::Size3 m_ndrange;
     oclgrind::Size3 m_wgsize;
@@ -64,11 +78,25 @@ class Simulation
       ArgDataType type;
       std::string name;
       bool hex;
+      std::string file;
     };
     std::list<DumpArg> m_dumpArguments;
 
+    // Raw binary argument data, which global memory buffers may use
+    // directly, so it is released after the context
+    struct MappedFile
+    {
+      unsigned char *data;
+      size_t size;
+      bool mapped;
+    };
+    std::list<MappedFile> m_mappedFiles;
+    const MappedFile& mapFile(const std::string& filename);
+
     template<typename T>
-    void dumpArgument(DumpArg& arg);
+    void dumpArgument(DumpArg& arg, std::ostream& output);
+    oclgrind::Program* loadProgram(const std::string& filename);
+    std::string resolvePath(const std::string& filename) const;
     template<typename T>
     void get(T& result);
     void parseArgument(size_t index);
@@ -12,14 +12,19 @@
 #include <cstring>
 #include <iostream>
 #include <string>
+#include <thread>
 
+#include "kernel/Batch.h"
 #include "kernel/Simulation.h"
 
 using namespace oclgrind;
 using namespace std;
 
 static bool outputGlobalMemory = false;
+static const char *globalMemoryFile = NULL;
 static const char *simfile = NULL;
+static const char *batchfile = NULL;
+static unsigned batchJobs = 0;
 
 static bool parseArguments(int argc, char *argv[]);
 static void printUsage();
@@ -33,6 +38,17 @@ int main(int argc, char *argv[])
     return 1;
   }
 
+  // Run each simulation listed in a manifest
+  if (batchfile)
+  {
+    Batch batch(batchJobs ? batchJobs : thread::hardware_concurrency());
+    if (!batch.load(batchfile))
+    {
+      return 1;
+    }
+    return batch.run() ? 0 : 1;
+  }
+
   // Initialise simulation
   Simulation simulation;
   if (!simulation.load(simfile))
@@ -41,14 +57,42 @@ int main(int argc, char *argv[])
   }
 
   // Run simulation
-  simulation.run(outputGlobalMemory);
+  simulation.run(outputGlobalMemory, globalMemoryFile);
 }
 
 static bool parseArguments(int argc, char *argv[])
 {
   for (int i = 1; i < argc; i++)
   {
-    if (!strcmp(argv[i], "--build-options"))
+    if (!strcmp(argv[i], "--aggregate-errors"))
+    {
+      setEnvironment("OCLGRIND_AGGREGATE_ERRORS", "1");
+    }
+    else if (!strcmp(argv[i], "--batch"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --batch" << endl;
+        return false;
+      }
+      batchfile = argv[i];
+    }
+    else if (!strcmp(argv[i], "--batch-jobs"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --batch-jobs" << endl;
+        return false;
+      }
+      char *next;
+      batchJobs = strtoul(argv[i], &next, 10);
+      if (strlen(next) || !batchJobs)
+      {
+        cerr << "Invalid argument to --batch-jobs" << endl;
+        return false;
+      }
+    }
+    else if (!strcmp(argv[i], "--build-options"))
     {
       if (++i >= argc)
       {
@@ -91,6 +135,15 @@ static bool parseArguments(int argc, char *argv[])
     {
       outputGlobalMemory = true;
     }
+    else if (!strcmp(argv[i], "--global-mem-file"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --global-mem-file" << endl;
+        return false;
+      }
+      globalMemoryFile = argv[i];
+    }
     else if (!strcmp(argv[i], "--global-mem-size"))
     {
       if (++i >= argc)
@@ -109,10 +162,24 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_INST_COUNTS", "1");
     }
+    else if (!strcmp(argv[i], "--inst-counts-cumulative"))
+    {
+      setEnvironment("OCLGRIND_INST_COUNTS", "1");
+      setEnvironment("OCLGRIND_INST_COUNTS_CUMULATIVE", "1");
+    }
     else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--interactive"))
     {
       setEnvironment("OCLGRIND_INTERACTIVE", "1");
     }
+    else if (!strcmp(argv[i], "--lanes"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --lanes" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_LANES", argv[i]);
+    }
     else if (!strcmp(argv[i], "--local-mem-size"))
     {
       if (++i >= argc)
@@ -131,6 +198,15 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_LOG", argv[i]);
     }
+    else if (!strcmp(argv[i], "--log-format"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --log-format" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_LOG_FORMAT", argv[i]);
+    }
     else if (!strcmp(argv[i], "--max-errors"))
     {
       if (++i >= argc)
@@ -158,6 +234,10 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_NUM_THREADS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--optimize-ir"))
+    {
+      setEnvironment("OCLGRIND_OPTIMIZE_IR", "1");
+    }
     else if (!strcmp(argv[i], "--pch-dir"))
     {
       if (++i >= argc)
@@ -176,6 +256,19 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_PLUGINS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--profile"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --profile" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_PROFILE", argv[i]);
+    }
+    else if (!strcmp(argv[i], "--profile-flush"))
+    {
+      setEnvironment("OCLGRIND_PROFILE_FLUSH", "1");
+    }
     else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quick"))
     {
       setEnvironment("OCLGRIND_QUICK", "1");
@@ -219,6 +312,21 @@ static bool parseArguments(int argc, char *argv[])
     }
   }
 
+  if (batchfile)
+  {
+    if (simfile)
+    {
+      cerr << "Unexpected simfile with --batch" << endl;
+      return false;
+    }
+    if (outputGlobalMemory || globalMemoryFile)
+    {
+      cerr << "Global memory output not supported with --batch" << endl;
+      return false;
+    }
+    return true;
+  }
+
   if (simfile == NULL)
   {
     printUsage();
@@ -232,9 +340,16 @@ static void printUsage()
 {
   cout
     << "Usage: oclgrind-kernel [OPTIONS] simfile" << endl
+    << "       oclgrind-kernel [OPTIONS] --batch MANIFEST" << endl
     << "       oclgrind-kernel [--help | --version]" << endl
     << endl
     << "Options:" << endl
+    << "  --aggregate-errors           "
+          "Report repeated errors from an instruction once" << endl
+    << "  --batch             MANIFEST "
+          "Run each simulation file listed in a manifest" << endl
+    << "  --batch-jobs        NUM      "
+          "Set the number of simulations to run in parallel" << endl
     << "  --build-options     OPTIONS  "
           "Additional options to pass to the OpenCL compiler" << endl
     << "  --compute-units     UNITS    "
@@ -249,28 +364,42 @@ static void printUsage()
           "Dump SPIR to /tmp/oclgrind_*.{ll,bc}" << endl
     << "  --global-mem [-g]            "
           "Output global memory at exit" << endl
+    << "  --global-mem-file   FILE     "
+          "Write global memory to a binary file at exit" << endl
     << "  --global-mem-size   BYTES    "
           "Change the global memory size of the device" << endl
     << "  --help [-h]                  "
           "Display usage information" << endl
     << "  --inst-counts                "
           "Output histograms of instructions executed" << endl
+    << "  --inst-counts-cumulative     "
+          "Output one histogram of instructions for all kernels" << endl
     << "  --interactive [-i]           "
           "Enable interactive mode" << endl
+    << "  --lanes             NUM      "
+          "Run work-items of barrier-free kernels in lockstep batches" << endl
     << "  --local-mem-size    BYTES    "
           "Change the local memory size of the device" << endl
     << "  --log               LOGFILE  "
           "Redirect log/error messages to a file" << endl
+    << "  --log-format        FORMAT   "
+          "Write log/error messages as 'text' or 'json' lines" << endl
     << "  --max-errors        NUM      "
           "Limit the number of error/warning messages" << endl
     << "  --max-wgsize        WGSIZE   "
           "Change the maximum work-group size of the device" << endl
     << "  --num-threads       NUM      "
           "Set the number of worker threads to use" << endl
+    << "  --optimize-ir                "
+          "Optimize kernels to reduce interpretation cost" << endl
     << "  --pch-dir           DIR      "
           "Override directory containing precompiled headers" << endl
     << "  --plugins           PLUGINS  "
           "Load colon separated list of plugin libraries" << endl
+    << "  --profile           FILE     "
+          "Write a callgrind profile of kernel hotspots to a file" << endl
+    << "  --profile-flush              "
+          "Rewrite the profile after every kernel" << endl
     << "  --quick [-q]                 "
           "Only run first and last work-group" << endl
     << "  --uniform-writes             "
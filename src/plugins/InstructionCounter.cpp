@@ -28,7 +28,8 @@ using namespace std;
 #define COUNTED_CALL_BASE  (COUNTED_STORE_BASE + 8)
 
 THREAD_LOCAL InstructionCounter::WorkerState
-  InstructionCounter::m_state = {NULL};
+  InstructionCounter::m_state = {0, NULL};
+atomic<size_t> InstructionCounter::m_nextKernelID(1);
 
 static bool compareNamedCount(pair<string,size_t> a, pair<string,size_t> b)
 {
@@ -40,24 +41,70 @@ static bool compareNamedCount(pair<string,size_t> a, pair<string,size_t> b)
     return a.first < b.first;
 }
 
-string InstructionCounter::getOpcodeName(unsigned opcode) const
+InstructionCounter::InstructionCounter(const Context *context)
+ : Plugin(context)
+{
+  m_kernelID = 0;
+
+  m_cumulative = checkEnv("OCLGRIND_INST_COUNTS_CUMULATIVE");
+  m_numKernels = 0;
+}
+
+InstructionCounter::~InstructionCounter()
+{
+  if (m_cumulative && m_numKernels)
+  {
+    ostringstream title;
+    title << "Instructions executed for all kernels ("
+          << m_numKernels << " invocations):";
+    printCounts(title.str(), m_totalCounts, m_totalMemopBytes);
+  }
+
+  for (auto arena : m_arenas)
+    delete arena.second;
+}
+
+Plugin::CallbackMask InstructionCounter::getCallbacks() const
+{
+  return (1 << INSTRUCTION_EXECUTED) |
+         (1 << KERNEL_BEGIN) |
+         (1 << KERNEL_END);
+}
+
+InstructionCounter::Arena* InstructionCounter::getArena()
+{
+  // Look up this thread's arena once per kernel
+  if (m_state.kernelID != m_kernelID)
+  {
+    lock_guard<mutex> lock(m_arenaMutex);
+
+    Arena*& arena = m_arenas[this_thread::get_id()];
+    if (!arena)
+    {
+      arena = new Arena;
+      arena->instCounts.resize(COUNTED_CALL_BASE);
+      arena->memopBytes.resize(16);
+    }
+
+    m_state.kernelID = m_kernelID;
+    m_state.arena = arena;
+  }
+  return m_state.arena;
+}
+
+string InstructionCounter::getOpcodeName(
+  unsigned opcode, const vector<const llvm::Function*>& functions) const
 {
   if (opcode >= COUNTED_CALL_BASE)
   {
     // Get function name
     unsigned index = opcode - COUNTED_CALL_BASE;
-    assert(index < m_functions.size());
-    return "call " + m_functions[index]->getName().str() + "()";
+    assert(index < functions.size());
+    return "call " + functions[index]->getName().str() + "()";
   }
   else if (opcode >= COUNTED_LOAD_BASE)
   {
-    // Create stream using default locale
     ostringstream name;
-    locale defaultLocale("");
-    name.imbue(defaultLocale);
-
-    // Get number of bytes
-    size_t bytes = m_memopBytes[opcode-COUNTED_LOAD_BASE];
 
     // Get name of operation
     if (opcode >= COUNTED_STORE_BASE)
@@ -74,9 +121,6 @@ string InstructionCounter::getOpcodeName(unsigned opcode) const
     // Add address space to name
     name << " " << getAddressSpaceName(opcode);
 
-    // Add number of bytes to name
-    name << " (" << bytes << " bytes)";
-
     return name.str();
   }
 
@@ -87,6 +131,7 @@ void InstructionCounter::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
 {
+  Arena *arena = getArena();
   unsigned opcode = instruction->getOpcode();
 
   // Check for loads and stores
@@ -100,7 +145,7 @@ void InstructionCounter::instructionExecuted(
 
     // Count total number of bytes loaded/stored
     unsigned bytes = getTypeSize(type->getPointerElementType());
-    (*m_state.memopBytes)[opcode-COUNTED_LOAD_BASE] += bytes;
+    arena->memopBytes[opcode-COUNTED_LOAD_BASE] += bytes;
   }
   else if (opcode == llvm::Instruction::Call)
   {
@@ -110,63 +155,91 @@ void InstructionCounter::instructionExecuted(
     if (function)
     {
       vector<const llvm::Function*>::iterator itr =
-        find(m_state.functions->begin(), m_state.functions->end(), function);
-      if (itr == m_state.functions->end())
+        find(arena->functions.begin(), arena->functions.end(), function);
+      if (itr == arena->functions.end())
       {
-        opcode = COUNTED_CALL_BASE + m_state.functions->size();
-        m_state.functions->push_back(function);
+        opcode = COUNTED_CALL_BASE + arena->functions.size();
+        arena->functions.push_back(function);
       }
       else
       {
-        opcode = COUNTED_CALL_BASE + (itr - m_state.functions->begin());
+        opcode = COUNTED_CALL_BASE + (itr - arena->functions.begin());
       }
     }
   }
 
-  if (opcode >= m_state.instCounts->size())
+  if (opcode >= arena->instCounts.size())
   {
-    m_state.instCounts->resize(opcode+1);
+    arena->instCounts.resize(opcode+1);
   }
-  (*m_state.instCounts)[opcode]++;
+  arena->instCounts[opcode]++;
 }
 
 void InstructionCounter::kernelBegin(const KernelInvocation *kernelInvocation)
 {
-  m_instructionCounts.clear();
+  m_kernelID = m_nextKernelID++;
+}
+
+void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
+{
+  // Merge every worker's counts by name, resetting them for the next kernel
+  NamedCounts counts, memopBytes;
+  for (auto itr : m_arenas)
+  {
+    Arena *arena = itr.second;
+    for (unsigned i = 0; i < arena->instCounts.size(); i++)
+    {
+      if (arena->instCounts[i] == 0)
+        continue;
+
+      string name = getOpcodeName(i, arena->functions);
+      counts[name] += arena->instCounts[i];
+      if (i >= COUNTED_LOAD_BASE && i < COUNTED_CALL_BASE)
+        memopBytes[name] += arena->memopBytes[i-COUNTED_LOAD_BASE];
+    }
 
-  m_memopBytes.clear();
-  m_memopBytes.resize(16);
+    arena->instCounts.assign(COUNTED_CALL_BASE, 0);
+    arena->memopBytes.assign(16, 0);
+    arena->functions.clear();
+  }
+  m_kernelID = 0;
+
+  if (m_cumulative)
+  {
+    for (auto count : counts)
+      m_totalCounts[count.first] += count.second;
+    for (auto bytes : memopBytes)
+      m_totalMemopBytes[bytes.first] += bytes.second;
+    m_numKernels++;
+    return;
+  }
 
-  m_functions.clear();
+  printCounts("Instructions executed for kernel '" +
+              kernelInvocation->getKernel()->getName() + "':",
+              counts, memopBytes);
 }
 
-void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
+void InstructionCounter::printCounts(const string& title,
+                                     const NamedCounts& counts,
+                                     const NamedCounts& memopBytes) const
 {
   // Load default locale
   locale previousLocale = cout.getloc();
   locale defaultLocale("");
   cout.imbue(defaultLocale);
 
-  cout << "Instructions executed for kernel '"
-       << kernelInvocation->getKernel()->getName() << "':";
-  cout << endl;
+  cout << title << endl;
 
   // Generate list named instructions and their counts
   vector< pair<string,size_t> > namedCounts;
-  for (unsigned i = 0; i < m_instructionCounts.size(); i++)
+  for (auto count : counts)
   {
-    if (m_instructionCounts[i] == 0)
+    if (count.first.compare(0, 14, "call llvm.dbg.") == 0)
     {
       continue;
     }
 
-    string name = getOpcodeName(i);
-    if (name.compare(0, 14, "call llvm.dbg.") == 0)
-    {
-      continue;
-    }
-
-    namedCounts.push_back(make_pair(name, m_instructionCounts[i]));
+    namedCounts.push_back(count);
   }
 
   // Sort named counts
@@ -176,7 +249,15 @@ void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
   for (unsigned i = 0; i < namedCounts.size(); i++)
   {
     cout << setw(16) << dec << namedCounts[i].second << " - "
-         << namedCounts[i].first << endl;
+         << namedCounts[i].first;
+
+    // Add number of bytes to loads and stores
+    auto bytes = memopBytes.find(namedCounts[i].first);
+    if (bytes != memopBytes.end())
+    {
+      cout << " (" << bytes->second << " bytes)";
+    }
+    cout << endl;
   }
 
   cout << endl;
@@ -184,61 +265,3 @@ void InstructionCounter::kernelEnd(const KernelInvocation *kernelInvocation)
   // Restore locale
   cout.imbue(previousLocale);
 }
-
-void InstructionCounter::workGroupBegin(const WorkGroup *workGroup)
-{
-  // Create worker state if haven't already
-  if (!m_state.instCounts)
-  {
-    m_state.instCounts = new vector<size_t>;
-    m_state.memopBytes = new vector<size_t>;
-    m_state.functions = new vector<const llvm::Function*>;
-  }
-
-  m_state.instCounts->clear();
-  m_state.instCounts->resize(COUNTED_CALL_BASE);
-
-  m_state.memopBytes->clear();
-  m_state.memopBytes->resize(16);
-
-  m_state.functions->clear();
-}
-
-void InstructionCounter::workGroupComplete(const WorkGroup *workGroup)
-{
-  lock_guard<mutex> lock(m_mtx);
-
-  if (m_state.instCounts->size() > m_instructionCounts.size())
-    m_instructionCounts.resize(m_state.instCounts->size());
-
-  // Merge instruction counts into global list
-  for (unsigned i = 0; i < m_state.instCounts->size(); i++)
-  {
-    if (m_state.instCounts->at(i) == 0)
-      continue;
-
-    // Merge functions into global list
-    unsigned opcode = i;
-    if (i >= COUNTED_CALL_BASE)
-    {
-      const llvm::Function *func = m_state.functions->at(i - COUNTED_CALL_BASE);
-      vector<const llvm::Function*>::iterator itr =
-        find(m_functions.begin(), m_functions.end(), func);
-      if (itr == m_functions.end())
-      {
-        opcode = COUNTED_CALL_BASE + m_functions.size();
-        m_functions.push_back(func);
-      }
-      else
-      {
-        opcode = COUNTED_CALL_BASE + (itr - m_functions.begin());
-      }
-    }
-
-    m_instructionCounts[opcode] += m_state.instCounts->at(i);
-  }
-
-  // Merge memory transfer sizes into global list
-  for (unsigned i = 0; i < m_state.memopBytes->size(); i++)
-    m_memopBytes[i] += m_state.memopBytes->at(i);
-}
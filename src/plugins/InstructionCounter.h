@@ -8,7 +8,9 @@
 
 #include "core/Plugin.h"
 
+#include <atomic>
 #include <mutex>
+#include <thread>
 
 namespace llvm
 {
@@ -20,31 +22,51 @@ namespace oclgrind
   class InstructionCounter : public Plugin
   {
   public:
-    InstructionCounter(const Context *context) : Plugin(context){};
+    InstructionCounter(const Context *context);
+    virtual ~InstructionCounter();
 
+    virtual CallbackMask getCallbacks() const override;
     virtual void instructionExecuted(const WorkItem *workItem,
                                      const llvm::Instruction *instruction,
                                      const TypedValue& result) override;
     virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
     virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
-    virtual void workGroupBegin(const WorkGroup *workGroup) override;
-    virtual void workGroupComplete(const WorkGroup *workGroup) override;
 
   private:
-    std::vector<size_t> m_instructionCounts;
-    std::vector<size_t> m_memopBytes;
-    std::vector<const llvm::Function*> m_functions;
+    typedef std::map<std::string,size_t> NamedCounts;
+
+    // Counters owned by one worker thread, kept across kernels and only
+    // merged into the totals when a kernel ends
+    struct Arena
+    {
+      std::vector<size_t> instCounts;
+      std::vector<size_t> memopBytes;
+      std::vector<const llvm::Function*> functions;
+    };
 
     struct WorkerState
     {
-      std::vector<size_t> *instCounts;
-      std::vector<size_t> *memopBytes;
-      std::vector<const llvm::Function*> *functions;
+      size_t kernelID;
+      Arena *arena;
     };
     static THREAD_LOCAL WorkerState m_state;
+    static std::atomic<size_t> m_nextKernelID;
+
+    size_t m_kernelID;
+    std::mutex m_arenaMutex;
+    std::map<std::thread::id, Arena*> m_arenas;
 
-    std::mutex m_mtx;
+    // Totals across all kernels, when reporting cumulatively
+    bool m_cumulative;
+    unsigned m_numKernels;
+    NamedCounts m_totalCounts;
+    NamedCounts m_totalMemopBytes;
 
-    std::string getOpcodeName(unsigned opcode) const;
+    Arena* getArena();
+    std::string getOpcodeName(unsigned opcode,
+                              const std::vector<const llvm::Function*>&
+                                functions) const;
+    void printCounts(const std::string& title, const NamedCounts& counts,
+                     const NamedCounts& memopBytes) const;
   };
 }
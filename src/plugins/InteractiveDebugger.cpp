@@ -85,6 +85,14 @@ InteractiveDebugger::InteractiveDebugger(const Context *context)
   ADD_CMD("workitem",     "wi", workitem);
 }
 
+Plugin::CallbackMask InteractiveDebugger::getCallbacks() const
+{
+  return (1 << INSTRUCTION_EXECUTED) |
+         (1 << KERNEL_BEGIN) |
+         (1 << KERNEL_END) |
+         (1 << LOG);
+}
+
 void InteractiveDebugger::instructionExecuted(
   const WorkItem *workItem, const llvm::Instruction *instruction,
   const TypedValue& result)
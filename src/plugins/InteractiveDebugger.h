@@ -17,6 +17,7 @@ namespace oclgrind
   public:
     InteractiveDebugger(const Context *context);
 
+    virtual CallbackMask getCallbacks() const override;
     virtual void instructionExecuted(const WorkItem *workItem,
                                      const llvm::Instruction *instruction,
                                      const TypedValue& result) override;
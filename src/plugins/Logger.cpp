@@ -8,19 +8,43 @@
 
 #include "core/common.h"
 
+#include <chrono>
 #include <fstream>
-#include <mutex>
 
 #include "Logger.h"
 
+#include "core/KernelInvocation.h"
+#include "core/WorkItem.h"
+
 using namespace oclgrind;
 using namespace std;
 
 #define DEFAULT_MAX_ERRORS 1000
 
-unsigned Logger::m_numErrors = 0;
+atomic<unsigned> Logger::m_numErrors(0);
+
+static const char *TYPE_NAMES[] = {"debug", "info", "warning", "error"};
 
-static mutex logMutex;
+// Get the kind of a diagnostic from the first line of its message, with
+// any addresses removed so that reports from different work-items match
+static string getErrorKind(const string& message)
+{
+  string kind;
+  size_t end = message.find('\n');
+  if (end == string::npos)
+    end = message.size();
+  for (size_t i = 0; i < end; i++)
+  {
+    kind += message[i];
+    if (message[i] == '0' && i + 1 < end && message[i+1] == 'x')
+    {
+      kind += "x...";
+      for (i += 2; i < end && isxdigit(message[i]); i++);
+      i--;
+    }
+  }
+  return kind;
+}
 
 Logger::Logger(const Context *context)
  : Plugin(context)
@@ -38,11 +62,53 @@ Logger::Logger(const Context *context)
     }
   }
 
+  m_json = false;
+  const char *format = getenv("OCLGRIND_LOG_FORMAT");
+  if (format)
+  {
+    if (!strcmp(format, "json"))
+      m_json = true;
+    else if (strcmp(format, "text"))
+      cerr << "Oclgrind: Invalid log format '" << format << "'" << endl;
+  }
+
+  m_aggregate = checkEnv("OCLGRIND_AGGREGATE_ERRORS");
   m_maxErrors = getEnvInt("OCLGRIND_MAX_ERRORS", DEFAULT_MAX_ERRORS);
+
+  // The interactive debugger prints to stdout while work-items are running,
+  // so messages have to be written before the debugger continues
+  m_sync = checkEnv("OCLGRIND_INTERACTIVE");
+
+  m_ring = new Cell[RING_SIZE];
+  for (size_t i = 0; i < RING_SIZE; i++)
+    m_ring[i].sequence = i;
+  m_enqueuePos = 0;
+  m_dequeuePos = 0;
+
+  m_writerIdle = false;
+  m_numWritten = 0;
+  m_shutdown = false;
+  m_writer = thread(&Logger::writer, this);
 }
 
 Logger::~Logger()
 {
+  if (m_aggregate)
+  {
+    Record record = Record();
+    record.summary = true;
+    enqueue(record, true);
+  }
+
+  {
+    lock_guard<mutex> lock(m_writerMutex);
+    m_shutdown = true;
+  }
+  m_wake.notify_one();
+  m_writer.join();
+
+  delete[] m_ring;
+
   if (m_log != &cerr)
   {
     ((ofstream*)m_log)->close();
@@ -50,22 +116,291 @@ Logger::~Logger()
   }
 }
 
+void Logger::enqueue(Record& record, bool wait)
+{
+  while (!push(record))
+  {
+    // Ring is full, so give the writer a chance to catch up
+    m_wake.notify_one();
+    this_thread::yield();
+  }
+
+  if (wait)
+  {
+    size_t target = m_enqueuePos;
+    unique_lock<mutex> lock(m_writerMutex);
+    m_wake.notify_one();
+    m_drained.wait(lock, [&]{ return m_numWritten >= target; });
+  }
+  else if (m_writerIdle)
+  {
+    m_wake.notify_one();
+  }
+}
+
+Plugin::CallbackMask Logger::getCallbacks() const
+{
+  return (1 << KERNEL_END) | (1 << LOG);
+}
+
+void Logger::kernelEnd(const KernelInvocation *kernelInvocation)
+{
+  // Write everything the kernel reported before control returns to the host
+  Record record = Record();
+  record.summary = m_aggregate;
+  enqueue(record, true);
+}
+
 void Logger::log(MessageType type, const char *message)
 {
-  lock_guard<mutex> lock(logMutex);
+  Record record;
+  record.summary = false;
+  record.suppressed = false;
+  record.type = type;
+  record.message = message;
+  record.instruction = NULL;
+  record.hasWorkItem = false;
+
+  const KernelInvocation *kernelInvocation = KernelInvocation::getCurrent();
+  bool worker = false;
+  if (kernelInvocation)
+  {
+    const WorkItem *workItem = kernelInvocation->getCurrentWorkItem();
+    if (workItem)
+    {
+      record.instruction = workItem->getCurrentInstruction();
+      record.hasWorkItem = true;
+      record.workItem = workItem->getGlobalID();
+    }
+    worker = workItem || kernelInvocation->getCurrentWorkGroup();
+  }
 
   // Limit number of errors/warning printed
-  if (type == ERROR || type == WARNING)
+  // Repeated diagnostics are collapsed first when aggregating, so the
+  // writer thread applies the limit instead
+  if (!m_aggregate && (type == ERROR || type == WARNING))
+  {
+    unsigned numErrors = m_numErrors++;
+    if (numErrors > m_maxErrors)
+      return;
+    if (numErrors == m_maxErrors)
+      record.suppressed = true;
+  }
+
+  // Messages from outside of work-items are written immediately, so that
+  // they are ordered with respect to the host program's own output
+  enqueue(record, m_sync || !worker);
+}
+
+bool Logger::pop(Record& record)
+{
+  Cell& cell = m_ring[m_dequeuePos & (RING_SIZE-1)];
+  if (cell.sequence.load(memory_order_acquire) != m_dequeuePos + 1)
+    return false;
+
+  record = std::move(cell.record);
+  cell.sequence.store(m_dequeuePos + RING_SIZE, memory_order_release);
+  m_dequeuePos++;
+  return true;
+}
+
+bool Logger::push(Record& record)
+{
+  size_t pos = m_enqueuePos.load(memory_order_relaxed);
+  Cell *cell;
+  while (true)
+  {
+    cell = &m_ring[pos & (RING_SIZE-1)];
+    size_t sequence = cell->sequence.load(memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+    if (diff == 0)
+    {
+      if (m_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                             memory_order_relaxed))
+        break;
+    }
+    else if (diff < 0)
+    {
+      return false;
+    }
+    else
+    {
+      pos = m_enqueuePos.load(memory_order_relaxed);
+    }
+  }
+
+  cell->record = std::move(record);
+  cell->sequence.store(pos + 1, memory_order_release);
+  return true;
+}
+
+bool Logger::supportsConcurrentKernels() const
+{
+  return true;
+}
+
+void Logger::write(const Record& record)
+{
+  if (record.summary)
+  {
+    writeSummary();
+    return;
+  }
+
+  if (record.suppressed)
+  {
+    writeSuppressed();
+    return;
+  }
+
+  if (record.message.empty())
+    return;
+
+  string kind;
+  if (m_aggregate && record.instruction)
   {
-    if (m_numErrors == m_maxErrors)
+    kind = getErrorKind(record.message);
+    auto index =
+      m_aggregateIndices.find(AggregateKey(record.instruction, kind));
+    if (index != m_aggregateIndices.end())
     {
-      *m_log << endl << "Oclgrind: "
-             << m_numErrors << " errors generated - suppressing further errors"
-             << endl << endl;
+      Aggregate& aggregate = m_aggregates[index->second];
+      aggregate.repeats++;
+      if (record.hasWorkItem && aggregate.examples.size() < MAX_EXAMPLES)
+        aggregate.examples.push_back(record.workItem);
+      return;
     }
-    if (m_numErrors++ >= m_maxErrors)
+  }
+
+  if (m_aggregate && (record.type == ERROR || record.type == WARNING))
+  {
+    unsigned numErrors = m_numErrors++;
+    if (numErrors == m_maxErrors)
+      writeSuppressed();
+    if (numErrors >= m_maxErrors)
       return;
   }
 
-  *m_log << endl << message << endl;
+  // Only diagnostics that were written are summarised, so suppressed ones
+  // do not reappear in the summary
+  if (m_aggregate && record.instruction)
+  {
+    m_aggregateIndices[AggregateKey(record.instruction, kind)] =
+      m_aggregates.size();
+    m_aggregates.push_back({kind, 0, {}});
+  }
+
+  writeMessage(record.type, record.message, &record);
+}
+
+void Logger::writeMessage(MessageType type, const string& message,
+                          const Record *record)
+{
+  if (!m_json)
+  {
+    *m_log << endl << message << endl;
+    return;
+  }
+
+  *m_log << "{\"type\": \"" << TYPE_NAMES[type] << "\""
+         << ", \"kind\": \"" << escapeJSON(getErrorKind(message)) << "\"";
+  if (record && record->hasWorkItem)
+  {
+    const Size3& wi = record->workItem;
+    *m_log << ", \"workItem\": [" << wi.x << ", " << wi.y << ", " << wi.z
+           << "]";
+  }
+  *m_log << ", \"message\": \"" << escapeJSON(message) << "\"}" << endl;
+}
+
+void Logger::writeSuppressed()
+{
+  if (m_json)
+  {
+    *m_log << "{\"type\": \"suppressed\", \"errors\": " << m_maxErrors << "}"
+           << endl;
+    return;
+  }
+
+  *m_log << endl << "Oclgrind: "
+         << m_maxErrors << " errors generated - suppressing further errors"
+         << endl << endl;
+}
+
+void Logger::writeSummary()
+{
+  for (const Aggregate& aggregate : m_aggregates)
+  {
+    if (!aggregate.repeats)
+      continue;
+
+    if (m_json)
+    {
+      *m_log << "{\"type\": \"summary\""
+             << ", \"kind\": \"" << escapeJSON(aggregate.kind) << "\""
+             << ", \"repeats\": " << aggregate.repeats
+             << ", \"workItems\": [";
+      for (unsigned i = 0; i < aggregate.examples.size(); i++)
+      {
+        const Size3& wi = aggregate.examples[i];
+        *m_log << (i ? ", " : "")
+               << "[" << wi.x << ", " << wi.y << ", " << wi.z << "]";
+      }
+      *m_log << "]}" << endl;
+    }
+    else
+    {
+      *m_log << endl << "Oclgrind: " << aggregate.kind
+             << " (repeated " << aggregate.repeats << " more times)" << endl;
+      if (!aggregate.examples.empty())
+      {
+        *m_log << "\tExamples:";
+        for (const Size3& wi : aggregate.examples)
+          *m_log << " Global" << wi;
+        if (aggregate.repeats > aggregate.examples.size())
+          *m_log << " ...";
+        *m_log << endl;
+      }
+    }
+  }
+
+  m_aggregates.clear();
+  m_aggregateIndices.clear();
+}
+
+void Logger::writer()
+{
+  unique_lock<mutex> lock(m_writerMutex);
+  while (true)
+  {
+    lock.unlock();
+
+    Record record;
+    size_t written = 0;
+    while (pop(record))
+    {
+      write(record);
+      written++;
+    }
+    if (written)
+      m_log->flush();
+
+    lock.lock();
+
+    if (written)
+    {
+      m_numWritten += written;
+      m_drained.notify_all();
+      continue;
+    }
+
+    if (m_shutdown)
+      return;
+
+    // Producers only notify the writer while it is idle, so wake up
+    // periodically in case a notification was missed
+    m_writerIdle = true;
+    m_wake.wait_for(lock, chrono::milliseconds(10));
+    m_writerIdle = false;
+  }
 }
@@ -8,20 +8,91 @@
 
 #include "core/Plugin.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
 namespace oclgrind
 {
+  // Writes diagnostics to stderr or a log file
+  // Messages from worker threads are queued in a lock-free ring buffer and
+  // written by a background thread, which is drained at the end of each
+  // kernel so that diagnostics are never reported after the kernel returns
   class Logger : public Plugin
   {
   public:
     Logger(const Context *context);
     virtual ~Logger();
 
+    virtual CallbackMask getCallbacks() const override;
+    virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
     virtual void log(MessageType type, const char *message) override;
+    virtual bool supportsConcurrentKernels() const override;
 
   private:
+    static const size_t RING_SIZE = 1024;
+    static const size_t MAX_EXAMPLES = 4;
+
+    struct Record
+    {
+      bool summary;
+      // Set on the first error past the limit, which is not written
+      bool suppressed;
+      MessageType type;
+      std::string message;
+      const llvm::Instruction *instruction;
+      bool hasWorkItem;
+      Size3 workItem;
+    };
+
+    // Ring buffer cell, whose sequence number says whether it is ready to
+    // be written by a producer or read by the writer thread
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      Record record;
+    };
+    Cell *m_ring;
+    std::atomic<size_t> m_enqueuePos;
+    size_t m_dequeuePos;
+
+    std::thread m_writer;
+    std::mutex m_writerMutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_drained;
+    std::atomic<bool> m_writerIdle;
+    size_t m_numWritten;
+    bool m_shutdown;
+
     std::ostream *m_log;
+    bool m_json;
+    bool m_sync;
 
     unsigned m_maxErrors;
-    static unsigned m_numErrors;
+    static std::atomic<unsigned> m_numErrors;
+
+    // Repeated diagnostics, keyed by instruction and error kind
+    // Only accessed by the writer thread
+    typedef std::pair<const llvm::Instruction*, std::string> AggregateKey;
+    struct Aggregate
+    {
+      std::string kind;
+      size_t repeats;
+      std::vector<Size3> examples;
+    };
+    bool m_aggregate;
+    std::map<AggregateKey, size_t> m_aggregateIndices;
+    std::vector<Aggregate> m_aggregates;
+
+    void enqueue(Record& record, bool wait);
+    bool pop(Record& record);
+    bool push(Record& record);
+    void write(const Record& record);
+    void writeMessage(MessageType type, const std::string& message,
+                      const Record *record);
+    void writeSuppressed();
+    void writeSummary();
+    void writer();
   };
 }
@@ -23,6 +23,18 @@ using namespace std;
 MemCheck::MemCheck(const Context *context)
  : Plugin(context)
 {
+  m_numMapRegions = 0;
+}
+
+Plugin::CallbackMask MemCheck::getCallbacks() const
+{
+  return (1 << MEMORY_INSTRUCTION_EXECUTED) |
+         (1 << MEMORY_ATOMIC_LOAD) |
+         (1 << MEMORY_ATOMIC_STORE) |
+         (1 << MEMORY_LOAD) |
+         (1 << MEMORY_MAP) |
+         (1 << MEMORY_STORE) |
+         (1 << MEMORY_UNMAP);
 }
 
 void MemCheck::instructionExecuted(const WorkItem *workItem,
@@ -89,7 +101,10 @@ void MemCheck::memoryMap(const Memory *memory, size_t address,
     address, offset, size, memory->getPointer(address + offset),
     (flags == CL_MAP_READ ? MapRegion::READ : MapRegion::WRITE)
   };
+
+  lock_guard<mutex> lock(m_mapMutex);
   m_mapRegions.push_back(map);
+  m_numMapRegions++;
 }
 
 void MemCheck::memoryStore(const Memory *memory, const WorkItem *workItem,
@@ -109,6 +124,7 @@ void MemCheck::memoryStore(const Memory *memory, const WorkGroup *workGroup,
 void MemCheck::memoryUnmap(const Memory *memory, size_t address,
                            const void *ptr)
 {
+  lock_guard<mutex> lock(m_mapMutex);
   for (auto region = m_mapRegions.begin();
             region != m_mapRegions.end();
             region++)
@@ -116,11 +132,17 @@ void MemCheck::memoryUnmap(const Memory *memory, size_t address,
     if (region->ptr == ptr)
     {
       m_mapRegions.erase(region);
+      m_numMapRegions--;
       return;
     }
   }
 }
 
+bool MemCheck::supportsConcurrentKernels() const
+{
+  return true;
+}
+
 void MemCheck::checkArrayAccess(const WorkItem *workItem,
                                 const llvm::GetElementPtrInst *GEPI) const
 {
@@ -178,7 +200,11 @@ void MemCheck::checkLoad(const Memory *memory,
   
   if (memory->getAddressSpace() == AddrSpaceLocal || memory->getAddressSpace() == AddrSpacePrivate) return;
 
+  if (!m_numMapRegions)
+    return;
+
   // Check if memory location is currently mapped for writing
+  lock_guard<mutex> lock(m_mapMutex);
   for (auto region = m_mapRegions.begin();
             region != m_mapRegions.end();
             region++)
@@ -208,7 +234,11 @@ void MemCheck::checkStore(const Memory *memory,
 
   if (memory->getAddressSpace() == AddrSpaceLocal || memory->getAddressSpace() == AddrSpacePrivate) return;
 
+  if (!m_numMapRegions)
+    return;
+
   // Check if memory location is currently mapped
+  lock_guard<mutex> lock(m_mapMutex);
   for (auto region = m_mapRegions.begin();
             region != m_mapRegions.end();
             region++)
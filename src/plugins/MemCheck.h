@@ -8,6 +8,9 @@
 
 #include "core/Plugin.h"
 
+#include <atomic>
+#include <mutex>
+
 namespace llvm
 {
     class GetElementPtrInst;
@@ -20,6 +23,7 @@ namespace oclgrind
   public:
     MemCheck(const Context *context);
 
+    virtual CallbackMask getCallbacks() const override;
     virtual void instructionExecuted(const WorkItem *workItem,
                                      const llvm::Instruction *instruction,
                                      const TypedValue& result) override;
@@ -46,6 +50,7 @@ namespace oclgrind
                              const uint8_t *storeData) override;
     virtual void memoryUnmap(const Memory *memory, size_t address,
                              const void *ptr) override;
+    virtual bool supportsConcurrentKernels() const override;
 
   private:
     void checkArrayAccess(const WorkItem *workItem,
@@ -64,5 +69,10 @@ namespace oclgrind
       enum {READ, WRITE} type;
     };
     std::list<MapRegion> m_mapRegions;
+
+    // Map commands can run concurrently with kernels, so accesses only
+    // take the lock while some buffer is mapped
+    mutable std::mutex m_mapMutex;
+    std::atomic<size_t> m_numMapRegions;
   };
 }
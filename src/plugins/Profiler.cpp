@@ -0,0 +1,405 @@
+// Profiler.cpp (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/common.h"
+
+#include <fstream>
+#include <set>
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Instructions.h"
+
+#include "Profiler.h"
+
+#include "core/Kernel.h"
+#include "core/KernelInvocation.h"
+#include "core/Memory.h"
+#include "core/Program.h"
+#include "core/WorkItem.h"
+
+using namespace oclgrind;
+using namespace std;
+
+THREAD_LOCAL Profiler::WorkerState Profiler::m_state = {0, NULL};
+atomic<size_t> Profiler::m_nextKernelID(1);
+
+static const char *EVENT_NAMES[] =
+{
+  "Ir",
+  "LdPrivate", "LdGlobal", "LdConstant", "LdLocal",
+  "StPrivate", "StGlobal", "StConstant", "StLocal",
+  "Atomics",
+  "Barriers",
+};
+
+Profiler::Profiler(const Context *context)
+ : Plugin(context)
+{
+  m_kernelID = 0;
+  m_cache = NULL;
+
+  const char *output = getenv("OCLGRIND_PROFILE");
+  m_outputFile = (output && strcmp(output, "1")) ? output
+                                                 : "oclgrind.callgrind";
+  m_flush = checkEnv("OCLGRIND_PROFILE_FLUSH");
+}
+
+Profiler::~Profiler()
+{
+  if (!m_flush && !m_profile.empty())
+  {
+    writeCallgrind();
+    writeJSON();
+  }
+
+  for (auto arena : m_arenas)
+    delete arena.second;
+}
+
+void Profiler::addFunction(const llvm::Function *function)
+{
+  set<const llvm::Function*> processed;
+  list<const llvm::Function*> pending;
+  pending.push_back(function);
+  processed.insert(function);
+
+  while (!pending.empty())
+  {
+    function = pending.front();
+    pending.pop_front();
+
+    unsigned blockIndex = 0;
+    for (auto B = function->begin(); B != function->end(); B++)
+    {
+      blockIndex++;
+      for (auto I = B->begin(); I != B->end(); I++)
+      {
+        bool barrier = false;
+        if (const llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(I))
+        {
+          const llvm::Function *callee = call->getCalledFunction();
+          if (callee && callee->isDeclaration())
+          {
+            barrier = callee->getName().find("barrier") != llvm::StringRef::npos;
+          }
+          else if (callee && !processed.count(callee))
+          {
+            processed.insert(callee);
+            pending.push_back(callee);
+          }
+        }
+
+        if (!m_cache->hasValue(&*I))
+          continue;
+
+        unsigned id = m_cache->getValueID(&*I);
+        m_instructions[id] = &*I;
+        m_blockIndices[id] = blockIndex;
+        m_barriers[id] = barrier;
+      }
+    }
+  }
+}
+
+Plugin::CallbackMask Profiler::getCallbacks() const
+{
+  return (1 << INSTRUCTION_EXECUTED) |
+         (1 << KERNEL_BEGIN) |
+         (1 << KERNEL_END) |
+         (1 << MEMORY_ATOMIC_LOAD) |
+         (1 << MEMORY_LOAD) |
+         (1 << MEMORY_STORE);
+}
+
+Profiler::Arena* Profiler::getArena()
+{
+  // Each worker thread keeps its arena across kernels, and only looks it up
+  // again when a new kernel starts
+  if (m_state.kernelID != m_kernelID)
+  {
+    lock_guard<mutex> lock(m_arenaMutex);
+
+    Arena*& arena = m_arenas[this_thread::get_id()];
+    if (!arena)
+      arena = new Arena;
+    arena->costs.resize(m_instructions.size());
+
+    m_state.kernelID = m_kernelID;
+    m_state.arena = arena;
+  }
+  return m_state.arena;
+}
+
+Profiler::Cost* Profiler::getCost(const WorkItem *workItem)
+{
+  unsigned id = workItem->getCurrentInstructionID();
+  if (id >= m_instructions.size() || !m_instructions[id])
+    return NULL;
+  return &getArena()->costs[id];
+}
+
+Profiler::Location Profiler::getLocation(unsigned id) const
+{
+  const llvm::Instruction *instruction = m_instructions[id];
+  const llvm::BasicBlock *block = instruction->getParent();
+
+  Location location;
+  location.file = "???";
+  location.function = block->getParent()->getName().str();
+  location.blockIndex = m_blockIndices[id];
+  location.line = 0;
+
+  if (block->hasName())
+    location.block = block->getName().str();
+  else
+    location.block = "bb" + to_string(location.blockIndex);
+
+  if (const llvm::DILocation *loc = instruction->getDebugLoc().get())
+  {
+    location.file = loc->getFilename().str();
+    location.line = loc->getLine();
+  }
+
+  return location;
+}
+
+void Profiler::instructionExecuted(const WorkItem *workItem,
+                                   const llvm::Instruction *instruction,
+                                   const TypedValue& result)
+{
+  // Calls and returns have already moved to another instruction by the time
+  // they are reported, so only they need to be looked up
+  unsigned id = workItem->getCurrentInstructionID();
+  if (workItem->getCurrentInstruction() != instruction)
+    id = m_cache->getValueID(instruction);
+  if (id >= m_instructions.size() || !m_instructions[id])
+    return;
+
+  Cost& cost = getArena()->costs[id];
+  cost.instructions++;
+  if (m_barriers[id])
+    cost.barriers++;
+}
+
+void Profiler::kernelBegin(const KernelInvocation *kernelInvocation)
+{
+  const Kernel *kernel = kernelInvocation->getKernel();
+  m_cache = kernel->getProgram()->getInterpreterCache(kernel->getFunction());
+
+  unsigned numValues = m_cache->getNumValues();
+  m_instructions.assign(numValues, NULL);
+  m_blockIndices.assign(numValues, 0);
+  m_barriers.assign(numValues, false);
+  addFunction(kernel->getFunction());
+
+  m_kernelID = m_nextKernelID++;
+}
+
+void Profiler::kernelEnd(const KernelInvocation *kernelInvocation)
+{
+  // Merge the per-worker counters, resetting them for the next kernel
+  vector<Cost> costs(m_instructions.size());
+  for (auto arena : m_arenas)
+  {
+    vector<Cost>& arenaCosts = arena.second->costs;
+    for (size_t i = 0; i < arenaCosts.size() && i < costs.size(); i++)
+      costs[i] += arenaCosts[i];
+    arenaCosts.assign(arenaCosts.size(), Cost());
+  }
+
+  // Attribute costs to source locations, which outlive the kernel's IR
+  for (unsigned i = 0; i < costs.size(); i++)
+  {
+    if (m_instructions[i] && !costs[i].isZero())
+      m_profile[getLocation(i)] += costs[i];
+  }
+
+  m_kernelID = 0;
+  m_cache = NULL;
+
+  // The profile is normally written when the context is destroyed, but can
+  // be rewritten after every kernel for applications that never release it
+  if (m_flush)
+  {
+    writeCallgrind();
+    writeJSON();
+  }
+}
+
+void Profiler::memoryAtomicLoad(const Memory *memory,
+                                const WorkItem *workItem,
+                                AtomicOp op, size_t address, size_t size)
+{
+  // Every atomic operation performs exactly one atomic load
+  Cost *cost = getCost(workItem);
+  if (cost)
+    cost->atomics++;
+}
+
+void Profiler::memoryLoad(const Memory *memory, const WorkItem *workItem,
+                          size_t address, size_t size)
+{
+  unsigned addrSpace = memory->getAddressSpace();
+  Cost *cost = getCost(workItem);
+  if (cost && addrSpace < NUM_ADDRESS_SPACES)
+    cost->loadBytes[addrSpace] += size;
+}
+
+void Profiler::memoryStore(const Memory *memory, const WorkItem *workItem,
+                           size_t address, size_t size,
+                           const uint8_t *storeData)
+{
+  unsigned addrSpace = memory->getAddressSpace();
+  Cost *cost = getCost(workItem);
+  if (cost && addrSpace < NUM_ADDRESS_SPACES)
+    cost->storeBytes[addrSpace] += size;
+}
+
+void Profiler::writeCallgrind() const
+{
+  ofstream output(m_outputFile);
+  if (!output.good())
+  {
+    cerr << "Oclgrind: Unable to open profile output file '"
+         << m_outputFile << "'" << endl;
+    return;
+  }
+
+  // Basic blocks are reported as instruction positions, so that tools
+  // such as kcachegrind can break down each function by block
+  Cost total = Cost();
+  for (auto entry : m_profile)
+    total += entry.second;
+
+  output << "# callgrind format" << endl
+         << "version: 1" << endl
+         << "creator: Oclgrind" << endl
+         << "positions: instr line" << endl
+         << "events:";
+  for (const char *name : EVENT_NAMES)
+    output << " " << name;
+  output << endl;
+
+  auto writeCost = [&output](const Cost& cost)
+  {
+    output << cost.instructions;
+    for (unsigned i = 0; i < NUM_ADDRESS_SPACES; i++)
+      output << " " << cost.loadBytes[i];
+    for (unsigned i = 0; i < NUM_ADDRESS_SPACES; i++)
+      output << " " << cost.storeBytes[i];
+    output << " " << cost.atomics << " " << cost.barriers << endl;
+  };
+
+  output << "summary: ";
+  writeCost(total);
+
+  string file, function;
+  for (auto entry : m_profile)
+  {
+    const Location& location = entry.first;
+    if (location.file != file || function.empty())
+    {
+      file = location.file;
+      output << endl << "fl=" << file << endl;
+      function.clear();
+    }
+    if (location.function != function)
+    {
+      function = location.function;
+      output << "fn=" << function << endl;
+    }
+
+    output << location.blockIndex << " " << location.line << " ";
+    writeCost(entry.second);
+  }
+}
+
+void Profiler::writeJSON() const
+{
+  string filename = m_outputFile + ".json";
+  ofstream output(filename);
+  if (!output.good())
+  {
+    cerr << "Oclgrind: Unable to open profile output file '"
+         << filename << "'" << endl;
+    return;
+  }
+
+  const char *addrSpaces[] = {"private", "global", "constant", "local"};
+  auto writeBytes = [&](const size_t *bytes)
+  {
+    output << "{";
+    for (unsigned i = 0; i < NUM_ADDRESS_SPACES; i++)
+    {
+      output << (i ? ", " : "") << "\"" << addrSpaces[i] << "\": "
+             << bytes[i];
+    }
+    output << "}";
+  };
+
+  output << "{" << endl << "  \"locations\": [";
+  bool first = true;
+  for (auto entry : m_profile)
+  {
+    const Location& location = entry.first;
+    const Cost& cost = entry.second;
+
+    output << (first ? "" : ",") << endl
+           << "    {\"file\": \"" << escapeJSON(location.file) << "\""
+           << ", \"function\": \"" << escapeJSON(location.function) << "\""
+           << ", \"block\": \"" << escapeJSON(location.block) << "\""
+           << ", \"line\": " << location.line
+           << ", \"instructions\": " << cost.instructions
+           << ", \"loadBytes\": ";
+    writeBytes(cost.loadBytes);
+    output << ", \"storeBytes\": ";
+    writeBytes(cost.storeBytes);
+    output << ", \"atomics\": " << cost.atomics
+           << ", \"barriers\": " << cost.barriers << "}";
+    first = false;
+  }
+  output << endl << "  ]" << endl << "}" << endl;
+}
+
+bool Profiler::Cost::isZero() const
+{
+  if (instructions || atomics || barriers)
+    return false;
+  for (unsigned i = 0; i < NUM_ADDRESS_SPACES; i++)
+  {
+    if (loadBytes[i] || storeBytes[i])
+      return false;
+  }
+  return true;
+}
+
+Profiler::Cost& Profiler::Cost::operator+=(const Cost& other)
+{
+  instructions += other.instructions;
+  for (unsigned i = 0; i < NUM_ADDRESS_SPACES; i++)
+  {
+    loadBytes[i] += other.loadBytes[i];
+    storeBytes[i] += other.storeBytes[i];
+  }
+  atomics += other.atomics;
+  barriers += other.barriers;
+  return *this;
+}
+
+bool Profiler::Location::operator<(const Location& other) const
+{
+  if (file != other.file)
+    return file < other.file;
+  if (function != other.function)
+    return function < other.function;
+  if (blockIndex != other.blockIndex)
+    return blockIndex < other.blockIndex;
+  return line < other.line;
+}
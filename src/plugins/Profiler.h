@@ -0,0 +1,113 @@
+// Profiler.h (Oclgrind)
+// Copyright (c) 2013-2019, James Price and Simon McIntosh-Smith,
+// University of Bristol. All rights reserved.
+//
+// This program is provided under a three-clause BSD license. For full
+// license terms please see the LICENSE file distributed with this
+// source code.
+
+#include "core/Plugin.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+namespace llvm
+{
+  class Function;
+}
+
+namespace oclgrind
+{
+  class InterpreterCache;
+
+  // Attributes the cost of kernel execution to source lines and basic
+  // blocks, and writes it out in callgrind and JSON formats
+  class Profiler : public Plugin
+  {
+  public:
+    Profiler(const Context *context);
+    virtual ~Profiler();
+
+    virtual CallbackMask getCallbacks() const override;
+    virtual void instructionExecuted(const WorkItem *workItem,
+                                     const llvm::Instruction *instruction,
+                                     const TypedValue& result) override;
+    virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
+    virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
+    virtual void memoryAtomicLoad(const Memory *memory,
+                                  const WorkItem *workItem,
+                                  AtomicOp op,
+                                  size_t address, size_t size) override;
+    virtual void memoryLoad(const Memory *memory, const WorkItem *workItem,
+                            size_t address, size_t size) override;
+    virtual void memoryStore(const Memory *memory, const WorkItem *workItem,
+                             size_t address, size_t size,
+                             const uint8_t *storeData) override;
+
+  private:
+    static const unsigned NUM_ADDRESS_SPACES = 4;
+
+    struct Cost
+    {
+      size_t instructions;
+      size_t loadBytes[NUM_ADDRESS_SPACES];
+      size_t storeBytes[NUM_ADDRESS_SPACES];
+      size_t atomics;
+      size_t barriers;
+
+      bool isZero() const;
+      Cost& operator+=(const Cost& other);
+    };
+
+    // Counters for one worker thread, indexed by instruction value ID
+    struct Arena
+    {
+      std::vector<Cost> costs;
+    };
+
+    struct WorkerState
+    {
+      size_t kernelID;
+      Arena *arena;
+    };
+    static THREAD_LOCAL WorkerState m_state;
+    static std::atomic<size_t> m_nextKernelID;
+
+    // Source position that costs are attributed to
+    struct Location
+    {
+      std::string file;
+      std::string function;
+      unsigned blockIndex;
+      std::string block;
+      unsigned line;
+
+      bool operator<(const Location& other) const;
+    };
+
+    std::string m_outputFile;
+    bool m_flush;
+
+    // Instructions of the running kernel and the functions it calls,
+    // indexed by their value IDs in the kernel's interpreter cache
+    size_t m_kernelID;
+    const InterpreterCache *m_cache;
+    std::vector<const llvm::Instruction*> m_instructions;
+    std::vector<unsigned> m_blockIndices;
+    std::vector<bool> m_barriers;
+
+    std::mutex m_arenaMutex;
+    std::map<std::thread::id, Arena*> m_arenas;
+
+    // Costs accumulated across all kernels
+    std::map<Location, Cost> m_profile;
+
+    void addFunction(const llvm::Function *function);
+    Cost* getCost(const WorkItem *workItem);
+    Arena* getArena();
+    Location getLocation(unsigned id) const;
+    void writeCallgrind() const;
+    void writeJSON() const;
+  };
+}
@@ -8,6 +8,15 @@
 
 #include "core/common.h"
 
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <windows.h>
+#undef ERROR
+#else
+#include <sys/mman.h>
+#endif
+
 #include "core/Context.h"
 #include "core/KernelInvocation.h"
 #include "core/Memory.h"
@@ -24,9 +33,59 @@ THREAD_LOCAL RaceDetector::WorkerState RaceDetector::m_state = {NULL};
 #define STATE(workgroup) (m_state.groups->at(workgroup))
 
 // Use a bank of mutexes to reduce unnecessary synchronisation
+// Each mutex covers a region of a buffer, so that sorted accesses can be
+// merged into the shadow memory while taking each lock once per region
 #define NUM_GLOBAL_MUTEXES 4096 // Must be power of two
-#define GLOBAL_MUTEX(buffer,offset) \
-  m_globalMutexes[buffer][offset & (NUM_GLOBAL_MUTEXES-1)]
+#define GLOBAL_MUTEX_SHIFT 12
+#define GLOBAL_MUTEX_INDEX(offset) \
+  ((offset>>GLOBAL_MUTEX_SHIFT) & (NUM_GLOBAL_MUTEXES-1))
+
+// Compact access logs when they would otherwise grow beyond this size
+#define MIN_COMPACT_SIZE 4096
+
+namespace
+{
+  // Allocate zero-initialised shadow memory, which the OS only backs with
+  // physical pages once they are first written
+  // On Windows the whole region is committed up front, so it counts
+  // towards the commit limit even though untouched pages use no memory
+  void* allocateShadow(size_t size)
+  {
+#if defined(_WIN32)
+    void *ptr = VirtualAlloc(NULL, size, MEM_RESERVE|MEM_COMMIT,
+                             PAGE_READWRITE);
+    if (!ptr)
+      throw std::bad_alloc();
+#else
+    void *ptr = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (ptr == MAP_FAILED)
+      throw std::bad_alloc();
+#endif
+    return ptr;
+  }
+
+  void releaseShadow(void *ptr, size_t size)
+  {
+#if defined(_WIN32)
+    VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    munmap(ptr, size);
+#endif
+  }
+
+  // Return the pages of a shadow region to the OS, zeroing its contents
+  // On Windows the pages are committed again so that they remain writable
+  void resetShadow(void *ptr, size_t size)
+  {
+#if defined(_WIN32)
+    VirtualFree(ptr, size, MEM_DECOMMIT);
+    VirtualAlloc(ptr, size, MEM_COMMIT, PAGE_READWRITE);
+#else
+    madvise(ptr, size, MADV_DONTNEED);
+#endif
+  }
+}
 
 RaceDetector::RaceDetector(const Context *context)
  : Plugin(context)
@@ -36,6 +95,21 @@ RaceDetector::RaceDetector(const Context *context)
   m_allowUniformWrites = !checkEnv("OCLGRIND_UNIFORM_WRITES");
 }
 
+Plugin::CallbackMask RaceDetector::getCallbacks() const
+{
+  return (1 << KERNEL_BEGIN) |
+         (1 << KERNEL_END) |
+         (1 << MEMORY_ALLOCATED) |
+         (1 << MEMORY_ATOMIC_LOAD) |
+         (1 << MEMORY_ATOMIC_STORE) |
+         (1 << MEMORY_DEALLOCATED) |
+         (1 << MEMORY_LOAD) |
+         (1 << MEMORY_STORE) |
+         (1 << WORK_GROUP_BARRIER) |
+         (1 << WORK_GROUP_BEGIN) |
+         (1 << WORK_GROUP_COMPLETE);
+}
+
 void RaceDetector::kernelBegin(const KernelInvocation *kernelInvocation)
 {
   m_kernelInvocation = kernelInvocation;
@@ -51,9 +125,9 @@ void RaceDetector::kernelEnd(const KernelInvocation *kernelInvocation)
   // Clear all global memory accesses
   for (auto &buffer : m_globalAccesses)
   {
-    size_t sz = buffer.second.size();
-    buffer.second.clear();
-    buffer.second.resize(sz);
+    ShadowBuffer& shadow = buffer.second;
+    resetShadow(shadow.words, shadow.numWords*sizeof(ShadowWord));
+    resetShadow(shadow.bytes, shadow.numWords*4*sizeof(ShadowByte));
   }
 
   m_kernelInvocation = NULL;
@@ -66,7 +140,15 @@ void RaceDetector::memoryAllocated(const Memory *memory, size_t address,
   size_t buffer = memory->extractBuffer(address);
   if (memory->getAddressSpace() == AddrSpaceGlobal)
   {
-    m_globalAccesses[buffer].resize(size);
+    ShadowBuffer& shadow = m_globalAccesses[buffer];
+    shadow.numWords = (size + 3) / 4;
+    if (!shadow.numWords)
+      shadow.numWords = 1;
+    shadow.words = (ShadowWord*)allocateShadow(
+      shadow.numWords*sizeof(ShadowWord));
+    shadow.bytes = (ShadowByte*)allocateShadow(
+      shadow.numWords*4*sizeof(ShadowByte));
+
     m_globalMutexes[buffer] = new mutex[NUM_GLOBAL_MUTEXES];
   }
 }
@@ -93,6 +175,9 @@ void RaceDetector::memoryDeallocated(const Memory *memory, size_t address)
   size_t buffer = memory->extractBuffer(address);
   if (memory->getAddressSpace() == AddrSpaceGlobal)
   {
+    ShadowBuffer& shadow = m_globalAccesses.at(buffer);
+    releaseShadow(shadow.words, shadow.numWords*sizeof(ShadowWord));
+    releaseShadow(shadow.bytes, shadow.numWords*4*sizeof(ShadowByte));
     m_globalAccesses.erase(buffer);
 
     delete[] m_globalMutexes.at(buffer);
@@ -156,11 +241,8 @@ void RaceDetector::workGroupBegin(const WorkGroup *workGroup)
   Size3 wgsize = workGroup->getGroupSize();
   state.numWorkItems = wgsize.x*wgsize.y*wgsize.z;
 
-  // Re-use pool allocator for all access maps
-  AccessMap tmp(0, AccessMap::hasher(), AccessMap::key_equal(),
-                state.wgGlobal.get_allocator());
-  state.wiGlobal.resize(state.numWorkItems+1, tmp);
-  state.wiLocal.resize(state.numWorkItems+1, tmp);
+  state.wiGlobal.resize(state.numWorkItems+1);
+  state.wiLocal.resize(state.numWorkItems+1);
 }
 
 void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
@@ -171,17 +253,30 @@ void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
   syncWorkItems(m_context->getGlobalMemory(), state, state.wiGlobal);
 
   // Merge global accesses across kernel invocation
+  // The log is sorted by address, so each region lock is only taken once
+  // for each run of accesses that falls inside it
+  compact(state.wgGlobal);
   size_t group = workGroup->getGroupIndex();
-  for (auto &record : state.wgGlobal)
+  mutex *locked = NULL;
+  for (auto &entry : state.wgGlobal)
   {
-    size_t address = record.first;
+    size_t address = entry.address;
     size_t buffer = m_context->getGlobalMemory()->extractBuffer(address);
     size_t offset = m_context->getGlobalMemory()->extractOffset(address);
 
-    lock_guard<mutex> lock(GLOBAL_MUTEX(buffer, offset));
+    mutex *regionMutex =
+      &m_globalMutexes.at(buffer)[GLOBAL_MUTEX_INDEX(offset)];
+    if (regionMutex != locked)
+    {
+      if (locked)
+        locked->unlock();
+      regionMutex->lock();
+      locked = regionMutex;
+    }
 
-    AccessRecord& a = record.second;
-    AccessRecord& b = m_globalAccesses.at(buffer)[offset];
+    ShadowBuffer& shadow = m_globalAccesses.at(buffer);
+    AccessRecord& a = entry.record;
+    AccessRecord b = loadShadow(shadow, offset);
 
     // Check for races with previous accesses
     if (check(a.load,  b.store) && getAccessWorkGroup(b.store) != group)
@@ -196,7 +291,10 @@ void RaceDetector::workGroupComplete(const WorkGroup *workGroup)
       insert(b, a.load);
     if (a.store.isSet())
       insert(b, a.store);
+    storeShadow(shadow, offset, b);
   }
+  if (locked)
+    locked->unlock();
   state.wgGlobal.clear();
 
   // Clean-up work-group state
@@ -238,6 +336,34 @@ bool RaceDetector::check(const MemoryAccess& a,
   return false;
 }
 
+void RaceDetector::compact(AccessLog& log) const
+{
+  // Sort by address, keeping accesses to each address in program order
+  stable_sort(log.begin(), log.end(),
+              [](const AccessEntry& a, const AccessEntry& b)
+              {
+                return a.address < b.address;
+              });
+
+  // Combine the accesses to each address into a single record
+  size_t n = 0;
+  for (size_t i = 0; i < log.size(); i++)
+  {
+    if (n && log[n-1].address == log[i].address)
+    {
+      if (log[i].record.load.isSet())
+        insert(log[n-1].record, log[i].record.load);
+      if (log[i].record.store.isSet())
+        insert(log[n-1].record, log[i].record.store);
+    }
+    else
+    {
+      log[n++] = log[i];
+    }
+  }
+  log.resize(n);
+}
+
 size_t RaceDetector::getAccessWorkGroup(const MemoryAccess& access) const
 {
   if (access.isWorkItem())
@@ -294,6 +420,30 @@ void RaceDetector::insertRace(RaceList& races, const Race& race) const
   races.push_back(race);
 }
 
+RaceDetector::AccessRecord RaceDetector::loadShadow(
+  const ShadowBuffer& shadow, size_t offset) const
+{
+  const ShadowWord& word = shadow.words[offset/4];
+  uint8_t storeData = word.storeData[offset%4];
+  uint8_t bit = 1 << (offset%4);
+
+  AccessRecord record;
+  if (word.refined)
+  {
+    const ShadowByte& byte = shadow.bytes[offset];
+    record.load = MemoryAccess(byte.load, 0);
+    record.store = MemoryAccess(byte.store, storeData);
+  }
+  else
+  {
+    if (word.load.mask & bit)
+      record.load = MemoryAccess(word.load, 0);
+    if (word.store.mask & bit)
+      record.store = MemoryAccess(word.store, storeData);
+  }
+  return record;
+}
+
 void RaceDetector::logRace(const Race& race) const
 {
   const char *raceType;
@@ -375,63 +525,134 @@ void RaceDetector::registerAccess(const Memory *memory,
     index = STATE(workGroup).wiLocal.size() - 1;
   }
 
-  AccessMap& accesses = (addrSpace == AddrSpaceGlobal) ?
+  AccessLog& log = (addrSpace == AddrSpaceGlobal) ?
     STATE(workGroup).wiGlobal[index] :
     STATE(workGroup).wiLocal[index];
 
+  // Collapse repeated accesses rather than letting the log grow unbounded
+  if (log.size() + size > log.capacity() && log.size() >= MIN_COMPACT_SIZE)
+    compact(log);
+
+  AccessEntry entry;
   for (size_t i = 0; i < size; i++)
   {
     if (storeData)
       access.setStoreData(storeData[i]);
 
-    insert(accesses[address+i], access);
+    entry.address = address + i;
+    entry.record = AccessRecord();
+    insert(entry.record, access);
+    log.push_back(entry);
   }
 }
 
-void RaceDetector::syncWorkItems(const Memory *memory,
-                                 WorkGroupState& state,
-                                 vector<AccessMap>& accesses)
+void RaceDetector::storeShadow(ShadowBuffer& shadow, size_t offset,
+                               const AccessRecord& record) const
 {
-  AccessMap wgAccesses(0, AccessMap::hasher(), AccessMap::key_equal(),
-                       state.wgGlobal.get_allocator());
+  ShadowWord& word = shadow.words[offset/4];
+  uint8_t bit = 1 << (offset%4);
 
-  for (size_t i = 0; i < state.numWorkItems + 1; i++)
+  if (record.store.isSet())
+    word.storeData[offset%4] = record.store.getStoreData();
+
+  if (!word.refined)
   {
-    RaceList races;
-    for (auto &record : accesses[i])
+    // Try to share the existing word-level access with this byte
+    auto update = [bit](ShadowAccess& slot, const MemoryAccess& access)
     {
-      size_t address = record.first;
-
-      AccessRecord& a = record.second;
-      AccessRecord& b = wgAccesses[address];
-
-      if (check(a.load,  b.store))
-        insertRace(races, {memory->getAddressSpace(),address,a.load,b.store});
-      if (check(a.store, b.load))
-        insertRace(races, {memory->getAddressSpace(),address,a.store,b.load});
-      if (check(a.store, b.store))
-        insertRace(races, {memory->getAddressSpace(),address,a.store,b.store});
-
-      if (a.load.isSet())
+      if (!access.isSet())
+        return !(slot.mask & bit);
+      if (!slot.mask || slot.mask == bit)
       {
-        insert(b, a.load);
-        if (memory->getAddressSpace() == AddrSpaceGlobal)
-          insert(state.wgGlobal[address], a.load);
+        slot = access.pack(bit);
+        return true;
       }
-      if (a.store.isSet())
+      if (access.matches(slot))
       {
-        insert(b, a.store);
-        if (memory->getAddressSpace() == AddrSpaceGlobal)
-          insert(state.wgGlobal[address], a.store);
+        slot.mask |= bit;
+        return true;
       }
+      return false;
+    };
+    ShadowAccess load = word.load, store = word.store;
+    if (update(load, record.load) && update(store, record.store))
+    {
+      word.load = load;
+      word.store = store;
+      return;
+    }
+
+    // Bytes within this word now differ, so split it into byte records
+    ShadowByte *bytes = shadow.bytes + (offset & ~(size_t)3);
+    for (unsigned i = 0; i < 4; i++)
+    {
+      bytes[i].load = word.load;
+      bytes[i].store = word.store;
+      if (!(word.load.mask & (1<<i)))
+        bytes[i].load.info = 0;
+      if (!(word.store.mask & (1<<i)))
+        bytes[i].store.info = 0;
     }
+    word.refined = true;
+  }
+
+  shadow.bytes[offset].load = record.load.pack(bit);
+  shadow.bytes[offset].store = record.store.pack(bit);
+}
+
+void RaceDetector::syncWorkItems(const Memory *memory,
+                                 WorkGroupState& state,
+                                 vector<AccessLog>& logs)
+{
+  // Collapse each work-item's log and gather them in work-item order
+  AccessLog accesses;
+  for (size_t i = 0; i < state.numWorkItems + 1; i++)
+  {
+    compact(logs[i]);
+    accesses.insert(accesses.end(), logs[i].begin(), logs[i].end());
+    logs[i].clear();
+  }
 
-    accesses[i].clear();
+  // Sort by address, so that the work-items that accessed each address
+  // form a contiguous run that is still in work-item order
+  stable_sort(accesses.begin(), accesses.end(),
+              [](const AccessEntry& a, const AccessEntry& b)
+              {
+                return a.address < b.address;
+              });
+
+  RaceList races;
+  AccessRecord b;
+  for (size_t i = 0; i < accesses.size(); i++)
+  {
+    size_t address = accesses[i].address;
+    AccessRecord& a = accesses[i].record;
+
+    if (i == 0 || accesses[i-1].address != address)
+      b = AccessRecord();
+
+    if (check(a.load,  b.store))
+      insertRace(races, {memory->getAddressSpace(),address,a.load,b.store});
+    if (check(a.store, b.load))
+      insertRace(races, {memory->getAddressSpace(),address,a.store,b.load});
+    if (check(a.store, b.store))
+      insertRace(races, {memory->getAddressSpace(),address,a.store,b.store});
+
+    if (a.load.isSet())
+      insert(b, a.load);
+    if (a.store.isSet())
+      insert(b, a.store);
 
-    // Log races
-    for (auto race : races)
-      logRace(race);
+    if (memory->getAddressSpace() == AddrSpaceGlobal &&
+        (i+1 == accesses.size() || accesses[i+1].address != address))
+      state.wgGlobal.push_back({address, b});
   }
+  if (state.wgGlobal.size() >= MIN_COMPACT_SIZE)
+    compact(state.wgGlobal);
+
+  // Log races
+  for (auto race : races)
+    logRace(race);
 }
 
 RaceDetector::MemoryAccess::MemoryAccess()
@@ -463,12 +684,39 @@ RaceDetector::MemoryAccess::MemoryAccess(const WorkGroup *workGroup,
   }
 }
 
+RaceDetector::MemoryAccess::MemoryAccess(const ShadowAccess& shadow,
+                                         uint8_t storeData)
+{
+  this->entity = shadow.entity;
+  this->instruction = shadow.instruction;
+  this->info = shadow.info;
+  this->storeData = storeData;
+}
+
 void RaceDetector::MemoryAccess::clear()
 {
   this->info = 0;
   this->instruction = NULL;
 }
 
+bool RaceDetector::MemoryAccess::matches(const ShadowAccess& shadow) const
+{
+  return this->entity == shadow.entity &&
+         this->instruction == shadow.instruction &&
+         this->info == shadow.info;
+}
+
+RaceDetector::ShadowAccess RaceDetector::MemoryAccess::pack(
+  uint8_t mask) const
+{
+  ShadowAccess shadow;
+  shadow.instruction = this->instruction;
+  shadow.entity = this->entity;
+  shadow.info = this->info;
+  shadow.mask = isSet() ? mask : 0;
+  return shadow;
+}
+
 bool RaceDetector::MemoryAccess::isSet() const
 {
   return this->info & (1<<SET_BIT);
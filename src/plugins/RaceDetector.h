@@ -17,6 +17,7 @@ namespace oclgrind
   public:
     RaceDetector(const Context *context);
 
+    virtual CallbackMask getCallbacks() const override;
     virtual void kernelBegin(const KernelInvocation *kernelInvocation) override;
     virtual void kernelEnd(const KernelInvocation *kernelInvocation) override;
     virtual void memoryAllocated(const Memory *memory, size_t address,
@@ -48,6 +49,38 @@ namespace oclgrind
     virtual void workGroupComplete(const WorkGroup *workGroup) override;
 
   private:
+    // Compact form of a MemoryAccess, which applies to the bytes of a
+    // 32-bit word of global memory that are set in its mask
+    struct ShadowAccess
+    {
+      const llvm::Instruction *instruction;
+      uint64_t entity : 48;
+      uint64_t info   : 8;
+      uint64_t mask   : 8;
+    };
+    struct ShadowWord
+    {
+      ShadowAccess load;
+      ShadowAccess store;
+      uint8_t storeData[4];
+      bool refined;
+    };
+    struct ShadowByte
+    {
+      ShadowAccess load;
+      ShadowAccess store;
+    };
+
+    // Shadow memory for a global buffer, with one record per word and
+    // per-byte records only for words whose bytes have differing accesses
+    // Both regions are reserved up-front and committed lazily per page
+    struct ShadowBuffer
+    {
+      size_t numWords;
+      ShadowWord *words;
+      ShadowByte *bytes;
+    };
+
     struct MemoryAccess
     {
     private:
@@ -81,6 +114,10 @@ namespace oclgrind
       MemoryAccess();
       MemoryAccess(const WorkGroup *workGroup, const WorkItem *workItem,
                    bool store, bool atomic);
+      MemoryAccess(const ShadowAccess& shadow, uint8_t storeData);
+
+      ShadowAccess pack(uint8_t mask) const;
+      bool matches(const ShadowAccess& shadow) const;
 
       bool operator==(const MemoryAccess& other) const;
     };
@@ -89,23 +126,23 @@ namespace oclgrind
       MemoryAccess load;
       MemoryAccess store;
     };
-    typedef std::vector<MemoryAccess> AccessList;
-    typedef std::unordered_map<
-      size_t,AccessRecord,
-      std::hash<size_t>,
-      std::equal_to<size_t>,
-      PoolAllocator<std::pair<const size_t,AccessRecord>,8192>
-      > AccessMap;
-
-    std::unordered_map<size_t,std::vector<AccessRecord>> m_globalAccesses;
+    struct AccessEntry
+    {
+      size_t address;
+      AccessRecord record;
+    };
+    // Accesses appended in program order, sorted by address when merged
+    typedef std::vector<AccessEntry> AccessLog;
+
+    std::unordered_map<size_t,ShadowBuffer> m_globalAccesses;
     std::map< size_t,std::mutex* > m_globalMutexes;
 
     struct WorkGroupState
     {
       size_t numWorkItems;
-      std::vector<AccessMap> wiLocal;
-      std::vector<AccessMap> wiGlobal;
-      AccessMap wgGlobal;
+      std::vector<AccessLog> wiLocal;
+      std::vector<AccessLog> wiGlobal;
+      AccessLog wgGlobal;
     };
     struct WorkerState
     {
@@ -130,17 +167,21 @@ namespace oclgrind
     size_t getAccessWorkGroup(const MemoryAccess& access) const;
 
     bool check(const MemoryAccess& a, const MemoryAccess& b) const;
+    void compact(AccessLog& log) const;
     void insert(AccessRecord& record, const MemoryAccess& access) const;
     void insertKernelRace(const Race& race);
     void insertRace(RaceList& races, const Race& race) const;
+    AccessRecord loadShadow(const ShadowBuffer& shadow, size_t offset) const;
     void logRace(const Race& race) const;
     void registerAccess(const Memory *memory,
                         const WorkGroup *workGroup,
                         const WorkItem *workItem,
                         size_t address, size_t size, bool atomic,
                         const uint8_t *storeData = NULL);
+    void storeShadow(ShadowBuffer& shadow, size_t offset,
+                     const AccessRecord& record) const;
     void syncWorkItems(const Memory *memory,
                        WorkGroupState& state,
-                       std::vector<AccessMap>& accesses);
+                       std::vector<AccessLog>& logs);
   };
 }
@@ -15,6 +15,7 @@
 #include "core/WorkGroup.h"
 #include "core/Kernel.h"
 #include "core/KernelInvocation.h"
+#include "core/Program.h"
 
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Constants.h"
@@ -53,6 +54,19 @@ Uninitialized::~Uninitialized()
     shadowContext.destroyMemoryPool();
 }
 
+Plugin::CallbackMask Uninitialized::getCallbacks() const
+{
+    return (1 << HOST_MEMORY_STORE) |
+           (1 << INSTRUCTION_EXECUTED) |
+           (1 << KERNEL_BEGIN) |
+           (1 << KERNEL_END) |
+           (1 << MEMORY_MAP) |
+           (1 << WORK_GROUP_BEGIN) |
+           (1 << WORK_GROUP_COMPLETE) |
+           (1 << WORK_ITEM_BEGIN) |
+           (1 << WORK_ITEM_COMPLETE);
+}
+
 void Uninitialized::allocAndStoreShadowMemory(unsigned addrSpace, size_t address, TypedValue SM,
         const WorkItem *workItem, const WorkGroup *workGroup, bool unchecked)
 {
@@ -1176,12 +1190,11 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
                     size_t origShadowAddress = workItem->getOperand(Val).getPointer();
                     size_t newShadowAddress = workItem->getOperand(&*argItr).getPointer();
                     ShadowMemory *mem = shadowWorkItem->getPrivateMemory();
-                    unsigned char *origShadowData = (unsigned char*)mem->getPointer(origShadowAddress);
                     size_t size = getTypeSize(argItr->getType()->getPointerElementType());
 
                     // Set new shadow memory
                     TypedValue v = ShadowContext::getCleanValue(size);
-                    memcpy(v.data, origShadowData, size);
+                    mem->load(v.data, origShadowAddress, size);
                     allocAndStoreShadowMemory(AddrSpacePrivate, newShadowAddress, v, workItem);
                     values->setValue(&*argItr, ShadowContext::getCleanValue(&*argItr));
                 }
@@ -1736,6 +1749,8 @@ void Uninitialized::instructionExecuted(const WorkItem *workItem,
 void Uninitialized::kernelBegin(const KernelInvocation *kernelInvocation)
 {
     const Kernel *kernel = kernelInvocation->getKernel();
+    shadowContext.setInterpreterCache(
+        kernel->getProgram()->getInterpreterCache(kernel->getFunction()));
 
     // Initialise kernel arguments and global variables
     for (auto value = kernel->values_begin(); value != kernel->values_end(); value++)
@@ -2142,8 +2157,8 @@ void Uninitialized::workGroupComplete(const WorkGroup *workGroup)
     shadowContext.destroyMemoryPool();
 }
 
-ShadowFrame::ShadowFrame() :
-    m_values(new UnorderedTypedValueMap())
+ShadowFrame::ShadowFrame(const InterpreterCache *cache) :
+    m_cache(cache), m_call(NULL), m_values(cache->getNumValues())
 {
 #ifdef DUMP_SHADOW
     m_valuesList = new ValuesList();
@@ -2152,12 +2167,25 @@ ShadowFrame::ShadowFrame() :
 
 ShadowFrame::~ShadowFrame()
 {
-    delete m_values;
 #ifdef DUMP_SHADOW
     delete m_valuesList;
 #endif
 }
 
+void ShadowFrame::clear()
+{
+    // Only reset the registers that were written, so frames are cheap to reuse
+    for(unsigned id : m_setValues)
+    {
+        m_values[id].num = 0;
+    }
+    m_setValues.clear();
+    m_call = NULL;
+#ifdef DUMP_SHADOW
+    m_valuesList->clear();
+#endif
+}
+
 void ShadowFrame::dump() const
 {
     cout << "==== ShadowMap (private) =======" << endl;
@@ -2170,11 +2198,11 @@ void ShadowFrame::dump() const
     {
         if((*itr)->hasName())
         {
-            cout << "%" << (*itr)->getName().str() << ": " << m_values->at(*itr) << endl;
+            cout << "%" << (*itr)->getName().str() << ": " << getValue(*itr) << endl;
         }
         else
         {
-            cout << "%" << dec << num++ << ": " << m_values->at(*itr) << endl;
+            cout << "%" << dec << num++ << ": " << getValue(*itr) << endl;
         }
     }
 #else
@@ -2186,19 +2214,15 @@ void ShadowFrame::dump() const
 
 TypedValue ShadowFrame::getValue(const llvm::Value *V) const
 {
-    if (llvm::isa<llvm::Instruction>(V)) {
-        // For instructions the shadow is already stored in the map.
-        assert(m_values->count(V) && "No shadow for instruction value");
-        return m_values->at(V);
+    if (llvm::isa<llvm::Instruction>(V) || llvm::isa<llvm::Argument>(V)) {
+        // For instructions and arguments the shadow is already stored in the frame.
+        const TypedValue& shadow = m_values[m_cache->getValueID(V)];
+        assert(shadow.num && "No shadow for instruction or argument value");
+        return shadow;
     }
     else if (llvm::isa<llvm::UndefValue>(V)) {
         return ShadowContext::getPoisonedValue(V);
     }
-    else if (llvm::isa<llvm::Argument>(V)) {
-        // For arguments the shadow is already stored in the map.
-        assert(m_values->count(V) && "No shadow for argument value");
-        return m_values->at(V);
-    }
     else if(const llvm::ConstantVector *VC = llvm::dyn_cast<llvm::ConstantVector>(V))
     {
         TypedValue vecShadow = ShadowContext::getCleanValue(V);
@@ -2220,23 +2244,40 @@ TypedValue ShadowFrame::getValue(const llvm::Value *V) const
     }
 }
 
+bool ShadowFrame::hasValue(const llvm::Value* V) const
+{
+    if (llvm::isa<llvm::Constant>(V))
+    {
+        return true;
+    }
+    if (!llvm::isa<llvm::Instruction>(V) && !llvm::isa<llvm::Argument>(V))
+    {
+        return false;
+    }
+    return m_values[m_cache->getValueID(V)].num;
+}
+
 void ShadowFrame::setValue(const llvm::Value *V, TypedValue SV)
 {
-#ifdef DUMP_SHADOW
-    if(!m_values->count(V))
+    unsigned id = m_cache->getValueID(V);
+    if(!m_values[id].num)
     {
+        m_setValues.push_back(id);
+#ifdef DUMP_SHADOW
         m_valuesList->push_back(V);
+#endif
     }
+#ifdef DUMP_SHADOW
     else
     {
         cout << "Shadow for value " << V->getName().str() << " reset!" << endl;
     }
 #endif
-    (*m_values)[V] = SV;
+    m_values[id] = SV;
 }
 
-ShadowValues::ShadowValues() :
-    m_stack(new ShadowValuesStack())
+ShadowValues::ShadowValues(const InterpreterCache *cache) :
+    m_cache(cache), m_stack(new ShadowValuesStack())
 {
     pushFrame(createCleanShadowFrame());
 }
@@ -2248,16 +2289,28 @@ ShadowValues::~ShadowValues()
         popFrame();
     }
 
+    for(ShadowFrame *frame : m_freeFrames)
+    {
+        delete frame;
+    }
+
     delete m_stack;
 }
 
 ShadowFrame* ShadowValues::createCleanShadowFrame()
 {
-    return new ShadowFrame();
+    if(!m_freeFrames.empty())
+    {
+        ShadowFrame *frame = m_freeFrames.back();
+        m_freeFrames.pop_back();
+        return frame;
+    }
+
+    return new ShadowFrame(m_cache);
 }
 
-ShadowWorkItem::ShadowWorkItem(unsigned bufferBits) :
-    m_memory(new ShadowMemory(AddrSpacePrivate, bufferBits)), m_values(new ShadowValues())
+ShadowWorkItem::ShadowWorkItem(unsigned bufferBits, const InterpreterCache *cache) :
+    m_memory(new ShadowMemory(AddrSpacePrivate, bufferBits)), m_values(new ShadowValues(cache))
 {
 }
 
@@ -2279,7 +2332,7 @@ ShadowWorkGroup::~ShadowWorkGroup()
 }
 
 ShadowMemory::ShadowMemory(AddressSpace addrSpace, unsigned bufferBits) :
-    m_addrSpace(addrSpace), m_map(), m_numBitsAddress((sizeof(size_t)<<3) - bufferBits), m_numBitsBuffer(bufferBits)
+    m_addrSpace(addrSpace), m_buffers(), m_numBitsAddress((sizeof(size_t)<<3) - bufferBits), m_numBitsBuffer(bufferBits)
 {
 }
 
@@ -2292,7 +2345,11 @@ void ShadowMemory::allocate(size_t address, size_t size)
 {
     size_t index = extractBuffer(address);
 
-    if(m_map.count(index))
+    if(index >= m_buffers.size())
+    {
+        m_buffers.resize(index+1, NULL);
+    }
+    else if(m_buffers[index])
     {
         deallocate(address);
     }
@@ -2300,57 +2357,60 @@ void ShadowMemory::allocate(size_t address, size_t size)
     Buffer *buffer = new Buffer();
     buffer->size   = size;
     buffer->flags  = 0;
-    buffer->data   = new unsigned char[size];
+    buffer->state  = new atomic<uint64_t>[(size + BYTES_PER_WORD - 1) / BYTES_PER_WORD]();
 
-    m_map[index] = buffer;
+    m_buffers[index] = buffer;
 }
 
 void ShadowMemory::clear()
 {
-    MemoryMap::iterator mItr;
-    for(mItr = m_map.begin(); mItr != m_map.end(); ++mItr)
+    for(Buffer *buffer : m_buffers)
     {
-        delete[] mItr->second->data;
-        delete mItr->second;
+        if(buffer)
+        {
+            delete[] buffer->state;
+            delete buffer;
+        }
     }
+    m_buffers.clear();
 }
 
 void ShadowMemory::deallocate(size_t address)
 {
     size_t index = extractBuffer(address);
 
-    assert(m_map.count(index) && "Cannot deallocate non existing memory!");
+    assert(index < m_buffers.size() && m_buffers[index] && "Cannot deallocate non existing memory!");
 
-    delete[] m_map.at(index)->data;
-    delete m_map.at(index);
-    m_map.at(index) = NULL;
+    delete[] m_buffers[index]->state;
+    delete m_buffers[index];
+    m_buffers[index] = NULL;
 }
 
 void ShadowMemory::dump() const
 {
     cout << "====== ShadowMem (" << getAddressSpaceName(m_addrSpace) << ") ======";
 
-    for(unsigned b = 0, o = 1; b < m_map.size(); o++)
+    for(size_t b = 0; b < m_buffers.size(); b++)
     {
-        if(!m_map.count(b+o))
+        if(!m_buffers[b])
         {
             continue;
         }
 
-        for(unsigned i = 0; i < m_map.at(b+o)->size; i++)
+        size_t base = b << m_numBitsAddress;
+        for(size_t i = 0; i < m_buffers[b]->size; i++)
         {
             if (i%4 == 0)
             {
                 cout << endl << hex << uppercase
                     << setw(16) << setfill(' ') << right
-                    << ((((size_t)b+o)<<m_numBitsAddress) | i) << ":";
+                    << (base | i) << ":";
             }
+            unsigned char shadow;
+            load(&shadow, base | i);
             cout << " " << hex << uppercase << setw(2) << setfill('0')
-                << (int)m_map.at(b+o)->data[i];
+                << (int)shadow;
         }
-
-        ++b;
-        o = 0;
     }
     cout << endl;
 
@@ -2367,37 +2427,43 @@ size_t ShadowMemory::extractOffset(size_t address) const
     return (address & (((size_t)-1) >> m_numBitsBuffer));
 }
 
-void* ShadowMemory::getPointer(size_t address) const
-{
-    size_t index = extractBuffer(address);
-    size_t offset= extractOffset(address);
-
-    assert(m_map.count(index) && "No shadow memory found!");
-
-    return m_map.at(index)->data + offset;
-}
-
 bool ShadowMemory::isAddressValid(size_t address, size_t size) const
 {
     size_t index = extractBuffer(address);
     size_t offset = extractOffset(address);
-    return m_map.count(index) && (offset + size <= m_map.at(index)->size);
+    return index < m_buffers.size() && m_buffers[index] &&
+           (offset + size <= m_buffers[index]->size);
 }
 
 void ShadowMemory::load(unsigned char *dst, size_t address, size_t size) const
 {
-    size_t index = extractBuffer(address);
-    size_t offset = extractOffset(address);
-
-    if(isAddressValid(address, size))
+    if(!isAddressValid(address, size))
     {
-        assert(m_map.count(index) && "No shadow memory found!");
-        memcpy(dst, m_map.at(index)->data + offset, size);
+        memset(dst, 0xff, size);
+        return;
     }
-    else
+
+    Buffer *buffer = m_buffers[extractBuffer(address)];
+    size_t offset = extractOffset(address);
+
+    uint64_t word = 0;
+    for(size_t i = 0; i < size; i++, offset++)
     {
-        TypedValue v = ShadowContext::getPoisonedValue(size);
-        memcpy(dst, v.data, size);
+        if(i == 0 || offset % BYTES_PER_WORD == 0)
+        {
+            word = buffer->state[offset / BYTES_PER_WORD].load(memory_order_acquire);
+        }
+
+        unsigned state = (word >> ((offset % BYTES_PER_WORD) * BITS_PER_BYTE)) & 0x3;
+        if(state == PARTIAL)
+        {
+            lock_guard<mutex> lock(buffer->partialMutex);
+            dst[i] = buffer->partial.at(offset);
+        }
+        else
+        {
+            dst[i] = (state == POISONED) ? 0xff : 0x00;
+        }
     }
 }
 
@@ -2409,13 +2475,53 @@ void ShadowMemory::lock(size_t address) const
 
 void ShadowMemory::store(const unsigned char *src, size_t address, size_t size)
 {
-    size_t index = extractBuffer(address);
+    if(!isAddressValid(address, size))
+    {
+        return;
+    }
+
+    Buffer *buffer = m_buffers[extractBuffer(address)];
     size_t offset = extractOffset(address);
 
-    if(isAddressValid(address, size))
+    // Update the state of each word in a single atomic operation, since other
+    // work-items may be storing to neighbouring bytes concurrently
+    size_t i = 0;
+    while(i < size)
     {
-        assert(m_map.count(index) && "Cannot store to unallocated memory!");
-        memcpy(m_map.at(index)->data + offset, src, size);
+        size_t index = offset / BYTES_PER_WORD;
+        uint64_t mask = 0, value = 0;
+        do
+        {
+            unsigned shift = (offset % BYTES_PER_WORD) * BITS_PER_BYTE;
+            uint64_t state;
+            if(src[i] == 0x00)
+            {
+                state = CLEAN;
+            }
+            else if(src[i] == 0xff)
+            {
+                state = POISONED;
+            }
+            else
+            {
+                state = PARTIAL;
+                lock_guard<mutex> lock(buffer->partialMutex);
+                buffer->partial[offset] = src[i];
+            }
+            mask  |= (uint64_t)0x3 << shift;
+            value |= state << shift;
+            i++;
+            offset++;
+        } while(i < size && offset % BYTES_PER_WORD);
+
+        atomic<uint64_t>& word = buffer->state[index];
+        uint64_t old = word.load(memory_order_relaxed);
+        while((old & mask) != value &&
+              !word.compare_exchange_weak(old, (old & ~mask) | value,
+                                          memory_order_release,
+                                          memory_order_relaxed))
+        {
+        }
     }
 }
 
@@ -2426,7 +2532,7 @@ void ShadowMemory::unlock(size_t address) const
 }
 
 ShadowContext::ShadowContext(unsigned bufferBits) :
-    m_globalMemory(new ShadowMemory(AddrSpaceGlobal, bufferBits)), m_globalValues(), m_numBitsBuffer(bufferBits)
+    m_cache(NULL), m_globalMemory(new ShadowMemory(AddrSpaceGlobal, bufferBits)), m_globalValues(), m_numBitsBuffer(bufferBits)
 {
 }
 
@@ -2454,6 +2560,7 @@ void ShadowContext::allocateWorkGroups()
 void ShadowContext::clearGlobalValues()
 {
     m_globalValues.clear();
+    m_globalValuesList.clear();
 }
 
 void ShadowContext::createMemoryPool()
@@ -2469,7 +2576,7 @@ void ShadowContext::createMemoryPool()
 ShadowWorkItem* ShadowContext::createShadowWorkItem(const WorkItem *workItem)
 {
     assert(!m_workSpace.workItems->count(workItem) && "Workitems may only have one shadow");
-    ShadowWorkItem *sWI = new ShadowWorkItem(m_numBitsBuffer);
+    ShadowWorkItem *sWI = new ShadowWorkItem(m_numBitsBuffer, m_cache);
     (*m_workSpace.workItems)[workItem] = sWI;
     return sWI;
 }
@@ -2537,18 +2644,18 @@ void ShadowContext::dumpGlobalValues() const
 {
     cout << "==== ShadowMap (global) =======" << endl;
 
-    UnorderedTypedValueMap::const_iterator itr;
     unsigned num = 1;
 
-    for(itr = m_globalValues.begin(); itr != m_globalValues.end(); ++itr)
+    for(const llvm::Value *V : m_globalValuesList)
     {
-        if(itr->first->hasName())
+        TypedValue shadow = m_globalValues[m_cache->getValueID(V)];
+        if(V->hasName())
         {
-            cout << "%" << itr->first->getName().str() << ": " << itr->second << endl;
+            cout << "%" << V->getName().str() << ": " << shadow << endl;
         }
         else
         {
-            cout << "%" << dec << num++ << ": " << itr->second << endl;
+            cout << "%" << dec << num++ << ": " << shadow << endl;
         }
     }
 
@@ -2683,15 +2790,32 @@ TypedValue ShadowContext::getPoisonedValue(const llvm::Type *Ty)
 
 TypedValue ShadowContext::getValue(const WorkItem *workItem, const llvm::Value *V) const
 {
-    if(m_globalValues.count(V))
+    // Only kernel arguments and global variables have global shadows
+    if(llvm::isa<llvm::Argument>(V) || llvm::isa<llvm::GlobalVariable>(V))
     {
-        return m_globalValues.at(V);
+        unsigned id = m_cache->getValueID(V);
+        if(id < m_globalValues.size() && m_globalValues[id].num)
+        {
+            return m_globalValues[id];
+        }
     }
-    else
+
+    ShadowValues *shadowValues = getShadowWorkItem(workItem)->getValues();
+    return shadowValues->getValue(V);
+}
+
+bool ShadowContext::hasValue(const WorkItem *workItem, const llvm::Value* V) const
+{
+    if(llvm::isa<llvm::Argument>(V) || llvm::isa<llvm::GlobalVariable>(V))
     {
-        ShadowValues *shadowValues = getShadowWorkItem(workItem)->getValues();
-        return shadowValues->getValue(V);
+        unsigned id = m_cache->getValueID(V);
+        if(id < m_globalValues.size() && m_globalValues[id].num)
+        {
+            return true;
+        }
     }
+
+    return getShadowWorkItem(workItem)->getValues()->hasValue(V);
 }
 
 bool ShadowContext::isCleanImage(const TypedValue shadowImage)
@@ -2800,8 +2924,14 @@ bool ShadowContext::isCleanValue(TypedValue v, unsigned offset)
 
 void ShadowContext::setGlobalValue(const llvm::Value *V, TypedValue SV)
 {
-    assert(!m_globalValues.count(V) && "Values may only have one shadow");
-    m_globalValues[V] = SV;
+    unsigned id = m_cache->getValueID(V);
+    if(m_globalValues.size() <= id)
+    {
+        m_globalValues.resize(m_cache->getNumValues());
+    }
+    assert(!m_globalValues[id].num && "Values may only have one shadow");
+    m_globalValues[id] = SV;
+    m_globalValuesList.push_back(V);
 }
 
 void ShadowContext::shadowOr(TypedValue v1, TypedValue v2)
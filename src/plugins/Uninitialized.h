@@ -10,6 +10,9 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IntrinsicInst.h"
 
+#include <atomic>
+#include <mutex>
+
 //#define DUMP_SHADOW
 //#define PARANOID_CHECK(W, I) assert(checkAllOperandsDefined(W, I) && "Not all operands defined")
 //#define PARANOID_CHECK(W, I) checkAllOperandsDefined(W, I)
@@ -17,24 +20,24 @@
 
 namespace oclgrind
 {
-    typedef std::unordered_map<const llvm::Value*, TypedValue> UnorderedTypedValueMap;
+    class InterpreterCache;
 
+    // Shadow registers for one call frame, indexed by the value IDs
+    // assigned by the kernel's InterpreterCache
     class ShadowFrame
     {
         public:
-            ShadowFrame();
+            ShadowFrame(const InterpreterCache *cache);
             virtual ~ShadowFrame();
 
+            void clear();
             void dump() const;
             inline const llvm::CallInst* getCall() const
             {
                 return m_call;
             }
             TypedValue getValue(const llvm::Value *V) const;
-            inline bool hasValue(const llvm::Value* V) const
-            {
-                return llvm::isa<llvm::Constant>(V) || m_values->count(V);
-            }
+            bool hasValue(const llvm::Value* V) const;
             inline void setCall(const llvm::CallInst *CI)
             {
                 m_call = CI;
@@ -44,8 +47,10 @@ namespace oclgrind
         private:
             typedef std::list<const llvm::Value*> ValuesList;
 
+            const InterpreterCache *m_cache;
             const llvm::CallInst *m_call;
-            UnorderedTypedValueMap *m_values;
+            std::vector<TypedValue> m_values;
+            std::vector<unsigned> m_setValues;
 #ifdef DUMP_SHADOW
             ValuesList *m_valuesList;
 #endif
@@ -54,7 +59,7 @@ namespace oclgrind
     class ShadowValues
     {
         public:
-            ShadowValues();
+            ShadowValues(const InterpreterCache *cache);
             virtual ~ShadowValues();
 
             ShadowFrame* createCleanShadowFrame();
@@ -78,7 +83,8 @@ namespace oclgrind
             {
                 ShadowFrame *frame = m_stack->top();
                 m_stack->pop();
-                delete frame;
+                frame->clear();
+                m_freeFrames.push_back(frame);
             }
             inline void pushFrame(ShadowFrame *frame)
             {
@@ -96,9 +102,14 @@ namespace oclgrind
         private:
             typedef std::stack<ShadowFrame*> ShadowValuesStack;
 
+            const InterpreterCache *m_cache;
             ShadowValuesStack *m_stack;
+            std::vector<ShadowFrame*> m_freeFrames;
     };
 
+    // Shadow memory with the same buffer-index addressing as Memory
+    // Each byte has a 2-bit state (clean, poisoned or partial), and the
+    // full shadow byte is only kept for partially initialised bytes
     class ShadowMemory
     {
         public:
@@ -106,7 +117,9 @@ namespace oclgrind
             {
                 size_t size;
                 cl_mem_flags flags;
-                unsigned char *data;
+                std::atomic<uint64_t> *state;
+                std::mutex partialMutex;
+                std::unordered_map<size_t, unsigned char> partial;
             };
 
             ShadowMemory(AddressSpace addrSpace, unsigned bufferBits);
@@ -114,7 +127,6 @@ namespace oclgrind
 
             void allocate(size_t address, size_t size);
             void dump() const;
-            void* getPointer(size_t address) const;
             bool isAddressValid(size_t address, size_t size=1) const;
             void load(unsigned char *dst, size_t address, size_t size=1) const;
             void lock(size_t address) const;
@@ -122,10 +134,14 @@ namespace oclgrind
             void unlock(size_t address) const;
 
         private:
-            typedef std::unordered_map<size_t, Buffer*> MemoryMap;
+            static const unsigned CLEAN    = 0;
+            static const unsigned POISONED = 1;
+            static const unsigned PARTIAL  = 2;
+            static const unsigned BITS_PER_BYTE = 2;
+            static const unsigned BYTES_PER_WORD = 64 / BITS_PER_BYTE;
 
             AddressSpace m_addrSpace;
-            MemoryMap m_map;
+            std::vector<Buffer*> m_buffers;
             unsigned m_numBitsAddress;
             unsigned m_numBitsBuffer;
 
@@ -138,7 +154,7 @@ namespace oclgrind
     class ShadowWorkItem
     {
         public:
-            ShadowWorkItem(unsigned bufferBits);
+            ShadowWorkItem(unsigned bufferBits, const InterpreterCache *cache);
             virtual ~ShadowWorkItem();
 
             inline void dump() const
@@ -206,7 +222,6 @@ namespace oclgrind
             {
                 return m_globalMemory;
             }
-            TypedValue getGlobalValue(const llvm::Value *V) const;
             MemoryPool* getMemoryPool() const
             {
                 return m_workSpace.memoryPool;
@@ -224,10 +239,7 @@ namespace oclgrind
                 return m_workSpace.workGroups->at(workGroup);
             }
             TypedValue getValue(const WorkItem *workItem, const llvm::Value *V) const;
-            inline bool hasValue(const WorkItem *workItem, const llvm::Value* V) const
-            {
-                return llvm::isa<llvm::Constant>(V) || m_globalValues.count(V) || m_workSpace.workItems->at(workItem)->getValues()->hasValue(V);
-            }
+            bool hasValue(const WorkItem *workItem, const llvm::Value* V) const;
             static bool isCleanImage(const TypedValue shadowImage);
             static bool isCleanImageAddress(const TypedValue shadowImage);
             static bool isCleanImageDescription(const TypedValue shadowImage);
@@ -237,11 +249,17 @@ namespace oclgrind
             static bool isCleanValue(TypedValue v);
             static bool isCleanValue(TypedValue v, unsigned offset);
             void setGlobalValue(const llvm::Value *V, TypedValue SV);
+            inline void setInterpreterCache(const InterpreterCache *cache)
+            {
+                m_cache = cache;
+            }
             static void shadowOr(TypedValue v1, TypedValue v2);
 
         private:
+            const InterpreterCache *m_cache;
             ShadowMemory *m_globalMemory;
-            UnorderedTypedValueMap m_globalValues;
+            std::vector<TypedValue> m_globalValues;
+            std::list<const llvm::Value*> m_globalValuesList;
             unsigned m_numBitsBuffer;
             typedef std::map<const WorkItem*, ShadowWorkItem*> ShadowItemMap;
             typedef std::map<const WorkGroup*, ShadowWorkGroup*> ShadowGroupMap;
@@ -261,6 +279,7 @@ namespace oclgrind
             Uninitialized(const Context *context);
             virtual ~Uninitialized();
 
+            virtual CallbackMask getCallbacks() const override;
             virtual void hostMemoryStore(const Memory *memory,
                     size_t address, size_t size,
                     const uint8_t *storeData) override;
@@ -113,10 +113,14 @@
 #define clCreateEventFromGLsyncKHR _clCreateEventFromGLsyncKHR
 #endif // OCLGRIND_ICD
 
+#include <atomic>
+#include <future>
 #include <list>
 #include <map>
+#include <mutex>
 #include <stack>
 #include <stdint.h>
+#include <thread>
 
 #define CL_USE_DEPRECATED_OPENCL_1_0_APIS
 #define CL_USE_DEPRECATED_OPENCL_1_1_APIS
@@ -164,7 +168,9 @@ struct _cl_context
   void *data;
   cl_context_properties *properties;
   size_t szProperties;
-  unsigned int refCount;
+  std::atomic<unsigned int> refCount;
+  std::mutex buildThreadsMutex;
+  std::list<std::thread> buildThreads;
 };
 
 struct _cl_command_queue
@@ -202,7 +208,10 @@ struct _cl_program
   void *dispatch;
   oclgrind::Program *program;
   cl_context context;
-  unsigned int refCount;
+  std::atomic<unsigned int> refCount;
+  std::mutex buildMutex;
+  std::shared_future<void> build;
+  std::thread buildThread;
 };
 
 struct _cl_kernel
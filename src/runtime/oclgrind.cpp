@@ -199,7 +199,11 @@ static bool parseArguments(int argc, char *argv[])
 {
   for (int i = 1; i < argc; i++)
   {
-    if (!strcmp(argv[i], "--build-options"))
+    if (!strcmp(argv[i], "--aggregate-errors"))
+    {
+      setEnvironment("OCLGRIND_AGGREGATE_ERRORS", "1");
+    }
+    else if (!strcmp(argv[i], "--build-options"))
     {
       if (++i >= argc)
       {
@@ -208,6 +212,15 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_BUILD_OPTIONS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--cache-dir"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --cache-dir" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_CACHE_DIR", argv[i]);
+    }
     else if (!strcmp(argv[i], "--check-api"))
     {
       setEnvironment("OCLGRIND_CHECK_API", "1");
@@ -260,10 +273,24 @@ static bool parseArguments(int argc, char *argv[])
     {
       setEnvironment("OCLGRIND_INST_COUNTS", "1");
     }
+    else if (!strcmp(argv[i], "--inst-counts-cumulative"))
+    {
+      setEnvironment("OCLGRIND_INST_COUNTS", "1");
+      setEnvironment("OCLGRIND_INST_COUNTS_CUMULATIVE", "1");
+    }
     else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--interactive"))
     {
       setEnvironment("OCLGRIND_INTERACTIVE", "1");
     }
+    else if (!strcmp(argv[i], "--lanes"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --lanes" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_LANES", argv[i]);
+    }
     else if (!strcmp(argv[i], "--local-mem-size"))
     {
       if (++i >= argc)
@@ -282,6 +309,15 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_LOG", argv[i]);
     }
+    else if (!strcmp(argv[i], "--log-format"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --log-format" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_LOG_FORMAT", argv[i]);
+    }
     else if (!strcmp(argv[i], "--max-errors"))
     {
       if (++i >= argc)
@@ -309,6 +345,10 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_NUM_THREADS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--optimize-ir"))
+    {
+      setEnvironment("OCLGRIND_OPTIMIZE_IR", "1");
+    }
     else if (!strcmp(argv[i], "--pch-dir"))
     {
       if (++i >= argc)
@@ -327,6 +367,19 @@ static bool parseArguments(int argc, char *argv[])
       }
       setEnvironment("OCLGRIND_PLUGINS", argv[i]);
     }
+    else if (!strcmp(argv[i], "--profile"))
+    {
+      if (++i >= argc)
+      {
+        cerr << "Missing argument to --profile" << endl;
+        return false;
+      }
+      setEnvironment("OCLGRIND_PROFILE", argv[i]);
+    }
+    else if (!strcmp(argv[i], "--profile-flush"))
+    {
+      setEnvironment("OCLGRIND_PROFILE_FLUSH", "1");
+    }
     else if (!strcmp(argv[i], "-q") || !strcmp(argv[i], "--quick"))
     {
       setEnvironment("OCLGRIND_QUICK", "1");
@@ -458,8 +511,12 @@ static void printUsage()
     << "       oclgrind [--help | --version]" << endl
     << endl
     << "Options:" << endl
+    << "  --aggregate-errors           "
+          "Report repeated errors from an instruction once" << endl
     << "  --build-options     OPTIONS  "
           "Additional options to pass to the OpenCL compiler" << endl
+    << "  --cache-dir         DIR      "
+          "Cache compiled programs in a directory" << endl
     << "  --check-api                  "
           "Report errors on API calls"  << endl
     << "  --compute-units     UNITS    "
@@ -478,22 +535,34 @@ static void printUsage()
           "Display usage information" << endl
     << "  --inst-counts                "
           "Output histograms of instructions executed" << endl
+    << "  --inst-counts-cumulative     "
+          "Output one histogram of instructions for all kernels" << endl
     << "  --interactive [-i]           "
           "Enable interactive mode" << endl
+    << "  --lanes             NUM      "
+          "Run work-items of barrier-free kernels in lockstep batches" << endl
     << "  --local-mem-size    BYTES    "
           "Change the local memory size of the device" << endl
     << "  --log               LOGFILE  "
           "Redirect log/error messages to a file" << endl
+    << "  --log-format        FORMAT   "
+          "Write log/error messages as 'text' or 'json' lines" << endl
     << "  --max-errors        NUM      "
           "Limit the number of error/warning messages" << endl
     << "  --max-wgsize        WGSIZE   "
           "Change the maximum work-group size of the device" << endl
     << "  --num-threads       NUM      "
           "Set the number of worker threads to use" << endl
+    << "  --optimize-ir                "
+          "Optimize kernels to reduce interpretation cost" << endl
     << "  --pch-dir           DIR      "
           "Override directory containing precompiled headers" << endl
     << "  --plugins           PLUGINS  "
           "Load colon separated list of plugin libraries" << endl
+    << "  --profile           FILE     "
+          "Write a callgrind profile of kernel hotspots to a file" << endl
+    << "  --profile-flush              "
+          "Rewrite the profile after every kernel" << endl
     << "  --quick [-q]                 "
           "Only run first and last work-group" << endl
     << "  --uniform-writes             "
@@ -11,8 +11,10 @@
 #include <cassert>
 #include <cmath>
 #include <cstring>
+#include <functional>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 #include "async_queue.h"
 #include "icd.h"
@@ -23,6 +25,7 @@
 #include "core/Memory.h"
 #include "core/Program.h"
 #include "core/Queue.h"
+#include "core/Scheduler.h"
 
 using namespace std;
 
@@ -168,22 +171,89 @@ namespace
     }
   }
 
-  void releaseCommand(oclgrind::Command *command)
+  void releaseCompletedCommands(oclgrind::Queue *queue)
   {
-    if (command)
+    while (oclgrind::Command *command = queue->popCompleted())
     {
       asyncQueueRelease(command);
+      delete command;
+    }
+  }
 
-      // Release dependent commands
-      while (!command->execBefore.empty())
-      {
-        oclgrind::Command *cmd = command->execBefore.front();
-        command->execBefore.pop_front();
-        releaseCommand(cmd);
-      }
+  // Programs built with a notification callback are built on a separate
+  // thread, and may be queried by the host while the build is running
+  bool isBuildInProgress(cl_program program)
+  {
+    lock_guard<mutex> lock(program->buildMutex);
+    return program->build.valid() &&
+      program->build.wait_for(chrono::seconds(0)) != future_status::ready;
+  }
 
-      delete command;
+  void waitForBuild(cl_program program)
+  {
+    shared_future<void> build;
+    {
+      lock_guard<mutex> lock(program->buildMutex);
+      build = program->build;
+    }
+    if (build.valid())
+      build.wait();
+  }
+
+  // Mark a program as being built, unless a build is already in progress
+  // The caller must set the returned promise once the build has finished
+  shared_ptr<promise<void>> beginBuild(cl_program program)
+  {
+    lock_guard<mutex> lock(program->buildMutex);
+    if (program->build.valid() &&
+        program->build.wait_for(chrono::seconds(0)) != future_status::ready)
+      return NULL;
+
+    shared_ptr<promise<void>> done = make_shared<promise<void>>();
+    program->build = done->get_future().share();
+    return done;
+  }
+
+  // Wait for a thread that builds programs in the background to finish
+  // A build callback that releases its program or context runs on that
+  // thread, which cannot wait for itself, but has nothing left to do once
+  // the callback returns
+  void joinBuildThread(thread& build)
+  {
+    if (!build.joinable())
+      return;
+    if (build.get_id() == this_thread::get_id())
+      build.detach();
+    else
+      build.join();
+  }
+
+  void joinBuildThread(cl_program program)
+  {
+    thread build;
+    {
+      lock_guard<mutex> lock(program->buildMutex);
+      build.swap(program->buildThread);
     }
+    joinBuildThread(build);
+  }
+
+  // The program is released by the host, so it must not be used by the
+  // build thread once the callback has been fired
+  void buildAsync(cl_program program, shared_ptr<promise<void>> done,
+                  function<void()> build,
+                  void (CL_CALLBACK *pfn_notify)(cl_program, void*),
+                  void *user_data)
+  {
+    // The thread from an earlier build may still be firing its callback
+    joinBuildThread(program);
+
+    lock_guard<mutex> lock(program->buildMutex);
+    program->buildThread = thread([=]{
+      build();
+      done->set_value();
+      pfn_notify(program, user_data);
+    });
   }
 }
 
@@ -980,6 +1050,17 @@ clReleaseContext
 
   if (--context->refCount == 0)
   {
+    // Build threads of programs released by their own build callbacks
+    list<thread> buildThreads;
+    {
+      lock_guard<mutex> lock(context->buildThreadsMutex);
+      buildThreads.swap(context->buildThreads);
+    }
+    for (thread& build : buildThreads)
+    {
+      joinBuildThread(build);
+    }
+
     if (context->properties)
     {
       free(context->properties);
@@ -2375,6 +2456,24 @@ clReleaseProgram
 
   if (--program->refCount == 0)
   {
+    // Wait for a background build and its callback to finish
+    // When the callback itself releases the program, its thread is joined
+    // when the context is released instead
+    thread build;
+    {
+      lock_guard<mutex> lock(program->buildMutex);
+      build.swap(program->buildThread);
+    }
+    if (build.joinable() && build.get_id() == this_thread::get_id())
+    {
+      lock_guard<mutex> lock(program->context->buildThreadsMutex);
+      program->context->buildThreads.push_back(std::move(build));
+    }
+    else
+    {
+      joinBuildThread(build);
+    }
+
     delete program->program;
     clReleaseContext(program->context);
     delete program;
@@ -2418,9 +2517,26 @@ clBuildProgram
   {
     ReturnErrorArg(program->context, CL_INVALID_DEVICE, device);
   }
+  shared_ptr<promise<void>> done = beginBuild(program);
+  if (!done)
+  {
+    ReturnErrorInfo(program->context, CL_INVALID_OPERATION,
+                    "Program build already in progress");
+  }
+
+  // Build in the background if the host asked to be notified
+  if (pfn_notify)
+  {
+    string buildOptions = options ? options : "";
+    buildAsync(program, done, [program, buildOptions]{
+        program->program->build(buildOptions.c_str());
+      }, pfn_notify, user_data);
+    return CL_SUCCESS;
+  }
 
   // Build program
   bool success = program->program->build(options);
+  done->set_value();
 
   // Fire callback
   if (pfn_notify)
@@ -2483,6 +2599,12 @@ clCompileProgram
   {
     ReturnErrorArg(program->context, CL_INVALID_DEVICE, device);
   }
+  shared_ptr<promise<void>> done = beginBuild(program);
+  if (!done)
+  {
+    ReturnErrorInfo(program->context, CL_INVALID_OPERATION,
+                    "Program build already in progress");
+  }
 
   // Prepare headers
   list<oclgrind::Program::Header> headers;
@@ -2492,8 +2614,27 @@ clCompileProgram
                                 input_headers[i]->program));
   }
 
+  // Build in the background if the host asked to be notified
+  if (pfn_notify)
+  {
+    string buildOptions = options ? options : "";
+    vector<cl_program> headerPrograms(input_headers,
+                                      input_headers + num_input_headers);
+    for (cl_program header : headerPrograms)
+      clRetainProgram(header);
+    buildAsync(program, done,
+               [program, buildOptions, headers, headerPrograms]{
+        program->program->build(buildOptions.c_str(), headers);
+        for (cl_program header : headerPrograms)
+          clReleaseProgram(header);
+      }, pfn_notify, user_data);
+    return CL_SUCCESS;
+  }
+
   // Build program
-  if (!program->program->build(options, headers))
+  bool success = program->program->build(options, headers);
+  done->set_value();
+  if (!success)
   {
     ReturnError(program->context, CL_BUILD_PROGRAM_FAILURE);
   }
@@ -2555,6 +2696,7 @@ clLinkProgram
   list<const oclgrind::Program*> programs;
   for (unsigned i = 0; i < num_input_programs; i++)
   {
+    waitForBuild(input_programs[i]);
     programs.push_back(input_programs[i]->program);
   }
 
@@ -2608,6 +2750,7 @@ clGetProgramInfo
   {
     ReturnErrorArg(NULL, CL_INVALID_PROGRAM, program);
   }
+  waitForBuild(program);
   if ((param_name == CL_PROGRAM_NUM_KERNELS ||
        param_name == CL_PROGRAM_KERNEL_NAMES) &&
       program->program->getBuildStatus() != CL_BUILD_SUCCESS)
@@ -2735,13 +2878,18 @@ clGetProgramBuildInfo
   {
   case CL_PROGRAM_BUILD_STATUS:
     result_size = sizeof(cl_build_status);
-    result_data.status = program->program->getBuildStatus();
+    if (isBuildInProgress(program))
+      result_data.status = CL_BUILD_IN_PROGRESS;
+    else
+      result_data.status = program->program->getBuildStatus();
     break;
   case CL_PROGRAM_BUILD_OPTIONS:
+    waitForBuild(program);
     str = program->program->getBuildOptions().c_str();
     result_size = strlen(str) + 1;
     break;
   case CL_PROGRAM_BUILD_LOG:
+    waitForBuild(program);
     str = program->program->getBuildLog().c_str();
     result_size = strlen(str) + 1;
     break;
@@ -2750,6 +2898,7 @@ clGetProgramBuildInfo
     result_data.type = CL_PROGRAM_BINARY_TYPE_COMPILED_OBJECT;
     break;
   case CL_PROGRAM_BUILD_GLOBAL_VARIABLE_TOTAL_SIZE:
+    waitForBuild(program);
     result_size = sizeof(size_t);
     result_data.sizet = program->program->getTotalProgramScopeVarSize();
     break;
@@ -2796,6 +2945,12 @@ clCreateKernel
     SetErrorArg(program->context, CL_INVALID_VALUE, kernel_name);
     return NULL;
   }
+  if (isBuildInProgress(program))
+  {
+    SetErrorInfo(program->context, CL_INVALID_PROGRAM_EXECUTABLE,
+                 "Program build in progress");
+    return NULL;
+  }
 
   // Create kernel object
   cl_kernel kernel = new _cl_kernel;
@@ -2831,7 +2986,8 @@ clCreateKernelsInProgram
   {
     ReturnErrorArg(NULL, CL_INVALID_PROGRAM, program);
   }
-  if (program->program->getBuildStatus() != CL_BUILD_SUCCESS)
+  if (isBuildInProgress(program) ||
+      program->program->getBuildStatus() != CL_BUILD_SUCCESS)
   {
     ReturnErrorInfo(program->context, CL_INVALID_PROGRAM_EXECUTABLE,
                     "Program not built");
@@ -3250,15 +3406,6 @@ clGetKernelWorkGroupInfo
 
 /* Event Object APIs  */
 
-namespace
-{
-  // Utility to check if an event has completed (or terminated)
-  inline bool isComplete(cl_event event)
-  {
-    return (event->event->state == CL_COMPLETE || event->event->state < 0);
-  }
-}
-
 CL_API_ENTRY cl_int CL_API_CALL
 clWaitForEvents
 (
@@ -3276,36 +3423,18 @@ clWaitForEvents
     ReturnErrorInfo(NULL, CL_INVALID_VALUE, "event_list cannot be NULL");
   }
 
-  // Loop until all events complete
-  bool complete = false;
-  while (!complete)
+  // Wait for each event to complete (or terminate)
+  for (unsigned i = 0; i < num_events; i++)
   {
-    complete = true;
-    for (unsigned i = 0; i < num_events; i++)
-    {
-      // Skip event if already complete
-      if (isComplete(event_list[i]))
-      {
-        continue;
-      }
-
-      // If it's not a user event, execute the associated command
-      if (event_list[i]->queue)
-      {
-        oclgrind::Command *cmd = event_list[i]->event->command;
-        event_list[i]->event->queue->execute(cmd, false);
-        releaseCommand(cmd);
+    oclgrind::Queue::wait(event_list[i]->event);
+  }
 
-        // If it's still not complete, update flag
-        if (!isComplete(event_list[i]))
-        {
-          complete = false;
-        }
-      }
-      else
-      {
-        complete = false;
-      }
+  // Release commands that have finished executing
+  for (unsigned i = 0; i < num_events; i++)
+  {
+    if (event_list[i]->queue)
+    {
+      releaseCompletedCommands(event_list[i]->queue->queue);
     }
   }
 
@@ -3490,7 +3619,9 @@ clSetUserEventStatus
                     "Event status already set");
   }
 
-  event->event->state = execution_status;
+  // Release commands waiting for the event, and host threads blocked on it
+  event->context->context->getScheduler()->setUserEventStatus(
+    event->event, execution_status);
 
   // Perform callbacks
   list< pair<void (CL_CALLBACK *)(cl_event, cl_int, void *), void*> >::iterator itr;
@@ -3607,8 +3738,9 @@ clFlush
     ReturnErrorArg(NULL, CL_INVALID_COMMAND_QUEUE, command_queue);
   }
 
-  // TODO: Implement properly?
-  clFinish(command_queue);
+  // Commands are submitted to the context's scheduler as soon as they are
+  // enqueued, so just release any that have already completed
+  releaseCompletedCommands(command_queue->queue);
 
   return CL_SUCCESS;
 }
@@ -3625,9 +3757,8 @@ clFinish
     ReturnErrorArg(NULL, CL_INVALID_COMMAND_QUEUE, command_queue);
   }
 
-  // TODO: Move this finish to async thread?
-  oclgrind::Command *cmd = command_queue->queue->finish();
-  releaseCommand(cmd);
+  command_queue->queue->finish();
+  releaseCompletedCommands(command_queue->queue);
 
   return CL_SUCCESS;
 }
@@ -5180,7 +5311,7 @@ clEnqueueMarkerWithWaitList
   }
 
   // Enqueue command
-  oclgrind::Command *cmd = new oclgrind::Command();
+  oclgrind::Command *cmd = new oclgrind::Command(oclgrind::Command::MARKER);
   asyncEnqueue(command_queue, CL_COMMAND_MARKER, cmd,
                num_events_in_wait_list, event_wait_list, event);
 
@@ -5203,7 +5334,7 @@ clEnqueueBarrierWithWaitList
   }
 
   // Enqueue command
-  oclgrind::Command *cmd = new oclgrind::Command();
+  oclgrind::Command *cmd = new oclgrind::Command(oclgrind::Command::BARRIER);
   asyncEnqueue(command_queue, CL_COMMAND_BARRIER, cmd,
                num_events_in_wait_list, event_wait_list, event);
 
@@ -5245,7 +5376,7 @@ clEnqueueWaitForEvents
   }
 
   // Enqueue command
-  oclgrind::Command *cmd = new oclgrind::Command();
+  oclgrind::Command *cmd = new oclgrind::Command(oclgrind::Command::BARRIER);
   asyncEnqueue(command_queue, CL_COMMAND_BARRIER, cmd,
                num_events, event_list, NULL);
 
@@ -0,0 +1,170 @@
+// Needed for setenv() with -std=c99
+#define _POSIX_C_SOURCE 200112L
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_ERRORS 8
+
+const char *KERNEL_SOURCE =
+"#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable \n"
+"kernel void histogram(global const uint *data,    \n"
+"                      global uint *bins,          \n"
+"                      global ulong *total,        \n"
+"                      uint numBins)               \n"
+"{                                                 \n"
+"  uint value = data[get_global_id(0)];            \n"
+"  atomic_inc(bins + (value % numBins));           \n"
+"  atom_add(total, value);                         \n"
+"}                                                 \n"
+;
+
+static void setEnvironment(const char *name, const char *value)
+{
+#if defined(_WIN32) && !defined(__MINGW32__)
+  _putenv_s(name, value);
+#else
+  setenv(name, value, 1);
+#endif
+}
+
+// Run histogram kernel, returning number of errors
+static unsigned runHistogram(size_t N, cl_uint numBins, cl_uint *h_data)
+{
+  cl_int err;
+  cl_kernel kernel;
+  cl_mem d_data, d_bins, d_total;
+
+  // Create a new context so that atomic settings are picked up
+  Context cl = createContext(KERNEL_SOURCE, "");
+
+  kernel = clCreateKernel(cl.program, "histogram", &err);
+  checkError(err, "creating kernel");
+
+  cl_uint *h_bins = calloc(numBins, sizeof(cl_uint));
+  cl_ulong h_total = 0;
+
+  d_data = clCreateBuffer(cl.context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR,
+                          N*sizeof(cl_uint), h_data, &err);
+  checkError(err, "creating d_data buffer");
+  d_bins = clCreateBuffer(cl.context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+                          numBins*sizeof(cl_uint), h_bins, &err);
+  checkError(err, "creating d_bins buffer");
+  d_total = clCreateBuffer(cl.context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+                           sizeof(cl_ulong), &h_total, &err);
+  checkError(err, "creating d_total buffer");
+
+  err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_data);
+  err |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_bins);
+  err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_total);
+  err |= clSetKernelArg(kernel, 3, sizeof(cl_uint), &numBins);
+  checkError(err, "setting kernel args");
+
+  err = clEnqueueNDRangeKernel(cl.queue, kernel,
+                               1, NULL, &N, NULL, 0, NULL, NULL);
+  checkError(err, "enqueuing kernel");
+
+  err = clFinish(cl.queue);
+  checkError(err, "running kernel");
+
+  err  = clEnqueueReadBuffer(cl.queue, d_bins, CL_TRUE, 0,
+                             numBins*sizeof(cl_uint), h_bins, 0, NULL, NULL);
+  err |= clEnqueueReadBuffer(cl.queue, d_total, CL_TRUE, 0,
+                             sizeof(cl_ulong), &h_total, 0, NULL, NULL);
+  checkError(err, "reading results");
+
+  // Check results
+  unsigned errors = 0;
+  cl_uint *ref = calloc(numBins, sizeof(cl_uint));
+  cl_ulong refTotal = 0;
+  for (size_t i = 0; i < N; i++)
+  {
+    ref[h_data[i] % numBins]++;
+    refTotal += h_data[i];
+  }
+  for (cl_uint b = 0; b < numBins; b++)
+  {
+    if (h_bins[b] != ref[b])
+    {
+      if (errors < MAX_ERRORS)
+        fprintf(stderr, "bin %4u: %u != %u\n", b, h_bins[b], ref[b]);
+      errors++;
+    }
+  }
+  if (h_total != refTotal)
+  {
+    fprintf(stderr, "total: %llu != %llu\n",
+            (unsigned long long)h_total, (unsigned long long)refTotal);
+    errors++;
+  }
+
+  free(ref);
+  free(h_bins);
+  clReleaseMemObject(d_data);
+  clReleaseMemObject(d_bins);
+  clReleaseMemObject(d_total);
+  clReleaseKernel(kernel);
+  releaseContext(cl);
+
+  return errors;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t N = 4096;
+  if (argc > 1)
+  {
+    N = atoi(argv[1]);
+  }
+
+  cl_uint numBins = 16;
+  if (argc > 2)
+  {
+    numBins = atoi(argv[2]);
+  }
+
+  // Atomics only contend when several workers run at once
+  unsigned maxThreads = 4;
+  if (argc > 3)
+  {
+    maxThreads = atoi(argv[3]);
+  }
+
+  if (!N || !numBins || !maxThreads)
+  {
+    printf("Usage: ./atomic_histogram N [BINS] [MAX_THREADS]\n");
+    exit(1);
+  }
+
+  // Initialise host data
+  srand(0);
+  cl_uint *h_data = malloc(N*sizeof(cl_uint));
+  for (size_t i = 0; i < N; i++)
+  {
+    h_data[i] = rand();
+  }
+
+  // Check lock-free and mutex-based global atomics at each thread count
+  unsigned errors = 0;
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    char numThreads[16];
+    sprintf(numThreads, "%u", threads);
+    setEnvironment("OCLGRIND_NUM_THREADS", numThreads);
+
+    setEnvironment("OCLGRIND_DISABLE_NATIVE_ATOMICS", "0");
+    errors += runHistogram(N, numBins, h_data);
+    setEnvironment("OCLGRIND_DISABLE_NATIVE_ATOMICS", "1");
+    errors += runHistogram(N, numBins, h_data);
+  }
+
+  if (errors)
+    printf("%d errors detected\n", errors);
+
+  free(h_data);
+
+  return (errors != 0);
+}
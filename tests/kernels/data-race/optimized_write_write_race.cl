@@ -0,0 +1,4 @@
+kernel void optimized_write_write_race(global int *data)
+{
+  data[0] = get_global_id(0);
+}
@@ -0,0 +1,5 @@
+kernel void json_max_errors(global int *a, global int *b)
+{
+  int i = get_global_id(0);
+  b[i] = a[i];
+}
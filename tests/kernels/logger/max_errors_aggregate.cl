@@ -0,0 +1,5 @@
+kernel void max_errors_aggregate(global int *a, global int *b, global int *c)
+{
+  int i = get_global_id(0);
+  c[i] = a[i] + b[i];
+}
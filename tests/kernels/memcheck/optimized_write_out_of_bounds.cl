@@ -0,0 +1,6 @@
+kernel void optimized_write_out_of_bounds(global int *a, global int *b,
+                                          global int *c)
+{
+  int i = get_global_id(0);
+  c[i] = a[i] + b[i];
+}
@@ -0,0 +1,5 @@
+kernel void binary_argument(global uint *input, global uint *output)
+{
+  size_t i = get_global_id(0);
+  output[i] = input[i] * 2;
+}
@@ -0,0 +1,140 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_PROGRAMS 4
+
+const char *SOURCE =
+"kernel void test_kernel(global int *out) \n"
+"{                                        \n"
+"  *out = VALUE;                          \n"
+"}                                        \n"
+;
+
+const char *SOURCE_INVALID =
+"kernel void test_kernel(global int *out) \n"
+"{                                        \n"
+"  *out = undeclared;                     \n"
+"}                                        \n"
+;
+
+void CL_CALLBACK notify(cl_program program, void *data)
+{
+  *(volatile int*)data = 1;
+}
+
+void CL_CALLBACK notifyAndRelease(cl_program program, void *data)
+{
+  clReleaseProgram(program);
+  *(volatile int*)data = 1;
+}
+
+int main(int argc, char *argv[])
+{
+  cl_int err;
+  cl_kernel kernel;
+  cl_mem d_out;
+  cl_program programs[NUM_PROGRAMS];
+  volatile int done[NUM_PROGRAMS+1] = {0};
+
+  Context cl = createContext(SOURCE, "-D VALUE=0");
+
+  d_out = clCreateBuffer(cl.context, CL_MEM_WRITE_ONLY, 4, NULL, &err);
+  checkError(err, "creating d_out");
+
+  // Start all builds before waiting for any of them
+  for (int i = 0; i < NUM_PROGRAMS; i++)
+  {
+    char options[32];
+    sprintf(options, "-D VALUE=%d", i+1);
+
+    programs[i] = clCreateProgramWithSource(cl.context, 1, &SOURCE, NULL, &err);
+    checkError(err, "creating program");
+
+    err = clBuildProgram(programs[i], 1, &cl.device, options,
+                         notify, (void*)&done[i]);
+    checkError(err, "starting build");
+  }
+
+  cl_program invalid =
+    clCreateProgramWithSource(cl.context, 1, &SOURCE_INVALID, NULL, &err);
+  checkError(err, "creating program");
+  err = clBuildProgram(invalid, 1, &cl.device, NULL,
+                       notify, (void*)&done[NUM_PROGRAMS]);
+  checkError(err, "starting build");
+
+  for (int i = 0; i <= NUM_PROGRAMS; i++)
+  {
+    while (!done[i]);
+  }
+
+  for (int i = 0; i < NUM_PROGRAMS; i++)
+  {
+    cl_build_status status;
+    err = clGetProgramBuildInfo(programs[i], cl.device,
+                                CL_PROGRAM_BUILD_STATUS,
+                                sizeof(status), &status, NULL);
+    checkError(err, "getting build status");
+    if (status != CL_BUILD_SUCCESS)
+    {
+      fprintf(stderr, "Program %d failed to build\n", i);
+      exit(1);
+    }
+
+    kernel = clCreateKernel(programs[i], "test_kernel", &err);
+    checkError(err, "creating kernel");
+
+    err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_out);
+    checkError(err, "setting kernel argument");
+
+    size_t global[1] = {1};
+    err = clEnqueueNDRangeKernel(cl.queue, kernel,
+                                 1, NULL, global, NULL, 0, NULL, NULL);
+    checkError(err, "enqueuing kernel");
+
+    int h_out;
+    err = clEnqueueReadBuffer(cl.queue, d_out, CL_TRUE, 0, 4, &h_out,
+                              0, NULL, NULL);
+    checkError(err, "reading buffer");
+
+    printf("out = %d\n", h_out);
+
+    clReleaseKernel(kernel);
+    clReleaseProgram(programs[i]);
+  }
+
+  cl_build_status status;
+  err = clGetProgramBuildInfo(invalid, cl.device, CL_PROGRAM_BUILD_STATUS,
+                              sizeof(status), &status, NULL);
+  checkError(err, "getting build status");
+  printf("invalid program %s\n",
+         status == CL_BUILD_ERROR ? "failed to build" : "built");
+  clReleaseProgram(invalid);
+
+  // Programs may be released by the host while they are being built, or
+  // by their own build callback
+  done[0] = 0;
+  cl_program released =
+    clCreateProgramWithSource(cl.context, 1, &SOURCE, NULL, &err);
+  checkError(err, "creating program");
+  err = clBuildProgram(released, 1, &cl.device, "-D VALUE=0",
+                       notify, (void*)&done[0]);
+  checkError(err, "starting build");
+  clReleaseProgram(released);
+  printf("released program %s\n", done[0] ? "notified" : "not notified");
+
+  done[0] = 0;
+  released = clCreateProgramWithSource(cl.context, 1, &SOURCE, NULL, &err);
+  checkError(err, "creating program");
+  err = clBuildProgram(released, 1, &cl.device, "-D VALUE=0",
+                       notifyAndRelease, (void*)&done[0]);
+  checkError(err, "starting build");
+  while (!done[0]);
+  printf("program released by callback\n");
+
+  clReleaseMemObject(d_out);
+  releaseContext(cl);
+
+  return 0;
+}
@@ -0,0 +1,154 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define N 16
+#define PROFILE "profile.callgrind"
+#define PROFILE_JSON PROFILE ".json"
+
+const char *SOURCE =
+"kernel void test_kernel(global int *data) \n"
+"{                                         \n"
+"  int i = get_global_id(0);               \n"
+"  data[i] = data[i] * 2;                  \n"
+"}                                         \n"
+;
+
+static void setEnv(const char *name, const char *value)
+{
+#if defined(_WIN32)
+  _putenv_s(name, value);
+#else
+  setenv(name, value, 1);
+#endif
+}
+
+static char* readFile(const char *filename)
+{
+  FILE *file = fopen(filename, "rb");
+  if (!file)
+    return NULL;
+
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+
+  char *data = malloc(size + 1);
+  data[fread(data, 1, size, file)] = '\0';
+  fclose(file);
+  return data;
+}
+
+static void runKernel(Context cl)
+{
+  cl_int err;
+  cl_kernel kernel;
+  cl_mem d_data;
+  int h_data[N] = {0};
+
+  kernel = clCreateKernel(cl.program, "test_kernel", &err);
+  checkError(err, "creating kernel");
+
+  d_data = clCreateBuffer(cl.context, CL_MEM_READ_WRITE|CL_MEM_COPY_HOST_PTR,
+                          sizeof(h_data), h_data, &err);
+  checkError(err, "creating d_data");
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_data);
+  checkError(err, "setting kernel argument");
+
+  size_t global[1] = {N};
+  err = clEnqueueNDRangeKernel(cl.queue, kernel,
+                               1, NULL, global, NULL, 0, NULL, NULL);
+  checkError(err, "enqueuing kernel");
+
+  err = clFinish(cl.queue);
+  checkError(err, "finishing queue");
+
+  clReleaseMemObject(d_data);
+  clReleaseKernel(kernel);
+}
+
+static void checkProfile()
+{
+  // The callgrind summary lists instructions, then loads and stores for
+  // the private, global, constant and local address spaces
+  char *callgrind = readFile(PROFILE);
+  if (!callgrind)
+  {
+    printf("callgrind profile missing\n");
+    return;
+  }
+  printf("%.*s\n", (int)strcspn(callgrind, "\n"), callgrind);
+
+  unsigned long counts[9] = {0};
+  const char *summary = strstr(callgrind, "summary: ");
+  if (summary)
+  {
+    sscanf(summary, "summary: %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+           counts+0, counts+1, counts+2, counts+3, counts+4,
+           counts+5, counts+6, counts+7, counts+8);
+  }
+  printf("callgrind global loads = %lu\n", counts[2]);
+  printf("callgrind global stores = %lu\n", counts[6]);
+  free(callgrind);
+
+  // Sum the global stores of each location in the JSON profile
+  char *json = readFile(PROFILE_JSON);
+  if (!json)
+  {
+    printf("JSON profile missing\n");
+    return;
+  }
+  printf("JSON %s test_kernel\n",
+         strstr(json, "\"function\": \"test_kernel\"") ? "contains"
+                                                         : "is missing");
+
+  unsigned long stores = 0;
+  const char *itr = json;
+  while ((itr = strstr(itr, "\"storeBytes\": {")))
+  {
+    unsigned long bytes = 0;
+    itr = strstr(itr, "\"global\": ");
+    if (!itr || sscanf(itr, "\"global\": %lu", &bytes) != 1)
+      break;
+    stores += bytes;
+  }
+  printf("JSON global stores = %lu\n", stores);
+  free(json);
+}
+
+int main(int argc, char *argv[])
+{
+  Context cl;
+
+  remove(PROFILE);
+  remove(PROFILE_JSON);
+  setEnv("OCLGRIND_PROFILE", PROFILE);
+
+  // The profile is written when the context is released
+  cl = createContext(SOURCE, NULL);
+  runKernel(cl);
+  char *early = readFile(PROFILE);
+  printf("profile %s before release\n", early ? "written" : "not written");
+  free(early);
+  releaseContext(cl);
+  checkProfile();
+
+  // Flushing rewrites the profile after every kernel
+  remove(PROFILE);
+  remove(PROFILE_JSON);
+  setEnv("OCLGRIND_PROFILE_FLUSH", "1");
+
+  cl = createContext(SOURCE, NULL);
+  runKernel(cl);
+  checkProfile();
+  releaseContext(cl);
+
+  return 0;
+}
@@ -0,0 +1,90 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// The helper is kept out of line, so that creating the kernel from the
+// binary has to load it along with the kernel itself
+const char *SOURCE =
+"__attribute__((noinline))                         \n"
+"int helper(int a, int b)                          \n"
+"{                                                 \n"
+"  return a * b + 1;                               \n"
+"}                                                 \n"
+"kernel void test_kernel(global int *out, int x)   \n"
+"{                                                 \n"
+"  *out = helper(x, 7);                            \n"
+"}                                                 \n"
+"kernel void other_kernel(global int *out)         \n"
+"{                                                 \n"
+"  *out = 0;                                       \n"
+"}                                                 \n"
+;
+
+int main(int argc, char *argv[])
+{
+  cl_int err;
+  cl_program program;
+  cl_kernel kernel;
+  cl_mem d_out;
+
+  Context cl = createContext(SOURCE, NULL);
+
+  // Retrieve the binary of the program built from source
+  size_t size;
+  err = clGetProgramInfo(cl.program, CL_PROGRAM_BINARY_SIZES,
+                         sizeof(size_t), &size, NULL);
+  checkError(err, "getting binary size");
+
+  unsigned char *binary = malloc(size);
+  err = clGetProgramInfo(cl.program, CL_PROGRAM_BINARIES,
+                         sizeof(unsigned char*), &binary, NULL);
+  checkError(err, "getting binary");
+
+  // Create and build a new program from the binary
+  cl_int status;
+  program = clCreateProgramWithBinary(cl.context, 1, &cl.device, &size,
+                                      (const unsigned char**)&binary,
+                                      &status, &err);
+  checkError(err, "creating program from binary");
+  checkError(status, "loading binary");
+  free(binary);
+
+  err = clBuildProgram(program, 1, &cl.device, NULL, NULL, NULL);
+  checkError(err, "building program from binary");
+
+  cl_uint numKernels;
+  err = clCreateKernelsInProgram(program, 0, NULL, &numKernels);
+  checkError(err, "counting kernels");
+  printf("kernels = %u\n", numKernels);
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  checkError(err, "creating kernel");
+
+  d_out = clCreateBuffer(cl.context, CL_MEM_WRITE_ONLY, 4, NULL, &err);
+  checkError(err, "creating d_out");
+
+  int x = 6;
+  err  = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_out);
+  err |= clSetKernelArg(kernel, 1, sizeof(int), &x);
+  checkError(err, "setting kernel arguments");
+
+  size_t global[1] = {1};
+  err = clEnqueueNDRangeKernel(cl.queue, kernel,
+                               1, NULL, global, NULL, 0, NULL, NULL);
+  checkError(err, "enqueuing kernel");
+
+  int h_out;
+  err = clEnqueueReadBuffer(cl.queue, d_out, CL_TRUE, 0, 4, &h_out,
+                            0, NULL, NULL);
+  checkError(err, "reading buffer");
+
+  printf("out = %d\n", h_out);
+
+  clReleaseMemObject(d_out);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+  releaseContext(cl);
+
+  return 0;
+}
@@ -0,0 +1,122 @@
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HEADER "program_cache.h"
+
+const char *SOURCE =
+"// %ld %ld                               \n"
+"#include \"" HEADER "\"                  \n"
+"#warning cached warning                  \n"
+"kernel void test_kernel(global int *out) \n"
+"{                                        \n"
+"  *out = VALUE;                          \n"
+"}                                        \n"
+;
+
+static void setEnv(const char *name, const char *value)
+{
+#if defined(_WIN32)
+  _putenv_s(name, value);
+#else
+  setenv(name, value, 1);
+#endif
+}
+
+static void writeHeader(int value)
+{
+  FILE *header = fopen(HEADER, "w");
+  if (!header)
+  {
+    fprintf(stderr, "Unable to write " HEADER "\n");
+    exit(1);
+  }
+  fprintf(header, "#define VALUE %d\n", value);
+  fclose(header);
+}
+
+void run(Context cl, const char *source)
+{
+  cl_int err;
+  cl_program program;
+  cl_kernel kernel;
+  cl_mem d_out;
+
+  program = clCreateProgramWithSource(cl.context, 1, &source, NULL, &err);
+  checkError(err, "creating program");
+
+  err = clBuildProgram(program, 1, &cl.device, "-I .", NULL, NULL);
+  checkError(err, "building program");
+
+  // Warnings must be reported whether or not the cache was used
+  size_t sz;
+  err = clGetProgramBuildInfo(program, cl.device, CL_PROGRAM_BUILD_LOG,
+                              0, NULL, &sz);
+  checkError(err, "getting build log size");
+  char *buildLog = malloc(sz);
+  err = clGetProgramBuildInfo(program, cl.device, CL_PROGRAM_BUILD_LOG,
+                              sz, buildLog, NULL);
+  checkError(err, "getting build log");
+  printf("warning %s\n",
+         strstr(buildLog, "cached warning") ? "reported" : "missing");
+  free(buildLog);
+
+  kernel = clCreateKernel(program, "test_kernel", &err);
+  checkError(err, "creating kernel");
+
+  d_out = clCreateBuffer(cl.context, CL_MEM_WRITE_ONLY, 4, NULL, &err);
+  checkError(err, "creating d_out");
+
+  err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_out);
+  checkError(err, "setting kernel argument");
+
+  size_t global[1] = {1};
+  err = clEnqueueNDRangeKernel(cl.queue, kernel,
+                               1, NULL, global, NULL, 0, NULL, NULL);
+  checkError(err, "enqueuing kernel");
+
+  int h_out;
+  err = clEnqueueReadBuffer(cl.queue, d_out, CL_TRUE, 0, 4, &h_out,
+                            0, NULL, NULL);
+  checkError(err, "reading buffer");
+
+  printf("out = %d\n", h_out);
+
+  clReleaseMemObject(d_out);
+  clReleaseKernel(kernel);
+  clReleaseProgram(program);
+}
+
+int main(int argc, char *argv[])
+{
+  Context cl = createContext("", NULL);
+
+  setEnv("OCLGRIND_CACHE_DIR", "program_cache");
+  setEnv("OCLGRIND_CACHE_STATS", "1");
+
+  // Make the source unique, so that entries from earlier runs are not used
+  char source[1024];
+  sprintf(source, SOURCE, (long)time(NULL), (long)clock());
+
+  // Miss, then hit
+  writeHeader(1);
+  run(cl, source);
+  run(cl, source);
+
+  // Changing an included file must invalidate the entry
+  writeHeader(2);
+  run(cl, source);
+
+  releaseContext(cl);
+
+  // Cache statistics are written to stderr at exit
+  fflush(stdout);
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include "common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static cl_int getStatus(cl_event event)
+{
+  cl_int status;
+  cl_int err = clGetEventInfo(event, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                              sizeof(status), &status, NULL);
+  checkError(err, "getting event status");
+  return status;
+}
+
+static int readValue(Context cl, cl_mem buffer)
+{
+  int value;
+  cl_int err = clEnqueueReadBuffer(cl.queue, buffer, CL_TRUE, 0, 4, &value,
+                                   0, NULL, NULL);
+  checkError(err, "reading buffer");
+  return value;
+}
+
+int main(int argc, char *argv[])
+{
+  cl_int err;
+  cl_mem buffer;
+  cl_event user, write, next;
+  static const int values[] = {1, 2, 3};
+
+  Context cl = createContext("", NULL);
+
+  buffer = clCreateBuffer(cl.context, CL_MEM_READ_WRITE, 4, NULL, &err);
+  checkError(err, "creating buffer");
+
+  // Completing a user event must release the commands waiting for it
+  user = clCreateUserEvent(cl.context, &err);
+  checkError(err, "creating user event");
+  err = clEnqueueWriteBuffer(cl.queue, buffer, CL_FALSE, 0, 4, values+0,
+                             1, &user, &write);
+  checkError(err, "enqueuing write");
+  err = clSetUserEventStatus(user, CL_COMPLETE);
+  checkError(err, "completing user event");
+  err = clWaitForEvents(1, &write);
+  checkError(err, "waiting for write");
+  printf("write %s\n", getStatus(write) == CL_COMPLETE ? "complete" : "failed");
+  printf("out = %d\n", readValue(cl, buffer));
+  clReleaseEvent(write);
+  clReleaseEvent(user);
+
+  // Commands waiting for a failed event, directly or through another
+  // command, must fail without executing
+  user = clCreateUserEvent(cl.context, &err);
+  checkError(err, "creating user event");
+  err = clEnqueueWriteBuffer(cl.queue, buffer, CL_FALSE, 0, 4, values+1,
+                             1, &user, &write);
+  checkError(err, "enqueuing write");
+  err = clEnqueueWriteBuffer(cl.queue, buffer, CL_FALSE, 0, 4, values+2,
+                             1, &write, &next);
+  checkError(err, "enqueuing write");
+  err = clSetUserEventStatus(user, -1);
+  checkError(err, "failing user event");
+  err = clFinish(cl.queue);
+  checkError(err, "finishing queue");
+  printf("write %s\n", getStatus(write) < 0 ? "failed" : "executed");
+  printf("next write %s\n", getStatus(next) < 0 ? "failed" : "executed");
+  printf("out = %d\n", readValue(cl, buffer));
+  clReleaseEvent(next);
+  clReleaseEvent(write);
+  clReleaseEvent(user);
+
+  // Commands that follow a failed command in an in-order queue must also
+  // fail, even though they do not wait for it explicitly
+  user = clCreateUserEvent(cl.context, &err);
+  checkError(err, "creating user event");
+  err = clEnqueueWriteBuffer(cl.queue, buffer, CL_FALSE, 0, 4, values+1,
+                             1, &user, &write);
+  checkError(err, "enqueuing write");
+  err = clEnqueueWriteBuffer(cl.queue, buffer, CL_FALSE, 0, 4, values+2,
+                             0, NULL, &next);
+  checkError(err, "enqueuing write");
+  err = clSetUserEventStatus(user, -1);
+  checkError(err, "failing user event");
+  err = clFinish(cl.queue);
+  checkError(err, "finishing queue");
+  printf("write %s\n", getStatus(write) < 0 ? "failed" : "executed");
+  printf("in-order write %s\n", getStatus(next) < 0 ? "failed" : "executed");
+  printf("out = %d\n", readValue(cl, buffer));
+  clReleaseEvent(next);
+  clReleaseEvent(write);
+  clReleaseEvent(user);
+
+  clReleaseMemObject(buffer);
+  releaseContext(cl);
+
+  return 0;
+}